@@ -0,0 +1,203 @@
+#!/usr/bin/env python
+
+"""
+Estimate the cost of the clock and timer hot paths on the ARM968 from the
+disassembly of cross-compiled objects (using arm-none-eabi-objdump).
+
+For each function, the number of instructions and an estimate of the number of
+cycles are produced by summing over every instruction in the function (i.e.
+every branch taken once, loops once) using the ARM9E-S instruction timings
+(ignoring interlocks and memory wait states). The inclusive cycle count also
+adds the cost of every call made to other functions found in the objects.
+Calls to functions which are not in the objects (e.g. the compiler's division
+routines) are listed but not costed.
+
+Output is a table with columns
+function,instructions,static_cycles,inclusive_cycles,calls
+and with -c the inclusive cycle counts are compared with a previously recorded
+table: the script exits with status 1 if any function has grown by more than
+the tolerance (-t, percent, default 10).
+
+Usage:
+	python arm_static_cost.py [-c baseline.tsv] [-t tolerance] object.o... [function...]
+"""
+
+import getopt
+import os
+import re
+import subprocess
+import sys
+
+# The objdump to use (may be overridden with the OBJDUMP environment variable)
+OBJDUMP = os.environ.get("OBJDUMP", "arm-none-eabi-objdump")
+
+DEFAULT_FUNCTIONS = [
+	"dclk_get_time",
+	"dclk_get_time_fp",
+	"dclk_add_correction",
+	"dclk_get_ticks_until_time",
+	"dtimer_schedule_next_interrupt",
+	"dtimer_update_schedule",
+	"dclk_get_raw_time_at",
+]
+
+CONDITIONS = ("eq", "ne", "cs", "hs", "cc", "lo", "mi", "pl",
+              "vs", "vc", "hi", "ls", "ge", "lt", "gt", "le", "al")
+
+# Base mnemonics (longest first so that prefixes do not match early) and their
+# cost in cycles. Instructions not listed are single-cycle data processing.
+COSTS = [
+	("smlal", 3), ("umlal", 3), ("smull", 3), ("umull", 3),
+	("smla", 1), ("smul", 1),
+	("mla", 2), ("mul", 2),
+	("push", None), ("pop", None), ("ldm", None), ("stm", None),
+	("ldr", 1), ("str", 1),
+	("swp", 2),
+	("blx", 3), ("bx", 3), ("bl", 3), ("b", 3),
+]
+
+function_re = re.compile(r"^[0-9a-f]+ <([^>]+)>:$")
+instruction_re = re.compile(r"^\s*[0-9a-f]+:\s+[0-9a-f]{8}\s+(\S+)\s*(.*)$")
+call_re = re.compile(r"<([^>+]+)>")
+shift_by_register_re = re.compile(r",\s*(lsl|lsr|asr|ror)\s+r\d+")
+
+
+# Find the base mnemonic of an instruction (without condition code or suffixes)
+# and whether it is conditional.
+def base_mnemonic(mnemonic):
+	for base, _ in COSTS:
+		if mnemonic.startswith(base):
+			rest = mnemonic[len(base):]
+			if base == "b" and rest not in ("",) + CONDITIONS:
+				continue
+			return base, rest[:2] in CONDITIONS and rest[:2] != "al"
+	return mnemonic, mnemonic[-2:] in CONDITIONS
+
+
+# Estimated cycles for one instruction
+def instruction_cycles(mnemonic, operands):
+	base, _ = base_mnemonic(mnemonic)
+	
+	if base in ("push", "pop", "ldm", "stm"):
+		registers = operands[operands.find("{"):operands.find("}")]
+		count = 0
+		for part in registers.strip("{}").split(","):
+			if "-" in part:
+				lo, hi = part.strip().split("-")
+				count += int(hi.strip()[1:]) - int(lo.strip()[1:]) + 1
+			elif part.strip():
+				count += 1
+		cycles = max(count, 2)
+		if base in ("pop", "ldm") and "pc" in registers:
+			cycles += 4
+		return cycles
+	
+	for name, cost in COSTS:
+		if name == base:
+			# Loads to the PC are branches
+			if base == "ldr" and operands.startswith("pc,"):
+				return 5
+			return cost
+	
+	# Data processing
+	cycles = 1
+	if shift_by_register_re.search(operands):
+		cycles += 1
+	if operands.startswith("pc,"):
+		cycles += 2
+	return cycles
+
+
+# Disassemble objects, returning {function: [(mnemonic, operands), ...]}
+def disassemble(objects):
+	functions = {}
+	current = None
+	output = subprocess.check_output([OBJDUMP, "-d", "--no-show-raw-insn"] + objects)
+	# Some versions of objdump ignore --no-show-raw-insn: accept either form
+	instruction_short_re = re.compile(r"^\s*[0-9a-f]+:\s+(\S+)\s*(.*)$")
+	for line in output.decode().splitlines():
+		match = function_re.match(line)
+		if match:
+			current = functions.setdefault(match.group(1), [])
+			continue
+		if current is None:
+			continue
+		match = instruction_re.match(line) or instruction_short_re.match(line)
+		if match and not match.group(1).startswith("."):
+			operands = match.group(2).split(";")[0].strip()
+			current.append((match.group(1), operands))
+	return functions
+
+
+# Functions called by a function
+def callees(instructions):
+	calls = []
+	for mnemonic, operands in instructions:
+		base, _ = base_mnemonic(mnemonic)
+		if base in ("bl", "blx"):
+			match = call_re.search(operands)
+			if match:
+				calls.append(match.group(1))
+	return calls
+
+
+def static_cycles(instructions):
+	return sum(instruction_cycles(m, o) for m, o in instructions)
+
+
+def inclusive_cycles(name, functions, stack=()):
+	if name not in functions or name in stack:
+		return 0
+	instructions = functions[name]
+	return static_cycles(instructions) + sum(
+		inclusive_cycles(callee, functions, stack + (name,))
+		for callee in callees(instructions))
+
+
+def read_baseline(filename):
+	baseline = {}
+	with open(filename, "r") as f:
+		for line in f:
+			if line.startswith("#") or not line.strip():
+				continue
+			fields = line.rstrip("\n").split("\t")
+			baseline[fields[0]] = int(fields[3])
+	return baseline
+
+
+if __name__ == "__main__":
+	opts, args = getopt.getopt(sys.argv[1:], "c:t:")
+	opts = dict(opts)
+	tolerance = float(opts.get("-t", 10)) / 100.0
+	
+	objects = [a for a in args if a.endswith(".o") or a.endswith(".elf")]
+	names = [a for a in args if a not in objects] or DEFAULT_FUNCTIONS
+	
+	functions = disassemble(objects)
+	
+	results = {}
+	print("#function\tinstructions\tstatic_cycles\tinclusive_cycles\tcalls")
+	for name in names:
+		if name not in functions:
+			sys.stderr.write("%s not found\n"%name)
+			continue
+		instructions = functions[name]
+		results[name] = inclusive_cycles(name, functions)
+		print("%s\t%d\t%d\t%d\t%s"%(
+			name,
+			len(instructions),
+			static_cycles(instructions),
+			results[name],
+			",".join(sorted(set(callees(instructions)))) or "-"))
+	
+	if "-c" in opts:
+		regressions = 0
+		for name, old in read_baseline(opts["-c"]).items():
+			if name not in results:
+				continue
+			regressed = results[name] > old * (1.0 + tolerance)
+			regressions += regressed
+			sys.stderr.write("%s: %d -> %d cycles%s\n"%(
+				name, old, results[name], " REGRESSION" if regressed else ""))
+		if regressions:
+			sys.exit(1)
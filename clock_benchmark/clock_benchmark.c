@@ -0,0 +1,609 @@
+/**
+ * Microbenchmarks of the clock and timer hot paths (dclk_get_time,
+ * dclk_get_time_fp, dclk_add_correction, dclk_get_ticks_until_time and
+ * dtimer_schedule_next_interrupt), run on the host.
+ *
+ * dtimer_schedule_next_interrupt is measured both computing each deadline
+ * itself and with every deadline precomputed by dtimer_update_schedule
+ * (untimed) beforehand, for which the schedule is made large enough for a
+ * whole block.
+ *
+ * Each function is called with a representative distribution of clock states:
+ * states taken from clocks (with random frequency offsets and correction
+ * jitter) which have just been set ("initial"), are still settling ("settling")
+ * and have been locked for some time ("locked"). Calls are made in blocks of
+ * BLOCK_CALLS, each on a copy of one of the states, and the cost of the loop
+ * itself (measured by calling an empty function in the same way) is subtracted.
+ * The cheapest of several blocks is taken as the cost for each state and the
+ * mean over the states is reported.
+ *
+ * Costs are measured using the hardware cycle and instruction counters (via
+ * perf_event_open) where available. Otherwise the time-stamp counter (x86) or
+ * the monotonic clock is used alone.
+ *
+ * Usage:
+ *   clock_benchmark [-n calls] [-c baseline.tsv] [-t tolerance_percent]
+ *
+ * Results are printed to stdout. With -c, they are also compared with a
+ * previously recorded set of results and the program exits with status 1 if
+ * any benchmark has become more expensive by more than the tolerance (default
+ * 10%). Instruction counts are compared where both sets have them, otherwise
+ * cycles (if measured in the same way) and otherwise time. Timing measurements
+ * are much noisier than instruction counts and so are always allowed at least
+ * TIMING_TOLERANCE.
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Number of consecutive calls made on each state
+#define BLOCK_CALLS 256
+
+// Every interrupt in a block must have been precomputed for the
+// dtimer_schedule_next_interrupt_precomputed benchmark so the timer is built
+// in with a schedule of that size.
+#define DTIMER_SCHEDULE_SIZE BLOCK_CALLS
+
+#include "disciplined_clock.h"
+#include "disciplined_timer.h"
+#include "disciplined_timer.c"
+#include "tb_rng.h"
+
+
+// Default total number of calls made to each function for each state class
+#define DEFAULT_CALLS 1000000
+
+// Number of states in each class
+#define NUM_STATES 64
+
+// Number of times each measurement is repeated (in addition to making the
+// requested number of calls)
+#define NUM_REPEATS 5
+
+// Number of corrections received by the states of each class
+#define INITIAL_CORRECTIONS  1
+#define SETTLING_CORRECTIONS 10
+#define LOCKED_CORRECTIONS   300
+
+// Nominal timer frequency (Hz), interval between corrections (ticks) and the
+// range of the clocks' frequency offsets (+/- ppm) and correction jitter
+// standard deviation (ticks)
+#define CLOCK_FREQ          (200000000.0/16.0)
+#define POLL_TICKS          ((dclk_time_t)CLOCK_FREQ)
+#define MAX_FREQ_OFFSET_PPM 30.0
+#define JITTER_SD           3.0
+
+// Period of the disciplined timer's interrupts (ticks), as in spinn_time
+#define INTERRUPT_PERIOD_TICKS 1250
+
+// Minimum tolerance when comparing cycle counts or times with recorded results
+#define TIMING_TOLERANCE 0.30
+
+// Ways of measuring cost
+#define COUNTER_PERF  0
+#define COUNTER_TSC   1
+#define COUNTER_CLOCK 2
+
+static const char *COUNTER_NAMES[] = {"perf", "tsc", "clock"};
+
+
+// A class of states on which to run the benchmarks
+typedef struct {
+	const char *name;
+	uint32_t num_corrections;
+	
+	dclk_state_t states[NUM_STATES];
+	
+	// The raw time at which each state was produced
+	dclk_time_t raw_times[NUM_STATES];
+} state_class_t;
+
+// A function to benchmark: called with a state, the number of the call within
+// the block and the state's raw time at the start of the block.
+typedef void (*bench_fn_t)(volatile dclk_state_t *state, uint32_t i, dclk_time_t base);
+
+typedef struct {
+	const char *name;
+	
+	// Called (untimed) before each block
+	bench_fn_t setup;
+	
+	bench_fn_t call;
+} benchmark_t;
+
+// Costs per call
+typedef struct {
+	double cycles;
+	double instructions;
+	double ns;
+} cost_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Hardware emulation
+////////////////////////////////////////////////////////////////////////////////
+
+// The raw clock seen by the library
+static volatile dclk_time_t raw_time;
+
+dclk_time_t
+dclk_read_raw_time(void)
+{
+	return raw_time;
+}
+
+// Timer registers written by the disciplined timer (see host_emulation)
+static volatile uint timer_regs[3][8];
+
+volatile uint *
+emu_timer_regs(uint timer)
+{
+	return timer_regs[timer];
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Benchmarks
+////////////////////////////////////////////////////////////////////////////////
+
+// Per-call arguments, generated before timing
+static dclk_time_t get_time_deltas[BLOCK_CALLS];
+static dclk_offset_t corrections[BLOCK_CALLS];
+static dclk_time_t lookaheads[BLOCK_CALLS];
+static dclk_offset_t interrupt_latencies[BLOCK_CALLS];
+
+// Results are written here so that calls are not optimised away
+static volatile dclk_time_t sink;
+static volatile dclk_fp_time_t fp_sink;
+
+static void
+bench_null(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	raw_time = base + get_time_deltas[i];
+	sink = i;
+}
+
+
+static void
+bench_get_time(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	// Times increase through the block (as between two corrections)
+	raw_time = base + get_time_deltas[i];
+	sink = dclk_get_time(state);
+}
+
+
+static void
+bench_get_time_fp(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	raw_time = base + get_time_deltas[i];
+	fp_sink = dclk_get_time_fp(state);
+}
+
+
+static void
+bench_add_correction(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	raw_time = base + ((i + 1) * POLL_TICKS);
+	dclk_add_correction(state, corrections[i]);
+}
+
+
+static void
+bench_get_ticks_until_time(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	raw_time = base + get_time_deltas[i];
+	sink = dclk_get_ticks_until_time(state, state->last_corrected_time + lookaheads[i]);
+}
+
+
+static void
+setup_schedule_next_interrupt(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	raw_time = base;
+	dtimer_start_interrupts(state, dclk_get_time(state) + INTERRUPT_PERIOD_TICKS, INTERRUPT_PERIOD_TICKS);
+}
+
+
+static void
+bench_schedule_next_interrupt(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	// Each call is an interrupt arriving (slightly late) one period after the
+	// last
+	raw_time = base + ((i + 1) * INTERRUPT_PERIOD_TICKS) + interrupt_latencies[i];
+	sink = dtimer_schedule_next_interrupt();
+}
+
+
+static void
+setup_schedule_next_interrupt_precomputed(volatile dclk_state_t *state, uint32_t i, dclk_time_t base)
+{
+	setup_schedule_next_interrupt(state, i, base);
+	dtimer_update_schedule();
+}
+
+
+static const benchmark_t BENCHMARKS[] = {
+	{"dclk_get_time",                  NULL, bench_get_time},
+	{"dclk_get_time_fp",               NULL, bench_get_time_fp},
+	{"dclk_add_correction",            NULL, bench_add_correction},
+	{"dclk_get_ticks_until_time",      NULL, bench_get_ticks_until_time},
+	{"dtimer_schedule_next_interrupt", setup_schedule_next_interrupt, bench_schedule_next_interrupt},
+	{"dtimer_schedule_next_interrupt_precomputed", setup_schedule_next_interrupt_precomputed, bench_schedule_next_interrupt},
+};
+
+#define NUM_BENCHMARKS (sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]))
+
+static const benchmark_t NULL_BENCHMARK = {"null", NULL, bench_null};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// States
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Produce the states of a class by applying corrections to clocks with random
+ * frequency offsets.
+ */
+static void
+generate_states(state_class_t *class, tb_rng_t *rng)
+{
+	for (int s = 0; s < NUM_STATES; s++) {
+		double freq_offset = ((2.0 * tb_rng_uniform(rng)) - 1.0) * MAX_FREQ_OFFSET_PPM * 1e-6;
+		double start = tb_rng_uniform(rng) * 4294967296.0;
+		
+		volatile dclk_state_t *state = &(class->states[s]);
+		raw_time = (dclk_time_t)start;
+		dclk_initialise_state(state);
+		
+		for (uint32_t n = 0; n < class->num_corrections; n++) {
+			double master = (double)n * POLL_TICKS;
+			raw_time = (dclk_time_t)(uint64_t)(start + (master * (1.0 + freq_offset)));
+			dclk_offset_t correction = (dclk_time_t)(uint64_t)master - dclk_get_time(state);
+			correction += tb_rng_gaussian(rng, JITTER_SD*JITTER_SD);
+			if (n == 0)
+				dclk_correct_phase_now(state, correction);
+			else
+				dclk_add_correction(state, correction);
+		}
+		
+		class->raw_times[s] = raw_time;
+	}
+}
+
+
+static void
+generate_arguments(tb_rng_t *rng)
+{
+	dclk_time_t t = 0;
+	for (int i = 0; i < BLOCK_CALLS; i++) {
+		t += (dclk_time_t)(tb_rng_uniform(rng) * (2.0 * POLL_TICKS / BLOCK_CALLS));
+		get_time_deltas[i] = t;
+		corrections[i] = (dclk_offset_t)lround(tb_rng_gaussian(rng, JITTER_SD*JITTER_SD));
+		lookaheads[i] = (dclk_time_t)(tb_rng_uniform(rng) * 2 * INTERRUPT_PERIOD_TICKS);
+		interrupt_latencies[i] = (dclk_offset_t)(tb_rng_uniform(rng) * 8);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Counters
+////////////////////////////////////////////////////////////////////////////////
+
+static int counter = COUNTER_CLOCK;
+
+// perf_event_open file descriptors (cycles is the group leader)
+static int cycles_fd = -1;
+static int instructions_fd = -1;
+
+
+static int
+open_perf_counter(uint64_t config, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.disabled = (group_fd == -1);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_GROUP;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+
+/**
+ * Choose the best available way of measuring cost.
+ */
+static void
+open_counters(void)
+{
+	cycles_fd = open_perf_counter(PERF_COUNT_HW_CPU_CYCLES, -1);
+	if (cycles_fd >= 0)
+		instructions_fd = open_perf_counter(PERF_COUNT_HW_INSTRUCTIONS, cycles_fd);
+	if (cycles_fd >= 0 && instructions_fd >= 0) {
+		ioctl(cycles_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		counter = COUNTER_PERF;
+		return;
+	}
+	
+	if (cycles_fd >= 0)
+		close(cycles_fd);
+	#if defined(__x86_64__) || defined(__i386__)
+	counter = COUNTER_TSC;
+	#else
+	counter = COUNTER_CLOCK;
+	#endif
+}
+
+
+/**
+ * Read the current cycle and instruction counts (zero if not available).
+ */
+static inline void
+read_counters(uint64_t *cycles, uint64_t *instructions)
+{
+	*cycles = 0;
+	*instructions = 0;
+	
+	if (counter == COUNTER_PERF) {
+		uint64_t values[3];
+		if (read(cycles_fd, values, sizeof(values)) == sizeof(values)) {
+			*cycles = values[1];
+			*instructions = values[2];
+		}
+	}
+	#if defined(__x86_64__) || defined(__i386__)
+	else if (counter == COUNTER_TSC) {
+		*cycles = __rdtsc();
+	}
+	#endif
+}
+
+
+static double
+now_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (t.tv_sec * 1e9) + t.tv_nsec;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Measurement
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Measure the cost per call of a benchmark on a class of states (including the
+ * loop overhead). Each state is measured in several blocks of calls and its
+ * cheapest block is taken as its cost (excluding interference from interrupts
+ * and other processes); the mean cost over all states is returned.
+ */
+static cost_t
+measure(const benchmark_t *benchmark, const state_class_t *class, uint32_t num_calls)
+{
+	uint32_t blocks_per_state = (num_calls + (BLOCK_CALLS * NUM_STATES) - 1)
+	                          / (BLOCK_CALLS * NUM_STATES);
+	cost_t best[NUM_STATES];
+	for (int s = 0; s < NUM_STATES; s++)
+		best[s] = (cost_t){INFINITY, INFINITY, INFINITY};
+	
+	for (uint32_t block = 0; block < blocks_per_state * NUM_REPEATS; block++) {
+		for (int s = 0; s < NUM_STATES; s++) {
+			volatile dclk_state_t state = class->states[s];
+			dclk_time_t base = class->raw_times[s];
+			if (benchmark->setup)
+				benchmark->setup(&state, 0, base);
+			
+			uint64_t cycles_start, instructions_start, cycles_end, instructions_end;
+			double ns_start = now_ns();
+			read_counters(&cycles_start, &instructions_start);
+			for (uint32_t i = 0; i < BLOCK_CALLS; i++)
+				benchmark->call(&state, i, base);
+			read_counters(&cycles_end, &instructions_end);
+			double ns_end = now_ns();
+			
+			best[s].cycles = fmin(best[s].cycles, (double)(cycles_end - cycles_start) / BLOCK_CALLS);
+			best[s].instructions = fmin(best[s].instructions, (double)(instructions_end - instructions_start) / BLOCK_CALLS);
+			best[s].ns = fmin(best[s].ns, (ns_end - ns_start) / BLOCK_CALLS);
+		}
+	}
+	
+	cost_t mean = {0.0, 0.0, 0.0};
+	for (int s = 0; s < NUM_STATES; s++) {
+		mean.cycles += best[s].cycles / NUM_STATES;
+		mean.instructions += best[s].instructions / NUM_STATES;
+		mean.ns += best[s].ns / NUM_STATES;
+	}
+	
+	return mean;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Comparison with recorded results
+////////////////////////////////////////////////////////////////////////////////
+
+// A recorded result
+typedef struct {
+	char benchmark[64];
+	char states[64];
+	char counter[16];
+	cost_t cost;
+} result_t;
+
+#define MAX_RESULTS 64
+
+static result_t results[MAX_RESULTS];
+static int num_results = 0;
+
+
+static int
+read_results(const char *filename, result_t *out, int max)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		fprintf(stderr, "Could not open %s.\n", filename);
+		exit(1);
+	}
+	
+	char line[512];
+	int n = 0;
+	while (n < max && fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		unsigned long calls;
+		result_t *r = &(out[n]);
+		if (sscanf( line, "%63s %63s %15s %lu %lf %lf %lf"
+		          , r->benchmark, r->states, r->counter, &calls
+		          , &(r->cost.cycles), &(r->cost.instructions), &(r->cost.ns)
+		          ) == 7)
+			n++;
+	}
+	
+	fclose(f);
+	return n;
+}
+
+
+/**
+ * Compare the results with a baseline. Returns the number of regressions.
+ */
+static int
+compare_results(const char *filename, double tolerance)
+{
+	result_t baseline[MAX_RESULTS];
+	int num_baseline = read_results(filename, baseline, MAX_RESULTS);
+	
+	int regressions = 0;
+	for (int i = 0; i < num_results; i++) {
+		result_t *r = &(results[i]);
+		result_t *b = NULL;
+		for (int j = 0; j < num_baseline; j++)
+			if ( strcmp(r->benchmark, baseline[j].benchmark) == 0
+			     && strcmp(r->states, baseline[j].states) == 0
+			   )
+				b = &(baseline[j]);
+		if (!b) {
+			fprintf(stderr, "%s (%s): no baseline\n", r->benchmark, r->states);
+			continue;
+		}
+		
+		// Compare the most reliable measure both results have
+		const char *measure;
+		double old, new;
+		if (strcmp(r->counter, "perf") == 0 && strcmp(b->counter, "perf") == 0) {
+			measure = "instructions";
+			old = b->cost.instructions;
+			new = r->cost.instructions;
+		} else if (strcmp(r->counter, b->counter) == 0 && strcmp(r->counter, "clock") != 0) {
+			measure = "cycles";
+			old = b->cost.cycles;
+			new = r->cost.cycles;
+		} else {
+			measure = "ns";
+			old = b->cost.ns;
+			new = r->cost.ns;
+		}
+		
+		double allowed = tolerance;
+		if (strcmp(measure, "instructions") != 0)
+			allowed = fmax(allowed, TIMING_TOLERANCE);
+		
+		bool regressed = new > old * (1.0 + allowed);
+		regressions += regressed;
+		fprintf( stderr, "%s (%s): %.1f -> %.1f %s per call%s\n"
+		       , r->benchmark, r->states, old, new, measure
+		       , regressed ? " REGRESSION" : ""
+		       );
+	}
+	
+	return regressions;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	uint32_t num_calls = DEFAULT_CALLS;
+	const char *baseline = NULL;
+	double tolerance = 0.10;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "n:c:t:")) != -1) {
+		if (opt == 'n') {
+			num_calls = strtoul(optarg, NULL, 0);
+		} else if (opt == 'c') {
+			baseline = optarg;
+		} else if (opt == 't') {
+			tolerance = atof(optarg) / 100.0;
+		} else {
+			fprintf(stderr, "usage: %s [-n calls] [-c baseline.tsv] [-t tolerance_percent]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	tb_rng_t rng;
+	tb_rng_init(&rng, 0);
+	generate_arguments(&rng);
+	
+	static state_class_t classes[] = {
+		{"initial",  INITIAL_CORRECTIONS},
+		{"settling", SETTLING_CORRECTIONS},
+		{"locked",   LOCKED_CORRECTIONS},
+	};
+	int num_classes = sizeof(classes) / sizeof(classes[0]);
+	for (int c = 0; c < num_classes; c++)
+		generate_states(&(classes[c]), &rng);
+	
+	open_counters();
+	
+	printf("#benchmark\tstates\tcounter\tcalls\tcycles_per_call\tinstructions_per_call\tns_per_call\n");
+	for (int c = 0; c < num_classes; c++) {
+		cost_t overhead = measure(&NULL_BENCHMARK, &(classes[c]), num_calls);
+		
+		for (uint32_t b = 0; b < NUM_BENCHMARKS; b++) {
+			cost_t cost = measure(&(BENCHMARKS[b]), &(classes[c]), num_calls);
+			cost.cycles = fmax(0.0, cost.cycles - overhead.cycles);
+			cost.instructions = fmax(0.0, cost.instructions - overhead.instructions);
+			cost.ns = fmax(0.0, cost.ns - overhead.ns);
+			
+			if (num_results < MAX_RESULTS) {
+				result_t *r = &(results[num_results++]);
+				snprintf(r->benchmark, sizeof(r->benchmark), "%s", BENCHMARKS[b].name);
+				snprintf(r->states, sizeof(r->states), "%s", classes[c].name);
+				snprintf(r->counter, sizeof(r->counter), "%s", COUNTER_NAMES[counter]);
+				r->cost = cost;
+			}
+			
+			printf( "%s\t%s\t%s\t%u\t%.1f\t%.1f\t%.2f\n"
+			      , BENCHMARKS[b].name, classes[c].name, COUNTER_NAMES[counter]
+			      , num_calls, cost.cycles, cost.instructions, cost.ns
+			      );
+		}
+	}
+	
+	if (baseline && compare_results(baseline, tolerance))
+		return 1;
+	
+	return 0;
+}
@@ -0,0 +1,429 @@
+/**
+ * Replays correction streams recorded on a real machine through the clock
+ * discipline algorithm, predicting how every chip's clock would have behaved
+ * under other discipline parameters (or another implementation of the
+ * algorithm).
+ *
+ * The corrections recorded by spinn_time (as read by read_spinn_time_results.py
+ * or pack_spinn_time_results) are the errors of each slave's corrected clock
+ * and so depend on the algorithm which produced them. Replay therefore takes
+ * two steps, each run by a build of this program linked with the algorithm in
+ * question:
+ *
+ * 1. With -i, the recorded corrections are fed through this build's algorithm
+ *    (which must be the one used to record them) to infer the offset of each
+ *    chip's raw clock from the master's at each correction. The offsets are
+ *    printed in the same CSV format (x,y,num,offset).
+ * 2. Without -i, the inferred offsets are fed through this build's algorithm
+ *    (e.g. compiled with different DCLK_* parameters), predicting the
+ *    corrections (i.e. errors) it would have seen.
+ *
+ * Corrections are assumed to have been made every poll period (one full scan
+ * of the master, see UPDATE_INTERVAL in spinn_time_common.h) on the slave's
+ * raw clock. Slave frequency offsets of a few ppm make no appreciable
+ * difference to this timing. As only the corrections are recorded, errors are
+ * only known when corrections are made and include the jitter of the recorded
+ * measurements.
+ *
+ * Usage:
+ *   dclk_replay -i [-p poll_period_s] corrections.csv > offsets.csv
+ *   dclk_replay [-j threads] [-p poll_period_s] offsets.csv
+ *
+ * Without -i, per-chip results are printed to stdout (one line per chip, in x,
+ * y order) and a summary of their distributions to stderr.
+ */
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "disciplined_clock.h"
+
+
+// Default interval between corrections to each chip (s)
+#define DEFAULT_POLL_PERIOD 1.0
+
+// Nominal frequency of the clocks (Hz)
+#define CLOCK_FREQ (200000000.0/16.0)
+
+// Conversion from clock ticks to ns
+#define TICKS_TO_NS (1000000000.0 / CLOCK_FREQ)
+
+
+// A line of the input
+typedef struct {
+	uint32_t x;
+	uint32_t y;
+	uint32_t num;
+	dclk_offset_t value;
+} sample_t;
+
+// The samples of one chip (a range of the sorted input) and the result of
+// replaying them.
+typedef struct {
+	uint32_t x;
+	uint32_t y;
+	
+	sample_t *samples;
+	uint32_t num_samples;
+	
+	// Inferred offsets (with -i) or predicted corrections
+	dclk_offset_t *output;
+	
+	bool locked;
+	double time_to_lock; // s
+	double rms_error; // ns, after locking
+	double max_error; // ns, after locking
+} chip_t;
+
+// Work shared between replay threads
+typedef struct {
+	bool infer;
+	dclk_time_t poll_ticks;
+	
+	chip_t *chips;
+	uint32_t num_chips;
+	
+	pthread_mutex_t lock;
+	uint32_t next_chip;
+} replay_work_t;
+
+
+// The raw slave clock seen by the disciplined clock library. Each thread
+// replays one chip at a time and so has its own slave clock.
+static __thread dclk_time_t slave_time;
+
+dclk_time_t
+dclk_read_raw_time(void)
+{
+	return slave_time;
+}
+
+
+/**
+ * Replay a chip's samples. The clock is set (with an error of zero) at raw
+ * time zero and the samples are taken every poll_ticks thereafter. When
+ * inferring, the samples are the corrections made and the outputs the raw
+ * clock offsets, otherwise the other way around.
+ */
+static void
+replay_chip(chip_t *chip, bool infer, dclk_time_t poll_ticks)
+{
+	dclk_state_t dclk;
+	slave_time = 0;
+	dclk_initialise_state(&dclk);
+	dclk_correct_phase_now(&dclk, 0);
+	
+	chip->locked = false;
+	chip->time_to_lock = NAN;
+	double sum_sq_error = 0.0;
+	double max_error = 0.0;
+	uint32_t num_errors = 0;
+	
+	for (uint32_t i = 0; i < chip->num_samples; i++) {
+		slave_time += poll_ticks;
+		
+		// The correction is the master's time less the slave's corrected time,
+		// i.e. the raw clock's offset less the corrected clock's.
+		dclk_offset_t corrected_offset = dclk_get_time(&dclk) - slave_time;
+		dclk_offset_t correction;
+		if (infer) {
+			correction = chip->samples[i].value;
+			chip->output[i] = correction + corrected_offset;
+		} else {
+			correction = chip->samples[i].value - corrected_offset;
+			chip->output[i] = correction;
+		}
+		dclk_add_correction(&dclk, correction);
+		
+		if (dclk_is_locked(&dclk) && !chip->locked) {
+			chip->locked = true;
+			chip->time_to_lock = (i + 1) * (poll_ticks / CLOCK_FREQ);
+		}
+		
+		if (chip->locked) {
+			double error_ns = correction * TICKS_TO_NS;
+			sum_sq_error += error_ns * error_ns;
+			if (fabs(error_ns) > max_error)
+				max_error = fabs(error_ns);
+			num_errors++;
+		}
+	}
+	
+	chip->rms_error = num_errors ? sqrt(sum_sq_error / num_errors) : NAN;
+	chip->max_error = num_errors ? max_error : NAN;
+}
+
+
+static void *
+replay_thread(void *arg)
+{
+	replay_work_t *work = arg;
+	
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		uint32_t i = work->next_chip++;
+		pthread_mutex_unlock(&work->lock);
+		
+		if (i >= work->num_chips)
+			return NULL;
+		
+		replay_chip(&(work->chips[i]), work->infer, work->poll_ticks);
+	}
+}
+
+
+static int
+compare_samples(const void *a_, const void *b_)
+{
+	const sample_t *a = a_;
+	const sample_t *b = b_;
+	if (a->x != b->x)
+		return (a->x > b->x) - (a->x < b->x);
+	if (a->y != b->y)
+		return (a->y > b->y) - (a->y < b->y);
+	return (a->num > b->num) - (a->num < b->num);
+}
+
+
+/**
+ * Read every sample from a CSV file (with a header line) of x,y,num,value
+ * lines and sort them by chip and number. Returns NULL on failure.
+ */
+static sample_t *
+read_samples(const char *filename, uint32_t *num_samples)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		return NULL;
+	}
+	
+	size_t capacity = 1024;
+	sample_t *samples = malloc(capacity * sizeof(sample_t));
+	*num_samples = 0;
+	
+	char line[256];
+	uint32_t line_num = 0;
+	while (samples && fgets(line, sizeof(line), f)) {
+		line_num++;
+		sample_t s;
+		if (sscanf(line, "%u,%u,%u,%d", &s.x, &s.y, &s.num, &s.value) != 4) {
+			if (line_num == 1)
+				continue;
+			fprintf(stderr, "%s:%u: malformed line\n", filename, line_num);
+			free(samples);
+			samples = NULL;
+			break;
+		}
+		
+		if (*num_samples == capacity) {
+			capacity *= 2;
+			sample_t *grown = realloc(samples, capacity * sizeof(sample_t));
+			if (!grown) {
+				free(samples);
+				samples = NULL;
+				break;
+			}
+			samples = grown;
+		}
+		samples[(*num_samples)++] = s;
+	}
+	fclose(f);
+	
+	if (samples)
+		qsort(samples, *num_samples, sizeof(sample_t), compare_samples);
+	return samples;
+}
+
+
+/**
+ * Split the sorted samples into chips, giving each the corresponding range of
+ * the output array. Returns NULL on failure.
+ */
+static chip_t *
+split_chips( sample_t *samples, dclk_offset_t *output, uint32_t num_samples
+           , uint32_t *num_chips
+           )
+{
+	chip_t *chips = calloc(num_samples ? num_samples : 1, sizeof(chip_t));
+	if (!chips)
+		return NULL;
+	
+	chip_t *chip = NULL;
+	*num_chips = 0;
+	for (uint32_t i = 0; i < num_samples; i++) {
+		if (!chip || samples[i].x != chip->x || samples[i].y != chip->y) {
+			chip = &(chips[(*num_chips)++]);
+			chip->x = samples[i].x;
+			chip->y = samples[i].y;
+			chip->samples = &(samples[i]);
+			chip->output = &(output[i]);
+		}
+		chip->num_samples++;
+	}
+	
+	return chips;
+}
+
+
+static int
+compare_doubles(const void *a_, const void *b_)
+{
+	double a = *(const double *)a_;
+	double b = *(const double *)b_;
+	return (a > b) - (a < b);
+}
+
+
+/**
+ * Print a summary of the distribution of values to stderr.
+ */
+static void
+print_distribution(const char *name, double *values, uint32_t n)
+{
+	if (!n) {
+		fprintf(stderr, "%-13s\t-\t-\t-\t-\t-\t-\n", name);
+		return;
+	}
+	
+	qsort(values, n, sizeof(double), compare_doubles);
+	double sum = 0.0;
+	for (uint32_t i = 0; i < n; i++)
+		sum += values[i];
+	fprintf( stderr, "%-13s\t%f\t%f\t%f\t%f\t%f\t%f\n"
+	       , name
+	       , values[0]
+	       , values[(uint32_t)(0.50 * (n - 1))]
+	       , values[(uint32_t)(0.90 * (n - 1))]
+	       , values[(uint32_t)(0.99 * (n - 1))]
+	       , values[n - 1]
+	       , sum / n
+	       );
+}
+
+
+static void
+print_summary(const chip_t *chips, uint32_t num_chips)
+{
+	double *time_to_lock = malloc((num_chips ? num_chips : 1) * sizeof(double));
+	double *rms_error    = malloc((num_chips ? num_chips : 1) * sizeof(double));
+	double *max_error    = malloc((num_chips ? num_chips : 1) * sizeof(double));
+	if (!time_to_lock || !rms_error || !max_error) {
+		free(time_to_lock);
+		free(rms_error);
+		free(max_error);
+		return;
+	}
+	
+	uint32_t num_locked = 0;
+	for (uint32_t i = 0; i < num_chips; i++) {
+		if (!chips[i].locked)
+			continue;
+		time_to_lock[num_locked] = chips[i].time_to_lock;
+		rms_error[num_locked]    = chips[i].rms_error;
+		max_error[num_locked]    = chips[i].max_error;
+		num_locked++;
+	}
+	
+	fprintf(stderr, "%u of %u chips locked.\n", num_locked, num_chips);
+	fprintf(stderr, "#metric      \tmin\tmedian\tp90\tp99\tmax\tmean\n");
+	print_distribution("time_to_lock", time_to_lock, num_locked);
+	print_distribution("rms_error", rms_error, num_locked);
+	print_distribution("max_error", max_error, num_locked);
+	
+	free(time_to_lock);
+	free(rms_error);
+	free(max_error);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	double poll_period = DEFAULT_POLL_PERIOD;
+	bool infer = false;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "ij:p:")) != -1) {
+		switch (opt) {
+			case 'i': infer = true; break;
+			case 'j': num_threads = strtol(optarg, NULL, 0); break;
+			case 'p': poll_period = strtod(optarg, NULL); break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "Usage:\n"
+		                "  %s -i [-p poll_period_s] corrections.csv > offsets.csv\n"
+		                "  %s [-j threads] [-p poll_period_s] offsets.csv\n"
+		       , argv[0], argv[0]);
+		return 1;
+	}
+	if (num_threads < 1)
+		num_threads = 1;
+	
+	uint32_t num_samples;
+	sample_t *samples = read_samples(argv[optind], &num_samples);
+	if (!samples)
+		return 1;
+	
+	dclk_offset_t *output = malloc((num_samples ? num_samples : 1) * sizeof(dclk_offset_t));
+	if (!output)
+		return 1;
+	
+	replay_work_t work;
+	work.infer = infer;
+	work.poll_ticks = (dclk_time_t)(poll_period * CLOCK_FREQ);
+	work.chips = split_chips(samples, output, num_samples, &work.num_chips);
+	work.next_chip = 0;
+	pthread_mutex_init(&work.lock, NULL);
+	if (!work.chips)
+		return 1;
+	
+	pthread_t threads[num_threads];
+	for (long i = 0; i < num_threads; i++)
+		pthread_create(&(threads[i]), NULL, replay_thread, &work);
+	for (long i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	
+	if (infer) {
+		printf("x,y,num,offset\n");
+		for (uint32_t c = 0; c < work.num_chips; c++) {
+			const chip_t *chip = &(work.chips[c]);
+			for (uint32_t i = 0; i < chip->num_samples; i++)
+				printf("%u,%u,%u,%d\n", chip->x, chip->y, chip->samples[i].num, chip->output[i]);
+		}
+	} else {
+		printf("#x\ty\tcorrections\tlocked\ttime_to_lock\trms_error\tmax_error\n");
+		for (uint32_t c = 0; c < work.num_chips; c++) {
+			const chip_t *chip = &(work.chips[c]);
+			printf( "%u\t%u\t%u\t%d\t%f\t%f\t%f\n"
+			      , chip->x, chip->y
+			      , chip->num_samples
+			      , chip->locked
+			      , chip->time_to_lock // s
+			      , chip->rms_error // ns
+			      , chip->max_error // ns
+			      );
+		}
+		
+		print_summary(work.chips, work.num_chips);
+	}
+	
+	free(work.chips);
+	free(output);
+	free(samples);
+	pthread_mutex_destroy(&work.lock);
+	return 0;
+}
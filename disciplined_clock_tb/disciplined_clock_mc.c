@@ -0,0 +1,433 @@
+/**
+ * A parallel, deterministic Monte Carlo harness for the clock discipline
+ * algorithm.
+ *
+ * Runs many independent trials, each with its own randomly chosen slave
+ * oscillator (frequency offset, wander and starting time) and correction
+ * jitter, and reports the time taken to lock, the RMS error and the maximum
+ * error (after locking) of each trial. Every trial draws all of its random
+ * numbers from its own stream (see tb_rng.h) so trials may be run on any number
+ * of threads and any trial can be replayed alone from its seed.
+ *
+ * Rather than stepping through every clock tick, the oscillators are modelled
+ * analytically and the model is only evaluated when a correction is sent and at
+ * SAMPLES_PER_POLL regular points in between.
+ *
+ * Usage:
+ *   disciplined_clock_mc [-n trials] [-j threads] [-s base_seed] [-d duration_s]
+ *                        [-w restart_s | -W restart_s]
+ *   disciplined_clock_mc -r seed [-d duration_s] [-w restart_s | -W restart_s]
+ *
+ *   -w  Restart the slave's application at the given time, restoring its
+ *       clock state from that saved by dclk_save_state (a warm restart), and
+ *       report the time taken to lock again.
+ *   -W  As -w but without restoring any state (a cold restart).
+ *
+ * Per-trial results are printed to stdout (one line per trial, in trial order)
+ * and a summary of their distributions to stderr. With -r, the single trial
+ * with the given seed is run and every sample of its error is printed instead.
+ */
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "disciplined_clock.h"
+#include "tb_rng.h"
+
+
+#define TWO_PI 6.2831853071795864769252866
+
+// Default number of trials and duration of each trial (s)
+#define DEFAULT_NUM_TRIALS 1000
+#define DEFAULT_DURATION   3600.0
+
+// Nominal frequency of both the master and slave clocks (Hz)
+#define CLOCK_FREQ (200000000.0/16.0)
+
+// Range of the slave's fixed frequency offset (+/- ppm)
+#define MAX_FREQ_OFFSET_PPM 50.0
+
+// Range of the amplitude (ppm) of the slave's sinusoidal frequency wander and
+// its period (s). The phase of the wander is random.
+#define MAX_WANDER_PPM 0.1
+#define WANDER_PERIOD  (7.0*60.0)
+
+// Interval between corrections (s)
+#ifndef POLL_PERIOD
+#define POLL_PERIOD 5.76
+#endif
+
+// Jitter standard-deviation added to correction values (ticks)
+#define JITTER_SD 3.0
+
+// Number of times the error is sampled per correction
+#define SAMPLES_PER_POLL 16
+
+// Saved clock state is stamped with the time (ms) and is only restored if it is
+// at most this old (as in spinn_time)
+#define SAVED_STATE_MAX_AGE_MS (5 * 60 * 1000)
+
+// Conversion from clock ticks to ns
+#define TICKS_TO_NS (1000000000.0 / CLOCK_FREQ)
+
+
+// The randomly chosen parameters of a trial
+typedef struct {
+	uint64_t seed;
+	
+	double freq_offset; // Fractional
+	double wander_amplitude; // Fractional
+	double wander_phase; // Radians
+	double start_ticks; // Slave ticks at time zero
+} trial_params_t;
+
+// The result of a trial
+typedef struct {
+	trial_params_t params;
+	
+	bool locked;
+	double time_to_lock; // s
+	double rms_error; // ns, after locking
+	double max_error; // ns, after locking
+	
+	double time_to_relock; // s, after the restart (if any)
+} trial_result_t;
+
+// Work shared between trial threads
+typedef struct {
+	uint64_t base_seed;
+	double duration;
+	double restart_time;
+	bool warm_restart;
+	
+	trial_result_t *results;
+	uint32_t num_trials;
+	
+	pthread_mutex_t lock;
+	uint32_t next_trial;
+} trial_work_t;
+
+
+// The raw slave clock seen by the disciplined clock library. Each thread runs
+// its own trial and so has its own slave clock.
+static __thread dclk_time_t slave_time;
+
+dclk_time_t
+dclk_read_raw_time(void)
+{
+	return slave_time;
+}
+
+
+/**
+ * The master's clock (ticks) at the given time.
+ */
+static dclk_time_t
+master_ticks(double t)
+{
+	return (dclk_time_t)(uint64_t)floor(t * CLOCK_FREQ);
+}
+
+
+/**
+ * The slave's clock (ticks) at the given time: the integral of its (offset and
+ * wandering) frequency.
+ */
+static dclk_time_t
+slave_ticks(const trial_params_t *params, double t)
+{
+	double ticks = t * (1.0 + params->freq_offset);
+	ticks += params->wander_amplitude * (WANDER_PERIOD / TWO_PI)
+	       * (cos(params->wander_phase) - cos((TWO_PI * t / WANDER_PERIOD) + params->wander_phase));
+	ticks = (ticks * CLOCK_FREQ) + params->start_ticks;
+	return (dclk_time_t)(uint64_t)floor(ticks);
+}
+
+
+/**
+ * Run a single trial. If trace is not NULL, every sample is printed to it. If
+ * restart_time is not NAN the slave is restarted at the first correction after
+ * that time, restoring its saved clock state if warm_restart is set.
+ */
+static void
+run_trial( uint64_t seed, double duration, double restart_time, bool warm_restart
+         , trial_result_t *result, FILE *trace
+         )
+{
+	tb_rng_t rng;
+	tb_rng_init(&rng, seed);
+	
+	trial_params_t *params = &(result->params);
+	params->seed = seed;
+	params->freq_offset = ((2.0 * tb_rng_uniform(&rng)) - 1.0) * MAX_FREQ_OFFSET_PPM * 1e-6;
+	params->wander_amplitude = tb_rng_uniform(&rng) * MAX_WANDER_PPM * 1e-6;
+	params->wander_phase = tb_rng_uniform(&rng) * TWO_PI;
+	params->start_ticks = tb_rng_uniform(&rng) * 4294967296.0;
+	
+	dclk_state_t dclk;
+	slave_time = slave_ticks(params, 0.0);
+	dclk_initialise_state(&dclk);
+	
+	result->locked = false;
+	result->time_to_lock = NAN;
+	result->time_to_relock = NAN;
+	dclk_saved_state_t saved;
+	memset(&saved, 0, sizeof(saved));
+	bool restarted = false;
+	bool relocked = false;
+	double sum_sq_error = 0.0;
+	double max_error = 0.0;
+	uint64_t num_samples = 0;
+	
+	uint64_t num_polls = (uint64_t)(duration / POLL_PERIOD);
+	for (uint64_t poll = 0; poll <= num_polls; poll++) {
+		for (int sample = 0; sample < SAMPLES_PER_POLL; sample++) {
+			double t = (poll + ((double)sample / SAMPLES_PER_POLL)) * POLL_PERIOD;
+			slave_time = slave_ticks(params, t);
+			
+			// Restart the application, forgetting everything but the saved state
+			bool restart_now = sample == 0 && !restarted && t >= restart_time;
+			if (restart_now) {
+				restarted = true;
+				dclk_initialise_state(&dclk);
+			}
+			
+			// Apply corrections
+			if (sample == 0) {
+				dclk_offset_t correction = master_ticks(t) - dclk_get_time(&dclk);
+				correction += tb_rng_gaussian(&rng, JITTER_SD*JITTER_SD);
+				if (poll == 0 || restart_now) {
+					dclk_correct_phase_now(&dclk, correction);
+					if (restart_now && warm_restart)
+						dclk_restore_state(&dclk, &saved, (uint32_t)(t * 1000.0), SAVED_STATE_MAX_AGE_MS);
+				} else {
+					dclk_add_correction(&dclk, correction);
+				}
+				dclk_save_state(&dclk, &saved, (uint32_t)(t * 1000.0));
+			}
+			
+			dclk_offset_t error = master_ticks(t) - dclk_get_time(&dclk);
+			bool locked = dclk_is_locked(&dclk);
+			if (locked && !result->locked) {
+				result->locked = true;
+				result->time_to_lock = t;
+			}
+			if (locked && restarted && !relocked) {
+				relocked = true;
+				result->time_to_relock = t - restart_time;
+			}
+			
+			if (result->locked) {
+				double error_ns = error * TICKS_TO_NS;
+				sum_sq_error += error_ns * error_ns;
+				if (fabs(error_ns) > max_error)
+					max_error = fabs(error_ns);
+				num_samples++;
+			}
+			
+			if (trace)
+				fprintf(trace, "%f\t%f\t%d\n", t, error * TICKS_TO_NS, locked);
+		}
+	}
+	
+	result->rms_error = num_samples ? sqrt(sum_sq_error / num_samples) : NAN;
+	result->max_error = num_samples ? max_error : NAN;
+}
+
+
+static void *
+trial_thread(void *arg)
+{
+	trial_work_t *work = arg;
+	
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		uint32_t i = work->next_trial++;
+		pthread_mutex_unlock(&work->lock);
+		
+		if (i >= work->num_trials)
+			return NULL;
+		
+		run_trial( tb_rng_derive_seed(work->base_seed, i), work->duration
+		         , work->restart_time, work->warm_restart
+		         , &(work->results[i]), NULL
+		         );
+	}
+}
+
+
+static int
+compare_doubles(const void *a_, const void *b_)
+{
+	double a = *(const double *)a_;
+	double b = *(const double *)b_;
+	return (a > b) - (a < b);
+}
+
+
+/**
+ * Print a summary of the distribution of values to stderr.
+ */
+static void
+print_distribution(const char *name, double *values, uint32_t n)
+{
+	if (!n) {
+		fprintf(stderr, "%-13s\t-\t-\t-\t-\t-\t-\n", name);
+		return;
+	}
+	
+	qsort(values, n, sizeof(double), compare_doubles);
+	double sum = 0.0;
+	for (uint32_t i = 0; i < n; i++)
+		sum += values[i];
+	fprintf( stderr, "%-13s\t%f\t%f\t%f\t%f\t%f\t%f\n"
+	       , name
+	       , values[0]
+	       , values[(uint32_t)(0.50 * (n - 1))]
+	       , values[(uint32_t)(0.90 * (n - 1))]
+	       , values[(uint32_t)(0.99 * (n - 1))]
+	       , values[n - 1]
+	       , sum / n
+	       );
+}
+
+
+static void
+print_summary(const trial_result_t *results, uint32_t num_trials, bool restart)
+{
+	double *time_to_lock   = malloc((num_trials ? num_trials : 1) * sizeof(double));
+	double *rms_error      = malloc((num_trials ? num_trials : 1) * sizeof(double));
+	double *max_error      = malloc((num_trials ? num_trials : 1) * sizeof(double));
+	double *time_to_relock = malloc((num_trials ? num_trials : 1) * sizeof(double));
+	if (!time_to_lock || !rms_error || !max_error || !time_to_relock) {
+		free(time_to_lock);
+		free(rms_error);
+		free(max_error);
+		free(time_to_relock);
+		return;
+	}
+	
+	uint32_t num_locked = 0;
+	uint32_t num_relocked = 0;
+	for (uint32_t i = 0; i < num_trials; i++) {
+		if (!isnan(results[i].time_to_relock))
+			time_to_relock[num_relocked++] = results[i].time_to_relock;
+		if (!results[i].locked)
+			continue;
+		time_to_lock[num_locked] = results[i].time_to_lock;
+		rms_error[num_locked]    = results[i].rms_error;
+		max_error[num_locked]    = results[i].max_error;
+		num_locked++;
+	}
+	
+	fprintf(stderr, "%u of %u trials locked.\n", num_locked, num_trials);
+	if (restart)
+		fprintf(stderr, "%u of %u trials locked again after restarting.\n", num_relocked, num_trials);
+	fprintf(stderr, "#metric      \tmin\tmedian\tp90\tp99\tmax\tmean\n");
+	print_distribution("time_to_lock", time_to_lock, num_locked);
+	print_distribution("rms_error", rms_error, num_locked);
+	print_distribution("max_error", max_error, num_locked);
+	if (restart)
+		print_distribution("time_to_relock", time_to_relock, num_relocked);
+	
+	free(time_to_lock);
+	free(rms_error);
+	free(max_error);
+	free(time_to_relock);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	uint32_t num_trials = DEFAULT_NUM_TRIALS;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t base_seed = 0;
+	double duration = DEFAULT_DURATION;
+	bool replay = false;
+	uint64_t replay_seed = 0;
+	double restart_time = NAN;
+	bool warm_restart = false;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "n:j:s:d:r:w:W:")) != -1) {
+		switch (opt) {
+			case 'n': num_trials = strtoul(optarg, NULL, 0); break;
+			case 'j': num_threads = strtol(optarg, NULL, 0); break;
+			case 's': base_seed = strtoull(optarg, NULL, 0); break;
+			case 'd': duration = strtod(optarg, NULL); break;
+			case 'r': replay = true; replay_seed = strtoull(optarg, NULL, 0); break;
+			case 'w': warm_restart = true; restart_time = strtod(optarg, NULL); break;
+			case 'W': warm_restart = false; restart_time = strtod(optarg, NULL); break;
+			default:
+				fprintf(stderr, "Usage:\n"
+				                "  %s [-n trials] [-j threads] [-s base_seed] [-d duration_s]\n"
+				                "     [-w restart_s | -W restart_s]\n"
+				                "  %s -r seed [-d duration_s] [-w restart_s | -W restart_s]\n"
+				       , argv[0], argv[0]);
+				return 1;
+		}
+	}
+	if (num_threads < 1)
+		num_threads = 1;
+	
+	if (replay) {
+		trial_result_t result;
+		printf("#sim_time\terror\tlocked\n");
+		run_trial(replay_seed, duration, restart_time, warm_restart, &result, stdout);
+		fprintf( stderr, "seed 0x%016llx: locked %d after %f s, rms error %f ns, max error %f ns\n"
+		       , (unsigned long long)replay_seed
+		       , result.locked, result.time_to_lock, result.rms_error, result.max_error
+		       );
+		if (!isnan(restart_time))
+			fprintf(stderr, "locked again %f s after restarting\n", result.time_to_relock);
+		return 0;
+	}
+	
+	trial_work_t work;
+	work.base_seed = base_seed;
+	work.duration = duration;
+	work.restart_time = restart_time;
+	work.warm_restart = warm_restart;
+	work.num_trials = num_trials;
+	work.results = calloc(num_trials ? num_trials : 1, sizeof(trial_result_t));
+	work.next_trial = 0;
+	pthread_mutex_init(&work.lock, NULL);
+	if (!work.results)
+		return 1;
+	
+	pthread_t threads[num_threads];
+	for (long i = 0; i < num_threads; i++)
+		pthread_create(&(threads[i]), NULL, trial_thread, &work);
+	for (long i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	
+	printf("#trial\tseed\tfreq_offset_ppm\twander_ppm\tlocked\ttime_to_lock\trms_error\tmax_error\n");
+	for (uint32_t i = 0; i < num_trials; i++) {
+		const trial_result_t *r = &(work.results[i]);
+		printf( "%u\t0x%016llx\t%f\t%f\t%d\t%f\t%f\t%f\n"
+		      , i
+		      , (unsigned long long)r->params.seed
+		      , r->params.freq_offset * 1e6
+		      , r->params.wander_amplitude * 1e6
+		      , r->locked
+		      , r->time_to_lock // s
+		      , r->rms_error // ns
+		      , r->max_error // ns
+		      );
+	}
+	
+	print_summary(work.results, num_trials, !isnan(restart_time));
+	
+	free(work.results);
+	pthread_mutex_destroy(&work.lock);
+	return 0;
+}
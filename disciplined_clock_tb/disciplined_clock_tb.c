@@ -9,6 +9,7 @@
 #include <stdbool.h>
 
 #include "disciplined_clock.h"
+#include "tb_rng.h"
 
 
 #ifndef MIN
@@ -58,31 +59,8 @@ dclk_read_raw_time(void)
 	return slave_time;
 }
 
-/**
- * Generate Gaussian random values (taken from
- * http://en.wikipedia.org/wiki/Box%E2%80%93Muller_transform)
- */
-double
-generate_gaussian_noise(double variance)
-{
-	static bool haveSpare = false;
-	static double rand1, rand2;
- 
-	if(haveSpare)
-	{
-		haveSpare = false;
-		return sqrt(variance * rand1) * sin(rand2);
-	}
- 
-	haveSpare = true;
- 
-	rand1 = rand() / ((double) RAND_MAX);
-	if(rand1 < 1e-100) rand1 = 1e-100;
-	rand1 = -2 * log(rand1);
-	rand2 = (rand() / ((double) RAND_MAX)) * TWO_PI;
- 
-	return sqrt(variance * rand1) * cos(rand2);
-}
+// Noise and sampling random numbers (seeded from the command line)
+tb_rng_t rng;
 
 double next_master_tick = 0.0;
 double next_slave_tick = 0.0;
@@ -92,10 +70,13 @@ double sim_time = 0.0;
 int
 main(int argc, char *argv[])
 {
+	tb_rng_init(&rng, (argc > 1) ? strtoull(argv[1], NULL, 0) : 0);
+	
 	dclk_initialise_state(&dclk);
 	bool first_update = true;
 	
-	printf("#sim_time\tmaster\tslave\terror\tfreq_corr\tphase_corr\tms_pred\n");
+	printf("#sim_time\tmaster\tslave\terror\tfreq_corr\tphase_corr\tms_pred"
+	       "\tlocked\tphase_err_mean\tphase_err_sd\tfreq_stability\terror_bound\n");
 	
 	while (sim_time < SIM_DURATION) {
 		sim_time = MIN(next_master_tick, next_slave_tick);
@@ -103,7 +84,7 @@ main(int argc, char *argv[])
 		// Apply corrections
 		if (sim_time == next_master_tick && master_time%POLL_PERIOD == 0) {
 			dclk_offset_t correction = master_time - dclk_get_time(&dclk);
-			correction += generate_gaussian_noise(JITTER_SD*JITTER_SD);
+			correction += tb_rng_gaussian(&rng, JITTER_SD*JITTER_SD);
 			if (first_update)
 				dclk_correct_phase_now(&dclk, correction);
 			else
@@ -123,10 +104,12 @@ main(int argc, char *argv[])
 		}
 		
 		// (Randomly) sample the model state to standard out
-		if (((double)rand())/((double)RAND_MAX) < SAMPLE_PROB) {
+		if (tb_rng_uniform(&rng) < SAMPLE_PROB) {
 			dclk_time_t corrected_slave_time = dclk_get_time(&dclk);
 			dclk_offset_t error = master_time - corrected_slave_time;
-			printf( "%f\t%d\t%d\t%d\t%f\t%f\t%d\n" 
+			dclk_lock_quality_t quality;
+			dclk_get_lock_quality(&dclk, &quality);
+			printf( "%f\t%d\t%d\t%d\t%f\t%f\t%d\t%d\t%f\t%f\t%e\t%d\n"
 			      , sim_time // s
 			      , master_time * (5*16) // ns
 			      , corrected_slave_time * (5*16) // ns
@@ -134,6 +117,11 @@ main(int argc, char *argv[])
 			      , dclk.correction_freq / ((double)(1<<DCLK_FP_FREQ_FBITS)) // Hz
 			      , (dclk.correction_phase_accumulator * (5*16)) / ((double)(1<<DCLK_FP_PHASE_FBITS)) // ns
 			      , dclk_get_ticks_until_time(&dclk, dclk_get_time(&dclk) + TICKS_UNTIL_TIME_PERIOD) // ticks
+			      , quality.locked
+			      , (quality.phase_error_mean * (5*16)) / ((double)(1<<DCLK_FP_PHASE_FBITS)) // ns
+			      , sqrt(quality.phase_error_variance / ((double)(1<<DCLK_FP_PHASE_FBITS))) * (5*16) // ns
+			      , quality.freq_stability / ((double)(1<<DCLK_FP_FREQ_FBITS)) // Hz
+			      , quality.error_bound * (5*16) // ns
 			      );
 		}
 	}
@@ -0,0 +1,37 @@
+require("ggplot2")
+require("gridExtra")
+
+# Usage: Rscript plot_lock_quality.r tb_output.tsv [output.pdf]
+args <- commandArgs(trailingOnly = TRUE)
+
+# The testbench prefixes its header line with a "#"
+t <- read.table(args[1], header=FALSE, sep="\t", comment.char="#")
+colnames(t) <- c( "sim_time", "master", "slave", "error", "freq_corr"
+                , "phase_corr", "ms_pred", "locked", "phase_err_mean"
+                , "phase_err_sd", "freq_stability", "error_bound"
+                )
+
+if (length(args) > 1)
+	pdf(args[2])
+
+base_plot <- ggplot(t, aes(x=sim_time)) +
+	labs(x="Time (s)")
+
+error_plot <- base_plot +
+	geom_ribbon(aes(ymin=-error_bound, ymax=error_bound), alpha=0.2) +
+	geom_point(aes(y=error, color=factor(locked)), size=0.5) +
+	labs(y="Error (ns)") +
+	labs(color="Locked")
+
+phase_plot <- base_plot +
+	geom_line(aes(y=phase_err_mean, linetype="Mean")) +
+	geom_line(aes(y=phase_err_sd, linetype="Standard deviation")) +
+	labs(y="Phase Error Estimate (ns)") +
+	labs(linetype="")
+
+freq_plot <- base_plot +
+	geom_line(aes(y=freq_stability)) +
+	scale_y_log10() +
+	labs(y="Frequency Stability (Hz)")
+
+grid.arrange(error_plot, phase_plot, freq_plot)
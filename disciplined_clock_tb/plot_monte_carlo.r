@@ -0,0 +1,35 @@
+require("ggplot2")
+require("gridExtra")
+
+# Usage: Rscript plot_monte_carlo.r mc_output.tsv [output.pdf]
+args <- commandArgs(trailingOnly = TRUE)
+
+# The harness prefixes its header line with a "#"
+t <- read.table(args[1], header=FALSE, sep="\t", comment.char="#", na.strings="nan"
+                , colClasses=c("integer", "character", rep("numeric", 6))
+                )
+colnames(t) <- c( "trial", "seed", "freq_offset_ppm", "wander_ppm", "locked"
+                , "time_to_lock", "rms_error", "max_error"
+                )
+t <- t[t$locked == 1,]
+
+if (length(args) > 1)
+	pdf(args[2])
+
+lock_plot <- ggplot(t, aes(x=time_to_lock)) +
+	stat_ecdf() +
+	labs(x="Time to Lock (s)", y="Fraction of Trials")
+
+rms_plot <- ggplot(t, aes(x=rms_error)) +
+	stat_ecdf() +
+	labs(x="RMS Error After Lock (ns)", y="Fraction of Trials")
+
+max_plot <- ggplot(t, aes(x=max_error)) +
+	stat_ecdf() +
+	labs(x="Maximum Error After Lock (ns)", y="Fraction of Trials")
+
+wander_plot <- ggplot(t, aes(x=wander_ppm, y=time_to_lock)) +
+	geom_point(size=0.5) +
+	labs(x="Wander Amplitude (ppm)", y="Time to Lock (s)")
+
+grid.arrange(lock_plot, rms_plot, max_plot, wander_plot)
@@ -0,0 +1,106 @@
+/**
+ * Seeded, counter-based random number streams for the testbenches.
+ *
+ * Each stream is identified by a 64-bit seed and the n-th value of a stream is
+ * a fixed function (the SplitMix64 finaliser) of the seed and n so streams
+ * share no state, may be used from any number of threads at once and any run
+ * can be reproduced from its seed alone.
+ */
+
+#ifndef TB_RNG_H
+#define TB_RNG_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// The SplitMix64 increment (2**64 / golden ratio)
+#define TB_RNG_GAMMA 0x9E3779B97F4A7C15ull
+
+typedef struct {
+	uint64_t seed;
+	uint64_t counter;
+	
+	// Box-Muller produces values in pairs, the second is kept here
+	bool have_spare;
+	double spare;
+} tb_rng_t;
+
+
+/**
+ * The SplitMix64 finaliser: a bijective mixing function.
+ */
+static inline uint64_t
+tb_rng_mix(uint64_t z)
+{
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+
+/**
+ * Start a stream from the given seed.
+ */
+static inline void
+tb_rng_init(tb_rng_t *rng, uint64_t seed)
+{
+	rng->seed = seed;
+	rng->counter = 0;
+	rng->have_spare = false;
+	rng->spare = 0.0;
+}
+
+
+/**
+ * Derive the seed of the n-th of a family of independent streams.
+ */
+static inline uint64_t
+tb_rng_derive_seed(uint64_t base_seed, uint64_t n)
+{
+	return tb_rng_mix(tb_rng_mix(base_seed) + ((n + 1) * TB_RNG_GAMMA));
+}
+
+
+/**
+ * The next 64 random bits of the stream.
+ */
+static inline uint64_t
+tb_rng_next(tb_rng_t *rng)
+{
+	return tb_rng_mix(rng->seed + (++rng->counter * TB_RNG_GAMMA));
+}
+
+
+/**
+ * A uniform random value in [0, 1).
+ */
+static inline double
+tb_rng_uniform(tb_rng_t *rng)
+{
+	return (tb_rng_next(rng) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * A Gaussian random value with zero mean and the given variance (using the
+ * Box-Muller transform).
+ */
+static inline double
+tb_rng_gaussian(tb_rng_t *rng, double variance)
+{
+	if (rng->have_spare) {
+		rng->have_spare = false;
+		return sqrt(variance) * rng->spare;
+	}
+	
+	double u1 = 1.0 - tb_rng_uniform(rng); // (0, 1]
+	double u2 = tb_rng_uniform(rng);
+	double r = sqrt(-2.0 * log(u1));
+	
+	rng->spare = r * sin(2.0 * M_PI * u2);
+	rng->have_spare = true;
+	return sqrt(variance) * r * cos(2.0 * M_PI * u2);
+}
+
+#endif
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "calendar_queue.h"
+
+// Initial (and minimum) number of buckets
+#define CQ_MIN_BUCKETS 2
+
+// Number of events sampled to estimate a new bucket width when resizing
+#define CQ_WIDTH_SAMPLES 25
+
+
+/**
+ * Is event a before event b?
+ */
+static inline int
+cq_before(const cq_event_t *a, const cq_event_t *b)
+{
+	return a->time < b->time || (a->time == b->time && a->seq < b->seq);
+}
+
+
+/**
+ * Insert an event into its bucket (without resizing).
+ */
+static void
+cq_insert(calendar_queue_t *cq, cq_event_t *event)
+{
+	uint32_t i = (event->time / cq->bucket_width) % cq->num_buckets;
+	cq_event_t **pos = &(cq->buckets[i]);
+	while (*pos && !cq_before(event, *pos))
+		pos = &((*pos)->next);
+	event->next = *pos;
+	*pos = event;
+}
+
+
+/**
+ * Set the current bucket and year to those of the given time.
+ */
+static void
+cq_set_position(calendar_queue_t *cq, uint64_t time)
+{
+	cq->last_bucket = (time / cq->bucket_width) % cq->num_buckets;
+	cq->bucket_top = ((time / cq->bucket_width) + 1) * cq->bucket_width;
+}
+
+
+/**
+ * Estimate a suitable bucket width from the separation of the earliest events
+ * (given as an array in any order).
+ */
+static uint64_t
+cq_estimate_width(cq_event_t **events, uint32_t n, uint64_t old_width)
+{
+	// Find the earliest few events (by insertion into a small sorted array)
+	uint64_t times[CQ_WIDTH_SAMPLES];
+	uint32_t num_times = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		uint64_t t = events[i]->time;
+		if (num_times == CQ_WIDTH_SAMPLES && t >= times[num_times - 1])
+			continue;
+		uint32_t j = (num_times < CQ_WIDTH_SAMPLES) ? num_times++ : num_times - 1;
+		while (j > 0 && times[j - 1] > t) {
+			times[j] = times[j - 1];
+			j--;
+		}
+		times[j] = t;
+	}
+	if (num_times < 2)
+		return old_width;
+	
+	// Average separation, ignoring unusually large gaps
+	uint64_t mean = (times[num_times - 1] - times[0]) / (num_times - 1);
+	uint64_t total = 0;
+	uint32_t count = 0;
+	for (uint32_t i = 1; i < num_times; i++) {
+		uint64_t gap = times[i] - times[i - 1];
+		if (gap <= 2 * mean) {
+			total += gap;
+			count++;
+		}
+	}
+	
+	uint64_t width = count ? (3 * total) / count : 3 * mean;
+	return width ? width : 1;
+}
+
+
+/**
+ * Change the number of buckets, re-estimating the bucket width.
+ */
+static void
+cq_resize(calendar_queue_t *cq, uint32_t num_buckets)
+{
+	cq_event_t **events = malloc((cq->size ? cq->size : 1) * sizeof(cq_event_t *));
+	cq_event_t **buckets = calloc(num_buckets, sizeof(cq_event_t *));
+	if (!events || !buckets) {
+		// Carry on with the current (inefficient but correct) calendar
+		free(events);
+		free(buckets);
+		return;
+	}
+	
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < cq->num_buckets; i++)
+		for (cq_event_t *e = cq->buckets[i]; e; e = e->next)
+			events[n++] = e;
+	
+	free(cq->buckets);
+	cq->buckets = buckets;
+	cq->num_buckets = num_buckets;
+	cq->bucket_width = cq_estimate_width(events, n, cq->bucket_width);
+	for (uint32_t i = 0; i < n; i++)
+		cq_insert(cq, events[i]);
+	cq_set_position(cq, cq->last_time);
+	
+	free(events);
+}
+
+
+int
+cq_init(calendar_queue_t *cq)
+{
+	memset(cq, 0, sizeof(calendar_queue_t));
+	cq->buckets = calloc(CQ_MIN_BUCKETS, sizeof(cq_event_t *));
+	if (!cq->buckets)
+		return -1;
+	cq->num_buckets = CQ_MIN_BUCKETS;
+	cq->bucket_width = 1;
+	cq_set_position(cq, 0);
+	return 0;
+}
+
+
+void
+cq_free(calendar_queue_t *cq)
+{
+	free(cq->buckets);
+	cq->buckets = NULL;
+}
+
+
+void
+cq_push(calendar_queue_t *cq, cq_event_t *event)
+{
+	event->seq = cq->next_seq++;
+	cq_insert(cq, event);
+	
+	if (++cq->size > 2 * cq->num_buckets)
+		cq_resize(cq, 2 * cq->num_buckets);
+}
+
+
+/**
+ * Find the earliest event, returning its bucket and the end of the year in
+ * which it was found. Does not modify the queue.
+ */
+static cq_event_t *
+cq_find_next(const calendar_queue_t *cq, uint32_t *bucket, uint64_t *bucket_top)
+{
+	// Search forward through the calendar for an event in the current year
+	uint32_t i = cq->last_bucket;
+	uint64_t top = cq->bucket_top;
+	for (uint32_t n = 0; n < cq->num_buckets; n++) {
+		cq_event_t *e = cq->buckets[i];
+		if (e && e->time < top) {
+			*bucket = i;
+			*bucket_top = top;
+			return e;
+		}
+		i = (i + 1) % cq->num_buckets;
+		top += cq->bucket_width;
+	}
+	
+	// Nothing this year: fall back on a direct search for the earliest event
+	cq_event_t *event = NULL;
+	for (i = 0; i < cq->num_buckets; i++) {
+		if (cq->buckets[i] && (!event || cq_before(cq->buckets[i], event))) {
+			event = cq->buckets[i];
+			*bucket = i;
+		}
+	}
+	*bucket_top = ((event->time / cq->bucket_width) + 1) * cq->bucket_width;
+	return event;
+}
+
+
+cq_event_t *
+cq_pop(calendar_queue_t *cq)
+{
+	if (!cq->size)
+		return NULL;
+	
+	cq_event_t *event = cq_find_next(cq, &(cq->last_bucket), &(cq->bucket_top));
+	cq->buckets[cq->last_bucket] = event->next;
+	event->next = NULL;
+	cq->last_time = event->time;
+	
+	if (--cq->size < cq->num_buckets / 2 && cq->num_buckets > CQ_MIN_BUCKETS)
+		cq_resize(cq, cq->num_buckets / 2);
+	
+	return event;
+}
+
+
+const cq_event_t *
+cq_peek(const calendar_queue_t *cq)
+{
+	if (!cq->size)
+		return NULL;
+	
+	uint32_t bucket;
+	uint64_t bucket_top;
+	return cq_find_next(cq, &bucket, &bucket_top);
+}
+
+
+uint32_t
+cq_size(const calendar_queue_t *cq)
+{
+	return cq->size;
+}
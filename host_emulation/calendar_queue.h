@@ -0,0 +1,81 @@
+/**
+ * A calendar queue (R. Brown, "Calendar Queues: A Fast O(1) Priority Queue
+ * Implementation for the Simulation Event Set Problem", CACM 31(10), 1988): a
+ * priority queue of timestamped events for discrete-event simulation with
+ * (amortised) constant time insertion and removal.
+ *
+ * Events are intrusive: users embed a cq_event_t as the first member of their
+ * own event structure. Events with equal times are removed in the order they
+ * were inserted so that simulations are deterministic.
+ */
+
+#ifndef CALENDAR_QUEUE_H
+#define CALENDAR_QUEUE_H
+
+#include <stdint.h>
+
+typedef struct cq_event {
+	// The time of the event
+	uint64_t time;
+	
+	// Insertion order (used to break ties). Set by cq_push.
+	uint64_t seq;
+	
+	struct cq_event *next;
+} cq_event_t;
+
+/**
+ * A calendar queue. Not intended for public access.
+ */
+typedef struct {
+	// Each bucket is a list of events sorted by (time, seq)
+	cq_event_t **buckets;
+	uint32_t num_buckets;
+	
+	// The span of time covered by each bucket
+	uint64_t bucket_width;
+	
+	// The bucket containing the last event removed and the (exclusive) end of
+	// the time span of the current "year" within that bucket.
+	uint32_t last_bucket;
+	uint64_t bucket_top;
+	
+	// The time of the last event removed
+	uint64_t last_time;
+	
+	uint32_t size;
+	uint64_t next_seq;
+} calendar_queue_t;
+
+/**
+ * Initialise an empty queue. Returns 0 on success and -1 on failure.
+ */
+int cq_init(calendar_queue_t *cq);
+
+/**
+ * Free the queue's buckets (but not any events it still holds).
+ */
+void cq_free(calendar_queue_t *cq);
+
+/**
+ * Insert an event. The event's time must not be earlier than that of the last
+ * event removed.
+ */
+void cq_push(calendar_queue_t *cq, cq_event_t *event);
+
+/**
+ * Remove and return the earliest event or NULL if the queue is empty.
+ */
+cq_event_t *cq_pop(calendar_queue_t *cq);
+
+/**
+ * The earliest event (left in the queue) or NULL if the queue is empty.
+ */
+const cq_event_t *cq_peek(const calendar_queue_t *cq);
+
+/**
+ * The number of events in the queue.
+ */
+uint32_t cq_size(const calendar_queue_t *cq);
+
+#endif
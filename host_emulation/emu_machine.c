@@ -0,0 +1,1536 @@
+/**
+ * The emulated SpiNNaker machine shared by the emulation front-ends (see
+ * emu_machine.h).
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include <dlfcn.h>
+#include <link.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "emu_machine.h"
+
+#include "calendar_queue.h"
+#include "tb_rng.h"
+
+
+#define TWO_PI 6.2831853071795864769252866
+
+// Default machine size
+#define DEFAULT_WIDTH          12
+#define DEFAULT_HEIGHT         12
+#define DEFAULT_CORES_PER_CHIP 16
+
+// Default range of each chip's fixed frequency offset (+/- ppm) and period of
+// its frequency wander (s)
+#define DEFAULT_MAX_FREQ_OFFSET_PPM 30.0
+#define DEFAULT_WANDER_PERIOD       (7.0*60.0)
+
+// The application on each chip is started at a random time within this period
+// after the start of the simulation (s). The cores of a chip start together.
+#define START_SPREAD 0.01
+
+// Latency of a router in forwarding a packet (ns) and the period of the router
+// clock (ps)
+#define ROUTER_LATENCY_NS 100
+#define ROUTER_CLOCK_PS   7500
+
+// Time taken for a packet to be transferred from a core to its router (ns).
+// Each core can queue up to TX_QUEUE_SIZE packets for transfer.
+#define CORE_TO_ROUTER_NS 50
+#define TX_QUEUE_SIZE     16
+
+// Time to transmit a single bit over a chip-to-chip link (ps) and the
+// propagation delay of a link (ns)
+#define LINK_BIT_PS      4000
+#define LINK_LATENCY_NS  50
+
+// Number of packets which may wait for a link before it is considered blocked
+#define LINK_BUFFER_PACKETS 4
+
+// Size of a multicast packet with and without a payload (bits)
+#define PACKET_BITS         40
+#define PACKET_PAYLOAD_BITS 72
+
+// Latency from the arrival of a packet (or a timer expiring or a user event
+// being triggered) to the callback running: a fixed latency plus uniform
+// random jitter (ns)
+#define CALLBACK_LATENCY_NS 400
+#define CALLBACK_JITTER_NS  200
+
+// The (much shorter) latency and jitter of callbacks registered with priority
+// -1, i.e. run directly by the FIQ handler (ns)
+#define FIQ_LATENCY_NS 100
+#define FIQ_JITTER_NS  50
+
+// Number of multicast routing entries in each router
+#define RTR_ENTRIES 1024
+
+// Number of chip-to-chip links
+#define NUM_LINKS 6
+
+// Bits of a routing entry's route which refer to links and cores
+#define ROUTE_LINK(l) (1u << (l))
+#define ROUTE_CORE(p) (1u << ((p) + NUM_LINKS))
+
+// Router control register wait fields and the value which disables dropping.
+// Until set by the application the router waits forever.
+#define RTR_WAIT1(control) (((control) >> 16) & 0xFF)
+#define RTR_WAIT2(control) (((control) >> 24) & 0xFF)
+#define RTR_WAIT_FOREVER   0xFF
+#define RTR_CONTROL_RESET  0xFFFF0000u
+
+// Timer control register bits
+#define TC_ONE_SHOT   (1u << 0)
+#define TC_INT_ENABLE (1u << 5)
+#define TC_PERIODIC   (1u << 6)
+#define TC_ENABLE     (1u << 7)
+
+// Value kept in a timer's load register to detect writes to it by the
+// application. A write of this exact value will be missed.
+#define TC_LOAD_UNWRITTEN 0xA5A5A5A5u
+
+// Conversions to picoseconds
+#define NS_TO_PS(ns) ((uint64_t)(ns) * 1000ull)
+#define S_TO_PS(s)   ((uint64_t)llround((s) * 1e12))
+#define PS_TO_S(ps)  ((double)(ps) * 1e-12)
+
+// The shortest time a packet can take between two chips: no event on one chip
+// can affect another sooner than this after it happens.
+#define LOOKAHEAD_PS ( NS_TO_PS(ROUTER_LATENCY_NS) \
+                     + ((uint64_t)PACKET_BITS * LINK_BIT_PS) \
+                     + NS_TO_PS(LINK_LATENCY_NS) \
+                     )
+
+// A time after every event
+#define NEVER UINT64_MAX
+
+// Offsets of each link's far end (links in the order EAST, NORTH_EAST, NORTH,
+// WEST, SOUTH_WEST, SOUTH)
+static const int LINK_DX[NUM_LINKS] = {1, 1, 0, -1, -1,  0};
+static const int LINK_DY[NUM_LINKS] = {0, 1, 1,  0, -1, -1};
+#define OPPOSITE_LINK(l) (((l) + 3) % NUM_LINKS)
+
+// Event types
+#define EV_START        0 // Load the application onto a chip's cores
+#define EV_TIMER_TICK   1 // The spin1 (periodic) timer tick
+#define EV_TC1_EXPIRED  2 // A timer 1 interrupt
+#define EV_PACKET_HOP   3 // A packet arrives at a router
+#define EV_PACKET_RX    4 // A packet is delivered to a core
+#define EV_USER         5 // A user event
+
+
+typedef struct {
+	uint key;
+	uint mask;
+	uint route;
+} rtr_entry_t;
+
+// An emulated timer/counter
+typedef struct {
+	// The registers seen by the application
+	volatile uint regs[8];
+	
+	// The control register when last synchronised
+	uint control;
+	
+	// The last value loaded and the oscillator cycle count at which counting
+	// from it started
+	uint load;
+	double load_cycles;
+	
+	// Incremented to cancel any scheduled interrupt
+	uint generation;
+} emu_timer_t;
+
+struct emu_chip;
+
+struct emu_core {
+	struct emu_chip *chip;
+	uint p;
+	
+	emu_timer_t timers[3]; // Timers 1 and 2
+	
+	callback_t callbacks[NUM_EVENTS];
+	
+	// Events whose callbacks were registered to run from FIQ (priority -1)
+	bool fiq[NUM_EVENTS];
+	
+	// The spin1 timer tick period (us), number of ticks so far and whether a
+	// tick is scheduled
+	uint timer_tick;
+	uint timer_ticks;
+	bool tick_scheduled;
+	
+	bool started;
+	bool exited;
+	
+	// The arguments of a triggered user event yet to be delivered
+	bool user_pending;
+	uint user_arg0;
+	uint user_arg1;
+	
+	// The time at which the last packet queued by the core reaches the router
+	uint64_t tx_free_at;
+	
+	vcpu_t vcpu;
+	sark_data_t sark_data;
+	
+	// Random numbers for spin1_rand and for this core's callback latencies
+	tb_rng_t rng;
+	tb_rng_t latency_rng;
+	
+	// The application's global variables (while another core is resident)
+	uint8_t *context;
+};
+
+typedef struct emu_chip {
+	uint x;
+	uint y;
+	
+	// The thread which runs the chip's cores
+	struct emu_thread *thread;
+	
+	// Oscillator parameters
+	double freq_offset; // Fractional
+	double wander_amplitude; // Fractional
+	double wander_phase; // Radians
+	double start_cycles; // Cycles at time zero
+	uint64_t start_time; // When the chip's cores start (ps)
+	
+	// Routing table (allocated when first used)
+	rtr_entry_t *rtr_entries;
+	uint rtr_num_entries;
+	uint rtr_regs[4];
+	
+	// The time at which each outgoing link finishes sending its last packet and
+	// random numbers for the background load on the links
+	uint64_t link_free_at[NUM_LINKS];
+	tb_rng_t link_rng;
+	
+	// Packets sent from this chip (used to order packets between threads)
+	uint64_t num_sent;
+	
+	// SDRAM (allocated when first used)
+	uint8_t *sdram;
+	
+	sv_t system_variables;
+	
+	// Indexed by core number (core 0, the monitor, is not used)
+	emu_core_t cores[EMU_MAX_CORES_PER_CHIP];
+} emu_chip_t;
+
+typedef struct {
+	cq_event_t cq;
+	uint type;
+	emu_chip_t *chip;
+	uint p;
+	
+	// Multicast packets: the link the packet arrived on (-1 if sent by a local
+	// core) and the chip and sequence number it was sent with (for ordering)
+	uint key;
+	uint payload;
+	bool has_payload;
+	int in_link;
+	uint src_chip;
+	uint64_t src_seq;
+	
+	// Timer interrupts: the timer generation the interrupt was scheduled in
+	uint generation;
+} event_t;
+
+// A thread emulating a block of chips
+typedef struct emu_thread {
+	uint id;
+	pthread_t thread;
+	
+	// The thread's copy of the application
+	void *handle;
+	void (*c_main)(void);
+	uint8_t *segment;
+	size_t segment_size;
+	
+	// The core whose application state is in this thread's data segment
+	emu_core_t *resident;
+	
+	calendar_queue_t queue;
+	event_t *free_events;
+	
+	// Events for this thread's chips sent by other threads during the current
+	// window
+	pthread_mutex_t inbox_lock;
+	event_t **inbox;
+	size_t inbox_size;
+	size_t inbox_capacity;
+	
+	// The number of this thread's cores which have not exited and whether the
+	// core to stop on has exited
+	uint num_running;
+	bool stopping;
+	
+	// Published at the end of each window: the time of this thread's next
+	// event, its number of running cores and whether it is stopping
+	uint64_t next_time;
+	uint published_running;
+	bool published_stopping;
+	
+	// Statistics
+	uint64_t num_events;
+	uint64_t num_hops;
+	uint64_t num_dropped;
+	uint64_t num_tx_full;
+	
+	// The time of the last event processed
+	uint64_t last_time;
+} emu_thread_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Emulation state
+////////////////////////////////////////////////////////////////////////////////
+
+static emu_params_t params;
+
+// Indexed by x + (y * width)
+static emu_chip_t *chips;
+
+static emu_thread_t *threads;
+static pthread_barrier_t barrier;
+
+// The core to stop on (if any)
+static emu_core_t *stop_core = NULL;
+
+// The events processed by the current call to emu_machine_run: those from
+// run_start up to and including run_end. Once stopped, nothing more is run.
+static uint64_t run_start = 0;
+static uint64_t run_end;
+static bool stopped = false;
+
+// The thread, core and simulated time (ps) currently running in this thread
+static __thread emu_thread_t *self = NULL;
+static __thread emu_core_t *current = NULL;
+static __thread uint64_t now = 0;
+
+// Serialises output from io_printf
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static void
+out_of_memory(void)
+{
+	fprintf(stderr, "Out of memory.\n");
+	exit(1);
+}
+
+
+static emu_chip_t *
+chip_at(uint x, uint y)
+{
+	return &(chips[x + (y * params.width)]);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Events
+////////////////////////////////////////////////////////////////////////////////
+
+static event_t *
+new_event(uint type, emu_chip_t *chip, uint p, uint64_t time)
+{
+	event_t *event = self->free_events;
+	if (event) {
+		self->free_events = (event_t *)event->cq.next;
+	} else {
+		event = malloc(sizeof(event_t));
+		if (!event)
+			out_of_memory();
+	}
+	
+	event->cq.time = time;
+	event->type = type;
+	event->chip = chip;
+	event->p = p;
+	return event;
+}
+
+
+/**
+ * Schedule an event. Events for another thread's chips are put in its inbox
+ * (and must not occur before the end of the current window).
+ */
+static void
+schedule(event_t *event)
+{
+	emu_thread_t *thread = event->chip->thread;
+	if (thread == self) {
+		cq_push(&(self->queue), &(event->cq));
+		return;
+	}
+	
+	pthread_mutex_lock(&(thread->inbox_lock));
+	if (thread->inbox_size == thread->inbox_capacity) {
+		size_t capacity = thread->inbox_capacity ? 2 * thread->inbox_capacity : 256;
+		event_t **inbox = realloc(thread->inbox, capacity * sizeof(event_t *));
+		if (!inbox)
+			out_of_memory();
+		thread->inbox = inbox;
+		thread->inbox_capacity = capacity;
+	}
+	thread->inbox[thread->inbox_size++] = event;
+	pthread_mutex_unlock(&(thread->inbox_lock));
+}
+
+
+static void
+free_event(event_t *event)
+{
+	event->cq.next = (cq_event_t *)self->free_events;
+	self->free_events = event;
+}
+
+
+/**
+ * Order events from other threads by time and then by sender so that they are
+ * queued in the same order regardless of the order they arrived in.
+ */
+static int
+compare_inbox_events(const void *a, const void *b)
+{
+	const event_t *ea = *(event_t * const *)a;
+	const event_t *eb = *(event_t * const *)b;
+	if (ea->cq.time != eb->cq.time)
+		return ea->cq.time < eb->cq.time ? -1 : 1;
+	if (ea->src_chip != eb->src_chip)
+		return ea->src_chip < eb->src_chip ? -1 : 1;
+	if (ea->src_seq != eb->src_seq)
+		return ea->src_seq < eb->src_seq ? -1 : 1;
+	return 0;
+}
+
+
+/**
+ * Move the events sent to this thread by other threads into its queue.
+ */
+static void
+drain_inbox(void)
+{
+	qsort(self->inbox, self->inbox_size, sizeof(event_t *), compare_inbox_events);
+	for (size_t i = 0; i < self->inbox_size; i++)
+		cq_push(&(self->queue), &(self->inbox[i]->cq));
+	self->inbox_size = 0;
+}
+
+
+/**
+ * Random latency between an interrupt being raised on a core and the callback
+ * for the given event running.
+ */
+static uint64_t
+callback_latency(emu_core_t *core, uint event_id)
+{
+	double jitter = tb_rng_uniform(&(core->latency_rng));
+	if (core->fiq[event_id])
+		return NS_TO_PS(FIQ_LATENCY_NS) + (uint64_t)(jitter * NS_TO_PS(FIQ_JITTER_NS));
+	else
+		return NS_TO_PS(CALLBACK_LATENCY_NS) + (uint64_t)(jitter * NS_TO_PS(CALLBACK_JITTER_NS));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Oscillators and timers
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The fractional frequency of a chip's oscillator at time t (ps).
+ */
+static double
+osc_rate(const emu_chip_t *chip, uint64_t t)
+{
+	return 1.0 + chip->freq_offset
+	     + chip->wander_amplitude * sin((TWO_PI * PS_TO_S(t) / params.wander_period) + chip->wander_phase);
+}
+
+
+/**
+ * The number of CPU clock cycles of a chip at time t (ps): the integral of its
+ * oscillator's frequency.
+ */
+static double
+osc_cycles(const emu_chip_t *chip, uint64_t t)
+{
+	double cycles = PS_TO_S(t) * (1.0 + chip->freq_offset);
+	if (chip->wander_amplitude)
+		cycles += chip->wander_amplitude * (params.wander_period / TWO_PI)
+		        * ( cos(chip->wander_phase)
+		          - cos((TWO_PI * PS_TO_S(t) / params.wander_period) + chip->wander_phase)
+		          );
+	return (cycles * EMU_CPU_CLK_MHZ * 1e6) + chip->start_cycles;
+}
+
+
+/**
+ * The (approximate) time taken for a chip's clock to advance by the given
+ * number of cycles from now (ps). Assumes the frequency does not change
+ * significantly in the interval.
+ */
+static uint64_t
+osc_cycles_to_ps(const emu_chip_t *chip, double cycles)
+{
+	if (cycles <= 0.0)
+		return 0;
+	double rate = osc_rate(chip, now) * EMU_CPU_CLK_MHZ * 1e6;
+	return (uint64_t)llround((cycles / rate) * 1e12);
+}
+
+
+static uint
+timer_divider(uint control)
+{
+	uint divider = (control >> 2) & 3;
+	if (divider == 0)
+		return 1;
+	else if (divider == 1)
+		return 16;
+	else
+		return 256;
+}
+
+
+/**
+ * Schedule the next interrupt of a core's timer 1 (if it will interrupt).
+ */
+static void
+schedule_tc1_interrupt(emu_core_t *core, double cycles)
+{
+	emu_timer_t *timer = &(core->timers[1]);
+	uint control = timer->control;
+	if ( !params.tc1_interrupts
+	     || !(control & TC_ENABLE) || !(control & TC_INT_ENABLE) || !timer->load
+	   )
+		return;
+	
+	double period = (double)timer->load * timer_divider(control);
+	double expiry = timer->load_cycles + period;
+	if (!(control & TC_ONE_SHOT) && (control & TC_PERIODIC))
+		expiry += floor((cycles - timer->load_cycles) / period) * period;
+	else if (expiry <= cycles)
+		return;
+	
+	// The callback runs after the interrupt latency
+	uint64_t time = now + osc_cycles_to_ps(core->chip, expiry - cycles);
+	event_t *event = new_event(EV_TC1_EXPIRED, core->chip, core->p, time + callback_latency(core, TIMER_TICK));
+	event->generation = timer->generation;
+	schedule(event);
+}
+
+
+/**
+ * Bring a core's timer up to date with the current time: apply any writes made
+ * by the application to its load and control registers, update its count and
+ * (re)schedule or cancel its interrupt.
+ */
+static void
+sync_timer(emu_core_t *core, uint n)
+{
+	emu_timer_t *timer = &(core->timers[n]);
+	double cycles = osc_cycles(core->chip, now);
+	uint control = timer->regs[TC_CONTROL];
+	uint old_control = timer->control;
+	bool was_enabled = (old_control & TC_ENABLE) != 0;
+	bool enabled = (control & TC_ENABLE) != 0;
+	bool restarted = false;
+	
+	// The count restarts from the load value when it is written or when the
+	// timer is enabled.
+	if (timer->regs[TC_LOAD] != TC_LOAD_UNWRITTEN) {
+		timer->load = timer->regs[TC_LOAD];
+		timer->regs[TC_LOAD] = TC_LOAD_UNWRITTEN;
+		timer->load_cycles = cycles;
+		restarted = true;
+	} else if (enabled && !was_enabled) {
+		timer->load_cycles = cycles;
+		restarted = true;
+	}
+	timer->control = control;
+	
+	if (enabled) {
+		uint64_t elapsed = (uint64_t)((cycles - timer->load_cycles) / timer_divider(control));
+		if (control & TC_ONE_SHOT)
+			timer->regs[TC_COUNT] = (elapsed >= timer->load) ? 0 : timer->load - elapsed;
+		else if ((control & TC_PERIODIC) && timer->load)
+			timer->regs[TC_COUNT] = timer->load - (elapsed % timer->load);
+		else
+			timer->regs[TC_COUNT] = timer->load - (uint)elapsed;
+	}
+	
+	// Only timer 1 interrupts are delivered (as TIMER_TICK events)
+	if (n == 1 && (restarted || control != old_control)) {
+		timer->generation++;
+		schedule_tc1_interrupt(core, cycles);
+	}
+}
+
+
+/**
+ * The decoded value of a router wait field: a 4-bit mantissa M and exponent E
+ * giving ((16 + M) << E) - 16 router clock cycles (ps).
+ */
+static uint64_t
+router_wait_ps(uint wait)
+{
+	uint64_t cycles = ((uint64_t)(16 + (wait & 0xF)) << (wait >> 4)) - 16;
+	return cycles * ROUTER_CLOCK_PS;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Application cores
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Make the given core the current core, swapping its global variables into
+ * its thread's data segment if required.
+ */
+static void
+switch_to(emu_core_t *core)
+{
+	if (self->resident != core) {
+		if (self->resident)
+			memcpy(self->resident->context, self->segment, self->segment_size);
+		memcpy(self->segment, core->context, self->segment_size);
+		self->resident = core;
+	}
+	current = core;
+}
+
+
+/**
+ * Apply any timer writes made by the current core and leave it.
+ */
+static void
+leave_core(void)
+{
+	sync_timer(current, 1);
+	sync_timer(current, 2);
+	current = NULL;
+}
+
+
+/**
+ * Run a callback on a core.
+ */
+static void
+run_callback(emu_core_t *core, uint event_id, uint arg0, uint arg1)
+{
+	callback_t callback = core->callbacks[event_id];
+	if (core->exited || !callback)
+		return;
+	
+	switch_to(core);
+	callback(arg0, arg1);
+	leave_core();
+}
+
+
+static void
+start_core(emu_core_t *core)
+{
+	switch_to(core);
+	self->c_main();
+	leave_core();
+}
+
+
+/**
+ * Schedule the next spin1 timer tick of a core.
+ */
+static void
+schedule_timer_tick(emu_core_t *core)
+{
+	double cycles = (double)core->timer_tick * EMU_CPU_CLK_MHZ;
+	uint64_t time = now + osc_cycles_to_ps(core->chip, cycles);
+	schedule(new_event(EV_TIMER_TICK, core->chip, core->p, time));
+	core->tick_scheduled = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Network
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Look up a key in a chip's routing table. Returns false if no entry matches.
+ */
+static bool
+route_lookup(const emu_chip_t *chip, uint key, uint *route)
+{
+	for (uint i = 0; i < chip->rtr_num_entries; i++) {
+		const rtr_entry_t *entry = &(chip->rtr_entries[i]);
+		if ((key & entry->mask) == entry->key) {
+			*route = entry->route;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/**
+ * Route a packet arriving at a chip's router.
+ */
+static void
+route_packet(event_t *packet)
+{
+	emu_chip_t *chip = packet->chip;
+	self->num_hops++;
+	
+	// Packets arriving over a link which match no entry are default routed
+	// straight through the chip.
+	uint route;
+	if (!route_lookup(chip, packet->key, &route)) {
+		if (packet->in_link < 0) {
+			self->num_dropped++;
+			return;
+		}
+		route = ROUTE_LINK(OPPOSITE_LINK(packet->in_link));
+	}
+	
+	uint64_t routed = now + NS_TO_PS(ROUTER_LATENCY_NS);
+	uint bits = packet->has_payload ? PACKET_PAYLOAD_BITS : PACKET_BITS;
+	uint64_t packet_ps = (uint64_t)bits * LINK_BIT_PS;
+	
+	// The time a packet may wait for a blocked link before being dropped
+	uint control = chip->rtr_regs[RTR_CONTROL / sizeof(uint)];
+	bool drop_blocked = RTR_WAIT1(control) != RTR_WAIT_FOREVER
+	                 && RTR_WAIT2(control) != RTR_WAIT_FOREVER;
+	uint64_t max_wait = (LINK_BUFFER_PACKETS * packet_ps)
+	                  + router_wait_ps(RTR_WAIT1(control))
+	                  + router_wait_ps(RTR_WAIT2(control));
+	
+	for (int link = 0; link < NUM_LINKS; link++) {
+		if (!(route & ROUTE_LINK(link)))
+			continue;
+		
+		int x = (int)chip->x + LINK_DX[link];
+		int y = (int)chip->y + LINK_DY[link];
+		if (x < 0 || x >= (int)params.width || y < 0 || y >= (int)params.height) {
+			self->num_dropped++;
+			continue;
+		}
+		
+		// Wait for the link to become free of other emulated packets and, with
+		// the probability that it is in use, for a background packet
+		uint64_t start = routed;
+		if (chip->link_free_at[link] > start)
+			start = chip->link_free_at[link];
+		if (params.link_load > 0.0 && tb_rng_uniform(&(chip->link_rng)) < params.link_load)
+			start += (uint64_t)( tb_rng_uniform(&(chip->link_rng))
+			                   * params.link_load_bits * LINK_BIT_PS
+			                   );
+		if (drop_blocked && start - routed > max_wait) {
+			self->num_dropped++;
+			continue;
+		}
+		
+		uint64_t sent = start + packet_ps;
+		chip->link_free_at[link] = sent;
+		
+		event_t *hop = new_event(EV_PACKET_HOP, chip_at(x, y), 0, sent + NS_TO_PS(LINK_LATENCY_NS));
+		hop->key = packet->key;
+		hop->payload = packet->payload;
+		hop->has_payload = packet->has_payload;
+		hop->in_link = OPPOSITE_LINK(link);
+		hop->src_chip = chip->x + (chip->y * params.width);
+		hop->src_seq = chip->num_sent++;
+		schedule(hop);
+	}
+	
+	// Packets for cores which are not emulated vanish
+	for (uint p = 1; p <= params.cores_per_chip; p++) {
+		if (!(route & ROUTE_CORE(p)))
+			continue;
+		emu_core_t *core = &(chip->cores[p]);
+		uint event_id = packet->has_payload ? MCPL_PACKET_RECEIVED : MC_PACKET_RECEIVED;
+		event_t *rx = new_event(EV_PACKET_RX, chip, p, routed + callback_latency(core, event_id));
+		rx->key = packet->key;
+		rx->payload = packet->payload;
+		rx->has_payload = packet->has_payload;
+		schedule(rx);
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Host emulation interface (see include/)
+////////////////////////////////////////////////////////////////////////////////
+
+volatile uint *
+emu_timer_regs(uint timer)
+{
+	sync_timer(current, timer);
+	return current->timers[timer].regs;
+}
+
+
+uintptr_t
+emu_sdram_base(void)
+{
+	emu_chip_t *chip = current->chip;
+	if (!chip->sdram) {
+		// Reserve address space only: pages are allocated as they are used
+		chip->sdram = mmap( NULL, EMU_SDRAM_SIZE
+		                  , PROT_READ | PROT_WRITE
+		                  , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE
+		                  , -1, 0
+		                  );
+		if (chip->sdram == MAP_FAILED) {
+			fprintf(stderr, "Could not allocate SDRAM.\n");
+			exit(1);
+		}
+	}
+	return (uintptr_t)chip->sdram;
+}
+
+
+uintptr_t
+emu_router_base(void)
+{
+	return (uintptr_t)current->chip->rtr_regs;
+}
+
+
+sv_t *
+emu_sv(void)
+{
+	emu_chip_t *chip = current->chip;
+	double cycles = osc_cycles(chip, now) - chip->start_cycles;
+	chip->system_variables.clock_ms = (uint)(cycles / (EMU_CPU_CLK_MHZ * 1000.0));
+	return &(chip->system_variables);
+}
+
+
+sark_data_t *
+emu_sark(void)
+{
+	return &(current->sark_data);
+}
+
+
+uint
+emu_lead_ap(void)
+{
+	return current->p == 1;
+}
+
+
+void
+io_printf(char *stream, char *format, ...)
+{
+	emu_chip_t *chip = current->chip;
+	if (params.quiet && (chip->x != 0 || chip->y != 0))
+		return;
+	
+	char message[1024];
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, sizeof(message), format, args);
+	va_end(args);
+	
+	pthread_mutex_lock(&output_lock);
+	fprintf(params.output, "[%12.6f] %d,%d,%d: %s", PS_TO_S(now), chip->x, chip->y, current->p, message);
+	pthread_mutex_unlock(&output_lock);
+}
+
+
+uint
+rtr_alloc(uint size)
+{
+	emu_chip_t *chip = current->chip;
+	if (!chip->rtr_entries) {
+		chip->rtr_entries = calloc(RTR_ENTRIES, sizeof(rtr_entry_t));
+		if (!chip->rtr_entries)
+			return 0;
+	}
+	
+	// Entries are allocated in order. Entry zero is never allocated (zero
+	// indicates failure) and so, unlike the hardware, is not used.
+	if (chip->rtr_num_entries + size >= RTR_ENTRIES)
+		return 0;
+	uint entry = chip->rtr_num_entries + 1;
+	chip->rtr_num_entries += size;
+	return entry;
+}
+
+
+uint
+rtr_mc_set(uint entry, uint key, uint mask, uint route)
+{
+	emu_chip_t *chip = current->chip;
+	if (entry == 0 || entry > chip->rtr_num_entries)
+		return 0;
+	
+	rtr_entry_t *e = &(chip->rtr_entries[entry - 1]);
+	e->key = key;
+	e->mask = mask;
+	e->route = route;
+	return 1;
+}
+
+
+void
+sark_word_set(void *dest, uint data, uint n)
+{
+	uint *words = dest;
+	for (uint i = 0; i < n / sizeof(uint); i++)
+		words[i] = data;
+}
+
+
+// Callbacks are never preempted so priorities only affect the latency of FIQ
+// (priority -1) callbacks
+void
+spin1_callback_on(uint event_id, callback_t cback, int priority)
+{
+	if (event_id < NUM_EVENTS) {
+		current->callbacks[event_id] = cback;
+		current->fiq[event_id] = priority < 0;
+	}
+}
+
+
+void
+spin1_callback_off(uint event_id)
+{
+	if (event_id < NUM_EVENTS) {
+		current->callbacks[event_id] = NULL;
+		current->fiq[event_id] = false;
+	}
+}
+
+
+uint
+spin1_send_mc_packet(uint key, uint data, uint load)
+{
+	// Packets are transferred to the router one at a time
+	uint64_t transfer_ps = NS_TO_PS(CORE_TO_ROUTER_NS);
+	uint64_t start = (current->tx_free_at > now) ? current->tx_free_at : now;
+	if (start - now >= TX_QUEUE_SIZE * transfer_ps) {
+		self->num_tx_full++;
+		return 0;
+	}
+	current->tx_free_at = start + transfer_ps;
+	
+	emu_chip_t *chip = current->chip;
+	event_t *packet = new_event(EV_PACKET_HOP, chip, 0, current->tx_free_at);
+	packet->key = key;
+	packet->payload = data;
+	packet->has_payload = load;
+	packet->in_link = -1;
+	packet->src_chip = chip->x + (chip->y * params.width);
+	packet->src_seq = chip->num_sent++;
+	schedule(packet);
+	return 1;
+}
+
+
+void
+spin1_set_timer_tick(uint time)
+{
+	current->timer_tick = time;
+	if (current->started && time && !current->tick_scheduled)
+		schedule_timer_tick(current);
+}
+
+
+uint
+spin1_get_chip_id(void)
+{
+	return (current->chip->x << 8) | current->chip->y;
+}
+
+
+uint
+spin1_get_core_id(void)
+{
+	return current->p;
+}
+
+
+void
+spin1_led_control(uint p)
+{
+	// LEDs are not modelled
+}
+
+
+uint
+spin1_rand(void)
+{
+	return (uint)tb_rng_next(&(current->rng));
+}
+
+
+void
+spin1_srand(uint seed)
+{
+	tb_rng_init(&(current->rng), seed);
+}
+
+
+// Callbacks are never preempted so interrupt control is a no-op
+uint spin1_int_disable(void) { return 0; }
+uint spin1_irq_disable(void) { return 0; }
+uint spin1_fiq_disable(void) { return 0; }
+void spin1_mode_restore(uint value) {}
+
+
+uint
+spin1_trigger_user_event(uint arg0, uint arg1)
+{
+	// Only one user event may be pending at a time
+	if (current->user_pending)
+		return 0;
+	current->user_pending = true;
+	current->user_arg0 = arg0;
+	current->user_arg1 = arg1;
+	
+	uint64_t time = now + callback_latency(current, USER_EVENT);
+	schedule(new_event(EV_USER, current->chip, current->p, time));
+	return 1;
+}
+
+
+uint
+spin1_start(uint sync)
+{
+	current->started = true;
+	if (current->timer_tick)
+		schedule_timer_tick(current);
+	return 0;
+}
+
+
+void
+spin1_exit(uint error)
+{
+	if (current->exited)
+		return;
+	current->exited = true;
+	self->num_running--;
+	if (current == stop_core)
+		self->stopping = true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Loading the application
+////////////////////////////////////////////////////////////////////////////////
+
+// Used to find the application's data segment with dl_iterate_phdr
+typedef struct {
+	void *symbol;
+	uint8_t *start;
+	uint8_t *end;
+} segment_search_t;
+
+
+static int
+find_data_segment(struct dl_phdr_info *info, size_t size, void *data)
+{
+	segment_search_t *search = data;
+	
+	// Is this the object containing the symbol?
+	bool found = false;
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &(info->dlpi_phdr[i]);
+		uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+		if ( phdr->p_type == PT_LOAD
+		     && (uintptr_t)search->symbol >= start
+		     && (uintptr_t)search->symbol < start + phdr->p_memsz
+		   )
+			found = true;
+	}
+	if (!found)
+		return 0;
+	
+	// Find the writable segment, excluding any part made read-only after
+	// relocation.
+	uintptr_t relro_end = 0;
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &(info->dlpi_phdr[i]);
+		if (phdr->p_type == PT_GNU_RELRO) {
+			uintptr_t page_size = sysconf(_SC_PAGESIZE);
+			relro_end = (info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz) & ~(page_size - 1);
+		}
+	}
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		const ElfW(Phdr) *phdr = &(info->dlpi_phdr[i]);
+		if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_W)) {
+			uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+			uintptr_t end = start + phdr->p_memsz;
+			if (start < relro_end)
+				start = relro_end;
+			search->start = (uint8_t *)start;
+			search->end = (uint8_t *)end;
+		}
+	}
+	return 1;
+}
+
+
+/**
+ * Copy a file to a new temporary file, returning its name (which must be
+ * freed) or NULL on failure.
+ */
+static char *
+copy_to_temp(const char *filename)
+{
+	char *copy = strdup("/tmp/spin1_emu_XXXXXX");
+	int fd = copy ? mkstemp(copy) : -1;
+	FILE *in = fopen(filename, "rb");
+	FILE *out = (fd >= 0) ? fdopen(fd, "wb") : NULL;
+	bool ok = in && out;
+	
+	char buf[65536];
+	size_t n;
+	while (ok && (n = fread(buf, 1, sizeof(buf), in)) > 0)
+		ok = fwrite(buf, 1, n, out) == n;
+	
+	if (in)
+		fclose(in);
+	if (out)
+		ok = (fclose(out) == 0) && ok;
+	else if (fd >= 0)
+		close(fd);
+	if (!ok && copy) {
+		if (fd >= 0)
+			unlink(copy);
+		free(copy);
+		copy = NULL;
+	}
+	return copy;
+}
+
+
+/**
+ * Load a copy of the application for a thread. The first thread loads the
+ * application itself (so that profilers can find it); every other thread
+ * loads a temporary copy of it since the dynamic linker will only load any
+ * given file once.
+ */
+static void
+load_app(emu_thread_t *thread, const char *filename)
+{
+	void *handle;
+	if (thread->id == 0) {
+		handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+	} else {
+		char *copy = copy_to_temp(filename);
+		if (!copy) {
+			fprintf(stderr, "Could not copy %s.\n", filename);
+			exit(1);
+		}
+		handle = dlopen(copy, RTLD_NOW | RTLD_LOCAL);
+		unlink(copy);
+		free(copy);
+	}
+	if (!handle) {
+		fprintf(stderr, "Could not load %s: %s\n", filename, dlerror());
+		exit(1);
+	}
+	thread->handle = handle;
+	
+	thread->c_main = (void (*)(void))dlsym(handle, "c_main");
+	if (!thread->c_main) {
+		fprintf(stderr, "Application does not define c_main.\n");
+		exit(1);
+	}
+	
+	segment_search_t search = {.symbol = (void *)thread->c_main, .start = NULL, .end = NULL};
+	dl_iterate_phdr(find_data_segment, &search);
+	if (!search.start) {
+		fprintf(stderr, "Could not find the data segment of %s.\n", filename);
+		exit(1);
+	}
+	thread->segment = search.start;
+	thread->segment_size = search.end - search.start;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Emulation
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+initialise_chips(void)
+{
+	tb_rng_t rng;
+	tb_rng_init(&rng, params.seed);
+	
+	for (uint y = 0; y < params.height; y++) {
+		for (uint x = 0; x < params.width; x++) {
+			emu_chip_t *chip = chip_at(x, y);
+			chip->x = x;
+			chip->y = y;
+			
+			// Rows are divided evenly between the threads
+			chip->thread = &(threads[(y * params.num_threads) / params.height]);
+			
+			chip->freq_offset = ((2.0 * tb_rng_uniform(&rng)) - 1.0) * params.max_offset_ppm * 1e-6;
+			chip->start_cycles = tb_rng_uniform(&rng) * 4294967296.0 * 256.0;
+			if (params.max_wander_ppm > 0.0) {
+				chip->wander_amplitude = tb_rng_uniform(&rng) * params.max_wander_ppm * 1e-6;
+				chip->wander_phase = tb_rng_uniform(&rng) * TWO_PI;
+			}
+			if (params.link_load > 0.0)
+				tb_rng_init(&(chip->link_rng), tb_rng_next(&rng));
+			
+			// Chip (0, 0) starts first
+			double start = (x == 0 && y == 0) ? 0.0 : tb_rng_uniform(&rng) * START_SPREAD;
+			chip->start_time = S_TO_PS(start);
+			
+			chip->rtr_regs[RTR_CONTROL / sizeof(uint)] = RTR_CONTROL_RESET;
+			chip->system_variables.cpu_clk = EMU_CPU_CLK_MHZ;
+			chip->system_variables.led_period = 1;
+			
+			for (uint p = 1; p <= params.cores_per_chip; p++) {
+				emu_core_t *core = &(chip->cores[p]);
+				core->chip = chip;
+				core->p = p;
+				for (uint n = 1; n <= 2; n++)
+					core->timers[n].regs[TC_LOAD] = TC_LOAD_UNWRITTEN;
+				core->sark_data.vcpu = &(core->vcpu);
+				core->sark_data.virt_cpu = p;
+				tb_rng_init(&(core->rng), tb_rng_next(&rng));
+				tb_rng_init(&(core->latency_rng), tb_rng_next(&rng));
+			}
+		}
+	}
+}
+
+
+/**
+ * Give a thread's cores their initial state and schedule their start.
+ */
+static void
+initialise_thread(emu_thread_t *thread)
+{
+	for (uint i = 0; i < params.width * params.height; i++) {
+		emu_chip_t *chip = &(chips[i]);
+		if (chip->thread != thread)
+			continue;
+		
+		for (uint p = 1; p <= params.cores_per_chip; p++) {
+			emu_core_t *core = &(chip->cores[p]);
+			
+			// Every core starts with the application's initial data
+			core->context = malloc(thread->segment_size);
+			if (!core->context)
+				out_of_memory();
+			memcpy(core->context, thread->segment, thread->segment_size);
+			thread->num_running++;
+		}
+		cq_push(&(thread->queue), &(new_event(EV_START, chip, 0, chip->start_time)->cq));
+	}
+}
+
+
+static void
+handle_event(event_t *event)
+{
+	emu_chip_t *chip = event->chip;
+	emu_core_t *core = &(chip->cores[event->p]);
+	
+	if (event->type == EV_START) {
+		for (uint p = 1; p <= params.cores_per_chip; p++)
+			start_core(&(chip->cores[p]));
+	} else if (event->type == EV_TIMER_TICK) {
+		core->tick_scheduled = false;
+		if (!core->exited && core->timer_tick) {
+			schedule_timer_tick(core);
+			run_callback(core, TIMER_TICK, ++core->timer_ticks, 0);
+		}
+	} else if (event->type == EV_TC1_EXPIRED) {
+		// Ignore interrupts cancelled (or rescheduled) since being scheduled
+		emu_timer_t *timer = &(core->timers[1]);
+		if (event->generation == timer->generation) {
+			if (timer->control & TC_PERIODIC)
+				schedule_tc1_interrupt(core, osc_cycles(chip, now));
+			run_callback(core, TIMER_TICK, 0, 0);
+		}
+	} else if (event->type == EV_PACKET_HOP) {
+		route_packet(event);
+	} else if (event->type == EV_PACKET_RX) {
+		run_callback( core
+		            , event->has_payload ? MCPL_PACKET_RECEIVED : MC_PACKET_RECEIVED
+		            , event->key, event->payload
+		            );
+	} else if (event->type == EV_USER) {
+		core->user_pending = false;
+		run_callback(core, USER_EVENT, core->user_arg0, core->user_arg1);
+	}
+}
+
+
+/**
+ * Should this thread stop processing events (without waiting for the end of
+ * the window)?
+ */
+static bool
+stop_now(void)
+{
+	return self->stopping || (params.num_threads == 1 && self->num_running == 0);
+}
+
+
+/**
+ * Process every event before the given time.
+ */
+static void
+run_window(uint64_t window_end)
+{
+	const cq_event_t *next;
+	while (!stop_now() && (next = cq_peek(&(self->queue))) && next->time < window_end) {
+		event_t *event = (event_t *)cq_pop(&(self->queue));
+		now = event->cq.time;
+		self->num_events++;
+		handle_event(event);
+		free_event(event);
+	}
+}
+
+
+static void *
+run_thread(void *arg)
+{
+	self = arg;
+	now = self->last_time;
+	
+	// With one thread there is nothing to synchronise with
+	uint64_t lookahead = (params.num_threads > 1) ? LOOKAHEAD_PS : NEVER - run_end;
+	
+	uint64_t window_start = run_start;
+	while (true) {
+		uint64_t window_end = window_start + lookahead;
+		if (window_end > run_end + 1)
+			window_end = run_end + 1;
+		run_window(window_end);
+		
+		if (params.num_threads == 1)
+			break;
+		
+		// Exchange packets between threads and then find the next window with
+		// something to do.
+		pthread_barrier_wait(&barrier);
+		drain_inbox();
+		const cq_event_t *next = cq_peek(&(self->queue));
+		self->next_time = next ? next->time : NEVER;
+		self->published_running = self->num_running;
+		self->published_stopping = self->stopping;
+		pthread_barrier_wait(&barrier);
+		
+		uint64_t next_time = NEVER;
+		uint num_running = 0;
+		bool stopping = false;
+		for (uint i = 0; i < params.num_threads; i++) {
+			if (threads[i].next_time < next_time)
+				next_time = threads[i].next_time;
+			num_running += threads[i].published_running;
+			stopping = stopping || threads[i].published_stopping;
+		}
+		if (stopping || num_running == 0 || next_time > run_end)
+			break;
+		window_start = (next_time > window_end) ? next_time : window_end;
+	}
+	
+	self->last_time = now;
+	return NULL;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Front-end interface (see emu_machine.h)
+////////////////////////////////////////////////////////////////////////////////
+
+void
+emu_machine_initialise_params(emu_params_t *p)
+{
+	p->width = DEFAULT_WIDTH;
+	p->height = DEFAULT_HEIGHT;
+	p->cores_per_chip = DEFAULT_CORES_PER_CHIP;
+	p->num_threads = 1;
+	p->seed = 0;
+	p->max_offset_ppm = DEFAULT_MAX_FREQ_OFFSET_PPM;
+	p->max_wander_ppm = 0.0;
+	p->wander_period = DEFAULT_WANDER_PERIOD;
+	p->tc1_interrupts = true;
+	p->link_load = 0.0;
+	p->link_load_bits = PACKET_BITS;
+	p->output = stdout;
+	p->quiet = false;
+}
+
+
+void
+emu_machine_initialise(const emu_params_t *p, const char *app_filename)
+{
+	params = *p;
+	if (params.width < 1 || params.height < 1 || params.width > 256 || params.height > 256) {
+		fprintf(stderr, "The machine must be between 1x1 and 256x256 chips.\n");
+		exit(1);
+	}
+	if (params.cores_per_chip < 1 || params.cores_per_chip >= EMU_MAX_CORES_PER_CHIP) {
+		fprintf(stderr, "There must be between 1 and %d cores per chip.\n", EMU_MAX_CORES_PER_CHIP - 1);
+		exit(1);
+	}
+	if (params.num_threads < 1 || params.num_threads > params.height) {
+		fprintf(stderr, "There must be between 1 and %u threads (one per row).\n", params.height);
+		exit(1);
+	}
+	
+	chips = calloc(params.width * params.height, sizeof(emu_chip_t));
+	threads = calloc(params.num_threads, sizeof(emu_thread_t));
+	if (!chips || !threads)
+		out_of_memory();
+	
+	for (uint i = 0; i < params.num_threads; i++) {
+		emu_thread_t *thread = &(threads[i]);
+		thread->id = i;
+		load_app(thread, app_filename);
+		pthread_mutex_init(&(thread->inbox_lock), NULL);
+		if (cq_init(&(thread->queue)))
+			out_of_memory();
+	}
+	initialise_chips();
+	for (uint i = 0; i < params.num_threads; i++) {
+		self = &(threads[i]);
+		initialise_thread(self);
+	}
+	self = NULL;
+	
+	pthread_barrier_init(&barrier, NULL, params.num_threads);
+}
+
+
+bool
+emu_machine_stop_on_core(uint x, uint y, uint p)
+{
+	if (x >= params.width || y >= params.height || p < 1 || p > params.cores_per_chip)
+		return false;
+	stop_core = &(chip_at(x, y)->cores[p]);
+	return true;
+}
+
+
+bool
+emu_machine_run(double until)
+{
+	run_end = S_TO_PS(until);
+	if (stopped || run_end < run_start)
+		return !stopped;
+	
+	for (uint i = 0; i < params.num_threads; i++) {
+		if (pthread_create(&(threads[i].thread), NULL, run_thread, &(threads[i]))) {
+			fprintf(stderr, "Could not start thread %u.\n", i);
+			exit(1);
+		}
+	}
+	
+	uint num_running = 0;
+	for (uint i = 0; i < params.num_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		num_running += threads[i].num_running;
+		stopped = stopped || threads[i].stopping;
+	}
+	stopped = stopped || num_running == 0;
+	
+	// Leave the front-end at the end of the run (e.g. to read the cores' timers)
+	run_start = run_end + 1;
+	now = run_end;
+	return !stopped;
+}
+
+
+void
+emu_machine_get_stats(emu_stats_t *stats)
+{
+	memset(stats, 0, sizeof(emu_stats_t));
+	uint64_t last_time = 0;
+	for (uint i = 0; i < params.num_threads; i++) {
+		stats->num_events += threads[i].num_events;
+		stats->num_hops += threads[i].num_hops;
+		stats->num_dropped += threads[i].num_dropped;
+		stats->num_tx_full += threads[i].num_tx_full;
+		stats->num_running += threads[i].num_running;
+		if (threads[i].last_time > last_time)
+			last_time = threads[i].last_time;
+	}
+	stats->last_time = PS_TO_S(last_time);
+}
+
+
+const uint8_t *
+emu_machine_chip_sdram(uint x, uint y)
+{
+	return chip_at(x, y)->sdram;
+}
+
+
+emu_core_t *
+emu_machine_get_core(uint x, uint y, uint p)
+{
+	return &(chip_at(x, y)->cores[p]);
+}
+
+
+emu_core_t *
+emu_machine_set_current(emu_core_t *core)
+{
+	emu_core_t *previous = current;
+	current = core;
+	return previous;
+}
+
+
+void *
+emu_machine_core_global(emu_core_t *core, const char *name)
+{
+	// Find the variable's offset in the data segment of the first thread's copy
+	// of the application and then in the core's own copy
+	uint8_t *addr = dlsym(threads[0].handle, name);
+	if (!addr || addr < threads[0].segment || addr >= threads[0].segment + threads[0].segment_size)
+		return NULL;
+	size_t offset = addr - threads[0].segment;
+	
+	emu_thread_t *thread = core->chip->thread;
+	if (thread->resident == core)
+		return thread->segment + offset;
+	else
+		return core->context + offset;
+}
+
+
+void *
+emu_machine_app_function(const char *name)
+{
+	return dlsym(threads[0].handle, name);
+}
+
+
+bool
+emu_machine_core_started(const emu_core_t *core)
+{
+	return core->started;
+}
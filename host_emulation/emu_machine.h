@@ -0,0 +1,184 @@
+/**
+ * An emulated SpiNNaker machine on which an unmodified application (compiled
+ * for the host against the headers in include/ into a shared object) runs on
+ * every application core. Provides the emu_* functions declared in include/
+ * along with the SARK and spin1 API functions. Used by emulation front-ends
+ * (spin1_emu.c and network_sim) which choose the machine's parameters, run it
+ * and report on it.
+ *
+ * Each emulated chip has its own oscillator (with a random fixed frequency
+ * offset and, optionally, a slow sinusoidal wander) driving the timers of its
+ * cores, SDRAM shared by its cores, system variables and a router. Every core
+ * runs the application's c_main and then has events delivered to the callbacks
+ * it registers: spin1 timer ticks, timer 1 interrupts (periodic or one-shot),
+ * multicast packets and user events. Callbacks take no simulated time and are
+ * never preempted; those registered with priority -1 (FIQ) run with a shorter
+ * interrupt latency. Multicast packets are routed hop-by-hop through the
+ * routing tables installed by the application (first matching entry, default
+ * routing straight through for packets arriving over a link) with router
+ * latency, link serialisation and link contention modelled. A packet which
+ * finds its outgoing link blocked for longer than the router's wait1 plus wait2
+ * time (from its control register) is dropped (emergency routing is not
+ * modelled). Traffic from cores which are not emulated may be modelled
+ * statistically as a background load on every link.
+ *
+ * The chips are divided into contiguous blocks of rows, one per thread. Each
+ * thread loads its own copy of the application so that its cores' global
+ * variables are independent of those of other threads' cores; within a
+ * thread, the writable data segment of the application is swapped for the
+ * state of the core about to run whenever a different core is scheduled.
+ * Threads are kept in step conservatively: every packet between chips takes
+ * at least a lookahead (one hop) to arrive so each thread may process all of
+ * its events in a window of that length independently, exchanging packets for
+ * other threads' chips at the end of the window. Windows with no events are
+ * skipped. Runs are deterministic for a given seed and number of threads.
+ */
+
+#ifndef EMU_MACHINE_H
+#define EMU_MACHINE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "spin1_api.h"
+
+// Nominal CPU clock frequency (MHz)
+#define EMU_CPU_CLK_MHZ 200
+
+// The number of cores on a chip (including the monitor)
+#define EMU_MAX_CORES_PER_CHIP 18
+
+// Size of the (emulated) SDRAM of each chip. Pages are only allocated as they
+// are used.
+#define EMU_SDRAM_SIZE (128u * 1024u * 1024u)
+
+/**
+ * The parameters of an emulated machine. Use
+ * emu_machine_initialise_params to get the defaults.
+ */
+typedef struct {
+	// Size of the machine (chips) and the number of application cores emulated
+	// on each chip (numbered from 1: core 0 is the monitor and is not emulated)
+	uint width;
+	uint height;
+	uint cores_per_chip;
+	
+	// Number of threads to divide the rows of chips between
+	uint num_threads;
+	
+	uint64_t seed;
+	
+	// Range of each chip's fixed frequency offset (+/- ppm), range of the
+	// amplitude of its sinusoidal frequency wander (ppm) and the wander's period
+	// (s). The phase of the wander is random.
+	double max_offset_ppm;
+	double max_wander_ppm;
+	double wander_period;
+	
+	// Deliver timer 1 interrupts (otherwise the timers still count but never
+	// interrupt)
+	bool tc1_interrupts;
+	
+	// The fraction of every link's bandwidth used by traffic which is not
+	// emulated and the size of its packets (bits). A packet sent on a link finds
+	// it busy with this traffic with this probability, in which case it waits
+	// for the remainder of a packet.
+	double link_load;
+	uint link_load_bits;
+	
+	// Where io_printf output is written (prefixed with the simulated time and
+	// the core) and whether only the output of the cores of chip (0, 0) is.
+	FILE *output;
+	bool quiet;
+} emu_params_t;
+
+/**
+ * Totals over the run so far.
+ */
+typedef struct {
+	uint64_t num_events;
+	uint64_t num_hops;
+	uint64_t num_dropped;
+	uint64_t num_tx_full;
+	
+	// The number of cores which have not called spin1_exit
+	uint num_running;
+	
+	// The simulated time of the last event processed (s)
+	double last_time;
+} emu_stats_t;
+
+// An emulated core (not intended for public access)
+typedef struct emu_core emu_core_t;
+
+
+/**
+ * Get the default parameters: a 12x12 machine of 16 application cores per
+ * chip run on one thread, delivering timer 1 interrupts, without frequency
+ * wander or background load and printing to stdout.
+ */
+void emu_machine_initialise_params(emu_params_t *params);
+
+/**
+ * Build the machine, load the application (one copy per thread) and schedule
+ * the start of every chip. Exits on failure.
+ */
+void emu_machine_initialise(const emu_params_t *params, const char *app_filename);
+
+/**
+ * Stop once the given core has called spin1_exit (rather than only when every
+ * core has). Returns false if the core does not exist.
+ */
+bool emu_machine_stop_on_core(uint x, uint y, uint p);
+
+/**
+ * Process every event up to the given simulated time (s), continuing from the
+ * last call. Returns false once the emulation has stopped (because every core
+ * has called spin1_exit or see emu_machine_stop_on_core), after which further
+ * calls do nothing.
+ */
+bool emu_machine_run(double until);
+
+/**
+ * Get the totals over the run so far.
+ */
+void emu_machine_get_stats(emu_stats_t *stats);
+
+/**
+ * The SDRAM of a chip, or NULL if it has never been used (and so reads as
+ * zero).
+ */
+const uint8_t *emu_machine_chip_sdram(uint x, uint y);
+
+/**
+ * Get a core. Between runs, the application's functions may be called as that
+ * core (e.g. to read its timers) after making it the current core.
+ */
+emu_core_t *emu_machine_get_core(uint x, uint y, uint p);
+
+/**
+ * Make a core (or NULL) the current core, returning the previous one. The
+ * core's global variables are not swapped in (see
+ * emu_machine_core_global).
+ */
+emu_core_t *emu_machine_set_current(emu_core_t *core);
+
+/**
+ * The address of one of the application's global variables as seen by the
+ * given core, or NULL if the application does not define it.
+ */
+void *emu_machine_core_global(emu_core_t *core, const char *name);
+
+/**
+ * The address of one of the application's functions, or NULL if the
+ * application does not define it.
+ */
+void *emu_machine_app_function(const char *name);
+
+/**
+ * Has the core's application called spin1_start?
+ */
+bool emu_machine_core_started(const emu_core_t *core);
+
+#endif
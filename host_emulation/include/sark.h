@@ -0,0 +1,76 @@
+/**
+ * Host emulation of the parts of the SARK API used by the applications in this
+ * repository. See spinnaker.h.
+ */
+
+#ifndef SARK_H
+#define SARK_H
+
+#include "spinnaker.h"
+
+// Output streams for io_printf
+#define IO_STD ((char *) 0)
+#define IO_BUF ((char *) 1)
+
+/**
+ * Print a message from the current core (on the host's standard error).
+ */
+void io_printf(char *stream, char *format, ...);
+
+/**
+ * Allocate size consecutive multicast routing entries on the current core's
+ * chip. Returns the index of the first entry or zero if none are left.
+ */
+uint rtr_alloc(uint size);
+
+/**
+ * Set a multicast routing entry. Returns zero if the entry does not exist.
+ */
+uint rtr_mc_set(uint entry, uint key, uint mask, uint route);
+
+void sark_word_set(void *dest, uint data, uint n);
+
+/**
+ * The subset of the system variables used by applications.
+ */
+typedef struct {
+	// CPU clock (MHz)
+	uint cpu_clk;
+	
+	// Milliseconds since boot
+	uint clock_ms;
+	
+	// LED flash period of the monitor processor (zero to disable)
+	uint led_period;
+} sv_t;
+
+/**
+ * A core's VCPU block (the user registers only).
+ */
+typedef struct {
+	uint user0;
+	uint user1;
+	uint user2;
+	uint user3;
+} vcpu_t;
+
+/**
+ * The subset of the SARK data structure used by applications.
+ */
+typedef struct {
+	vcpu_t *vcpu;
+	uint virt_cpu;
+} sark_data_t;
+
+/**
+ * Per-chip and per-core SARK state of the current core.
+ */
+sv_t *emu_sv(void);
+sark_data_t *emu_sark(void);
+uint emu_lead_ap(void);
+
+#define sv     (emu_sv())
+#define sark   (*emu_sark())
+#define leadAp (emu_lead_ap())
+
+#endif
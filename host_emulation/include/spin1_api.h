@@ -0,0 +1,58 @@
+/**
+ * Host emulation of the spin1 API (as used by the applications in this
+ * repository). See spinnaker.h.
+ *
+ * Unlike on a real core, spin1_start returns immediately: the emulation
+ * environment calls c_main for each emulated core and then delivers events to
+ * the callbacks registered by it.
+ */
+
+#ifndef SPIN1_API_H
+#define SPIN1_API_H
+
+#include "sark.h"
+
+typedef void (*callback_t)(uint, uint);
+
+// Events
+#define MC_PACKET_RECEIVED   0
+#define DMA_TRANSFER_DONE    1
+#define TIMER_TICK           2
+#define SDP_PACKET_RX        3
+#define USER_EVENT           4
+#define MCPL_PACKET_RECEIVED 5
+
+#define NUM_EVENTS 6
+
+void spin1_callback_on(uint event_id, callback_t cback, int priority);
+void spin1_callback_off(uint event_id);
+
+/**
+ * Returns zero if the packet could not be queued.
+ */
+uint spin1_send_mc_packet(uint key, uint data, uint load);
+
+/**
+ * Set the period (us) of the timer tick. Takes effect at the next tick.
+ */
+void spin1_set_timer_tick(uint time);
+
+uint spin1_get_chip_id(void);
+uint spin1_get_core_id(void);
+
+void spin1_led_control(uint p);
+
+uint spin1_rand(void);
+void spin1_srand(uint seed);
+
+uint spin1_int_disable(void);
+uint spin1_irq_disable(void);
+uint spin1_fiq_disable(void);
+void spin1_mode_restore(uint value);
+
+uint spin1_trigger_user_event(uint arg0, uint arg1);
+
+uint spin1_start(uint sync);
+void spin1_exit(uint error);
+
+#endif
@@ -0,0 +1,74 @@
+/**
+ * Host emulation of the parts of the SpiNNaker hardware definitions
+ * (spinnaker.h) used by the applications in this repository.
+ *
+ * Memory-mapped peripherals are replaced by calls into the emulation
+ * environment (the emu_* functions) which is responsible for giving each
+ * emulated core its own registers and memories.
+ */
+
+#ifndef SPINNAKER_H
+#define SPINNAKER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef unsigned int   uint;
+typedef unsigned short ushort;
+typedef unsigned char  uchar;
+
+#define TRUE  1
+#define FALSE 0
+
+////////////////////////////////////////////////////////////////////////////////
+// Timer/counters
+////////////////////////////////////////////////////////////////////////////////
+
+// Register indices
+#define TC_LOAD     0
+#define TC_COUNT    1
+#define TC_CONTROL  2
+#define TC_INT_CLR  3
+#define TC_RAW_INT  4
+#define TC_MASK_INT 5
+#define TC_BG_LOAD  6
+
+/**
+ * The registers of the current core's timer (1 or 2). The registers are
+ * brought up to date with simulated time (and any writes made since the last
+ * call applied) on every call so they should be accessed via tc1 and tc2.
+ */
+volatile uint *emu_timer_regs(uint timer);
+
+#define tc1 (emu_timer_regs(1))
+#define tc2 (emu_timer_regs(2))
+
+////////////////////////////////////////////////////////////////////////////////
+// Memories and other peripherals
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * The address of the (emulated) SDRAM of the current core's chip.
+ */
+uintptr_t emu_sdram_base(void);
+
+/**
+ * The address of the (emulated) router registers of the current core's chip.
+ */
+uintptr_t emu_router_base(void);
+
+#define SDRAM_BASE_BUF (emu_sdram_base())
+#define RTR_BASE       (emu_router_base())
+
+// Router register offsets
+#define RTR_CONTROL 0x00
+
+////////////////////////////////////////////////////////////////////////////////
+// LEDs
+////////////////////////////////////////////////////////////////////////////////
+
+#define LED_ON(n)  (3 << (2 * (n)))
+#define LED_OFF(n) (2 << (2 * (n)))
+#define LED_INV(n) (1 << (2 * (n)))
+
+#endif
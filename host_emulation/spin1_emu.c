@@ -0,0 +1,198 @@
+/**
+ * A host emulator for SpiNNaker applications written against the spin1 API and
+ * SARK: runs an unmodified application (compiled for the host against the
+ * headers in include/ into a shared object) on every application core of an
+ * emulated machine (see emu_machine.h).
+ *
+ * Usage:
+ *   spin1_emu [-W width] [-H height] [-c cores_per_chip] [-j threads]
+ *             [-d duration_s] [-s seed] [-p max_offset_ppm] [-e x,y,p]
+ *             [-m x,y,offset,length,file]... [-q] app.so
+ *
+ *   -c  The number of application cores on each chip (1 to 17, numbered from
+ *       1; core 0 is the monitor and is not emulated).
+ *   -e  Stop when the given core calls spin1_exit (rather than when every core
+ *       has exited or the duration has elapsed).
+ *   -m  Once stopped, write length bytes of a chip's SDRAM from the given
+ *       offset to a file (e.g. to pass to a results unpacking script).
+ *   -p  The range of the chips' oscillator frequency offsets (+/- ppm).
+ *   -q  Only print the output of the cores of chip (0, 0).
+ *
+ * The output of io_printf is printed to stdout prefixed with the simulated
+ * time and the core. A summary is printed to stderr on completion.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "emu_machine.h"
+
+
+// Default simulation duration (s)
+#define DEFAULT_DURATION 10.0
+
+
+// An SDRAM region to dump to a file
+typedef struct {
+	uint x;
+	uint y;
+	size_t offset;
+	size_t length;
+	const char *filename;
+} sdram_dump_t;
+
+
+/**
+ * Write a region of a chip's SDRAM to a file. Returns 0 on success.
+ */
+static int
+dump_sdram(const emu_params_t *params, const sdram_dump_t *dump)
+{
+	if ( dump->x >= params->width || dump->y >= params->height
+	     || dump->offset + dump->length > EMU_SDRAM_SIZE
+	   ) {
+		fprintf(stderr, "SDRAM region %u,%u,%zu,%zu does not exist.\n"
+		       , dump->x, dump->y, dump->offset, dump->length);
+		return -1;
+	}
+	
+	FILE *f = fopen(dump->filename, "wb");
+	if (!f) {
+		fprintf(stderr, "Could not open %s.\n", dump->filename);
+		return -1;
+	}
+	
+	// SDRAM never used by the application reads as zero
+	const uint8_t *sdram = emu_machine_chip_sdram(dump->x, dump->y);
+	static const uint8_t zeros[4096];
+	size_t written = 0;
+	while (written < dump->length) {
+		size_t n = dump->length - written;
+		if (!sdram && n > sizeof(zeros))
+			n = sizeof(zeros);
+		const uint8_t *data = sdram ? sdram + dump->offset + written : zeros;
+		if (fwrite(data, 1, n, f) != n)
+			break;
+		written += n;
+	}
+	
+	if (fclose(f) != 0 || written != dump->length) {
+		fprintf(stderr, "Could not write %s.\n", dump->filename);
+		return -1;
+	}
+	return 0;
+}
+
+
+static void
+usage(const char *name)
+{
+	fprintf( stderr, "usage: %s [-W width] [-H height] [-c cores_per_chip] [-j threads]\n"
+	                 "          [-d duration_s] [-s seed] [-p max_offset_ppm] [-e x,y,p]\n"
+	                 "          [-m x,y,offset,length,file]... [-q] app.so\n"
+	       , name);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	emu_params_t params;
+	emu_machine_initialise_params(&params);
+	double duration = DEFAULT_DURATION;
+	int stop_x = -1, stop_y = -1, stop_p = -1;
+	
+	sdram_dump_t *dumps = NULL;
+	uint num_dumps = 0;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "W:H:c:j:d:s:p:e:m:q")) != -1) {
+		if (opt == 'W') {
+			params.width = atoi(optarg);
+		} else if (opt == 'H') {
+			params.height = atoi(optarg);
+		} else if (opt == 'c') {
+			params.cores_per_chip = atoi(optarg);
+		} else if (opt == 'j') {
+			params.num_threads = atoi(optarg);
+		} else if (opt == 'd') {
+			duration = atof(optarg);
+		} else if (opt == 's') {
+			params.seed = strtoull(optarg, NULL, 0);
+		} else if (opt == 'p') {
+			params.max_offset_ppm = atof(optarg);
+		} else if (opt == 'e') {
+			if (sscanf(optarg, "%d,%d,%d", &stop_x, &stop_y, &stop_p) != 3) {
+				usage(argv[0]);
+				return 1;
+			}
+		} else if (opt == 'm') {
+			dumps = realloc(dumps, (num_dumps + 1) * sizeof(sdram_dump_t));
+			if (!dumps) {
+				fprintf(stderr, "Out of memory.\n");
+				return 1;
+			}
+			sdram_dump_t *dump = &(dumps[num_dumps++]);
+			int filename_start = 0;
+			if (sscanf(optarg, "%u,%u,%zi,%zi,%n", &dump->x, &dump->y
+			          , &dump->offset, &dump->length, &filename_start) != 4
+			    || !filename_start || !optarg[filename_start]) {
+				usage(argv[0]);
+				return 1;
+			}
+			dump->filename = optarg + filename_start;
+		} else if (opt == 'q') {
+			params.quiet = true;
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	
+	emu_machine_initialise(&params, argv[optind]);
+	
+	if (stop_x >= 0 && (stop_y < 0 || stop_p < 0 || !emu_machine_stop_on_core(stop_x, stop_y, stop_p))) {
+		fprintf(stderr, "Core %d,%d,%d does not exist.\n", stop_x, stop_y, stop_p);
+		return 1;
+	}
+	
+	struct timespec wall_start, wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	
+	emu_machine_run(duration);
+	
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	double wall = (wall_end.tv_sec - wall_start.tv_sec)
+	            + ((wall_end.tv_nsec - wall_start.tv_nsec) * 1e-9);
+	
+	emu_stats_t stats;
+	emu_machine_get_stats(&stats);
+	fflush(stdout);
+	fprintf( stderr, "Emulated %ux%u chips with %u cores each for %f s in %f s (%.2fx real time) on %u threads: "
+	                 "%llu events, %llu hops, %llu packets dropped, %llu sends refused, "
+	                 "%u cores still running.\n"
+	       , params.width, params.height, params.cores_per_chip, stats.last_time, wall, stats.last_time / wall
+	       , params.num_threads
+	       , (unsigned long long)stats.num_events
+	       , (unsigned long long)stats.num_hops
+	       , (unsigned long long)stats.num_dropped
+	       , (unsigned long long)stats.num_tx_full
+	       , stats.num_running
+	       );
+	
+	int status = 0;
+	for (uint i = 0; i < num_dumps; i++)
+		if (dump_sdram(&params, &(dumps[i])))
+			status = 1;
+	
+	return status;
+}
@@ -0,0 +1,9 @@
+mkdir -p link_map
+for X in {0..95}; do
+	for Y in {0..59}; do
+		echo "sp $X $Y"
+		echo "sdump link_map/link_map_${X}_${Y}.dat 70000000 1864"
+	done
+done | ybug 10.2.225.1
+
+python unpack_link_map.py 96 60 > link_map.tsv
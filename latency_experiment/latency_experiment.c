@@ -1,12 +1,29 @@
 /**
  * SpiNNaker application which measures roundtrip to every core in the system
  * from (0,0). Dumps the result in SDRAM on (0,0).
+ *
+ * Many probes are kept in flight at once: each is recorded in a table, keyed by
+ * the probe's routing key, along with its send time. Replies are matched
+ * against this table and a new probe is sent for each reply received so the
+ * sweep proceeds as fast as the network allows. Probes which do not return
+ * within PROBE_TIMEOUT are recorded as lost.
+ *
+ * The sweep is repeated SAMPLES_PER_PATH times. The samples for each path are
+ * accumulated in SDRAM and once the final sample is in, are sorted and
+ * summarised (see path_result_t).
+ *
+ * Alternatively, if LOAD_SWEEP is set, every other core generates background
+ * traffic and the experiment steps through a series of traffic rates and
+ * router wait settings, recording the distribution of roundtrip times (to
+ * every core in the system) and the number of lost probes at each step (see
+ * load_step_result_t).
  */
 
 #include <sark.h>
 #include <spin1_api.h>
 
 #include "dor.h"
+#include "traffic_gen.h"
 
 // Height of the (rectangular) system
 #define WIDTH  96
@@ -18,15 +35,114 @@
 // Include a payload
 #define USE_PAYLOAD 1
 
-// Router wait periods
+// Router wait periods (when not performing a load sweep)
 #define WAIT1 0x00
 #define WAIT2 0x00
 
-// Timer for master sending out requests (us)
+// Timer for master checking for lost probes (us)
 #define MASTER_TIMER_TICK 1000
 
+// Maximum number of probes in flight at once
+#define MAX_IN_FLIGHT 64
+
+// Size of the in-flight table (must be a power of two, larger than
+// MAX_IN_FLIGHT to keep probe sequences short).
+#define IN_FLIGHT_TABLE_BITS 8
+#define IN_FLIGHT_TABLE_SIZE (1 << IN_FLIGHT_TABLE_BITS)
+
+// Time after which a probe is considered lost (us)
+#define PROBE_TIMEOUT 5000
+
+// Number of roundtrip samples to take for each path (i.e. the number of times
+// the sweep is repeated).
+#define SAMPLES_PER_PATH 16
+
+// Perform a load sweep rather than sweeping every path
+#ifndef LOAD_SWEEP
+#define LOAD_SWEEP FALSE
+#endif
+
+// Background traffic rates (packets per second generated by each core other
+// than the master) and router wait settings (WAIT1, WAIT2) to step through in
+// a load sweep. Every combination is tried, stepping through the rates for
+// each wait setting in turn.
+const uint LOAD_SWEEP_RATES[] = {0, 1000, 5000, 10000, 20000, 50000};
+const uint LOAD_SWEEP_WAITS[][2] = {{0x00,0x00}, {0x40,0x40}, {0xFF,0xFF}};
+#define NUM_LOAD_SWEEP_RATES (sizeof(LOAD_SWEEP_RATES)/sizeof(LOAD_SWEEP_RATES[0]))
+#define NUM_LOAD_SWEEP_WAITS (sizeof(LOAD_SWEEP_WAITS)/sizeof(LOAD_SWEEP_WAITS[0]))
+#define NUM_LOAD_STEPS (NUM_LOAD_SWEEP_RATES * NUM_LOAD_SWEEP_WAITS)
+
+// Duration of each step of a load sweep (ms). Probes sent within
+// LOAD_STEP_SETTLE ms of the start of a step are discarded to allow the
+// network to settle (and since steps do not begin at exactly the same time on
+// every chip).
+#define LOAD_STEP_DURATION 10000
+#define LOAD_STEP_SETTLE   1000
+
+// Add some noise to the background traffic timer (us)
+#define GEN_TIMER_NOISE_RANGE 10
+
+// Should the background traffic packets have payloads?
+#define GEN_USE_PAYLOAD FALSE
+
+// Pattern of background traffic (one of the TGEN_PATTERN_* options in
+// lib/traffic_gen.h except TGEN_PATTERN_BURST since there is no synchronised
+// timer to trigger bursts).
+#define GEN_PATTERN TGEN_PATTERN_REGULAR
+
+// Roundtrip histogram for each step of the load sweep (in timer ticks). The
+// last bin also counts all longer roundtrips.
+#define LOAD_HIST_BINS      256
+#define LOAD_HIST_BIN_WIDTH 64
+
+// The result of a single step of a load sweep
+typedef struct {
+	// The settings used
+	uint packets_per_sec;
+	uint wait1;
+	uint wait2;
+	
+	// Probes sent (outside the settling period), replies received and probes
+	// lost.
+	uint num_sent;
+	uint num_received;
+	uint num_lost;
+	
+	uint hist[LOAD_HIST_BINS];
+} load_step_result_t;
+
+// Address in SDRAM of the results of each step of a load sweep
+#define LOAD_STEP_RESULT_ADDR(s) (((load_step_result_t*)SDRAM_BASE_BUF) + (s))
+
+// Value of probe_t.step for probes whose results are to be discarded
+#define LOAD_STEP_DISCARD (-1)
+
+// Key marking an empty in-flight table slot (probe keys always have the return
+// bit set so can never take this value).
+#define EMPTY_KEY 0
+
+// The results for a single path (in timer ticks). Roundtrips too long to
+// represent are saturated.
+typedef struct {
+	// Number of replies received and probes lost
+	ushort num_received;
+	ushort num_lost;
+	
+	// Summary of the received samples (valid once num_received + num_lost ==
+	// SAMPLES_PER_PATH and num_received is non-zero).
+	ushort min;
+	ushort median;
+	ushort p99;
+	ushort max;
+	
+	// The received samples (sorted once all samples have been taken)
+	ushort samples[SAMPLES_PER_PATH];
+} path_result_t;
+
+#define MAX_ROUNDTRIP 0xFFFF
+
 // Address in SDRAM to store results
-#define RESULT_ADDR(x,y,p,d) ( ((uint*)SDRAM_BASE_BUF) \
+#define RESULT_ADDR(x,y,p,d) ( ((path_result_t*)SDRAM_BASE_BUF) \
                                + (( (((x) + ((y)*WIDTH)) * CORES_PER_CHIP) \
                                   + (p)-1) * NUM_DIM_ORDERS) \
                                + (d) \
@@ -37,48 +153,220 @@ uint my_x = -1;
 uint my_y = -1;
 uint my_p = -1;
 
-// Last destination sent to (on master)
+// Next destination to send to (on master)
 uint dest_x = 0;
 uint dest_y = 0;
 uint dest_p = 1;
 uint dest_dim_order = 0;
 
-// Got reply flag
-volatile uint got_reply = FALSE;
+// The number of complete sweeps of the system made so far
+uint pass = 0;
+
+// Has a probe been sent to every destination SAMPLES_PER_PATH times (or has
+// the load sweep finished)?
+uint all_sent = FALSE;
+
+// The current step of the load sweep (-1 before the sweep starts) and the time
+// the sweep started (sv->clock_ms).
+int load_step = -1;
+uint load_sweep_start_ms;
+
+// A probe which has been sent and not yet returned or timed out
+typedef struct {
+	uint key;
+	uint x, y, p, d;
+	uint send_time;
+	
+	// The load sweep step the probe was sent in (or LOAD_STEP_DISCARD)
+	int step;
+} probe_t;
+
+// Table of in-flight probes, open-addressed by key with linear probing.
+probe_t in_flight[IN_FLIGHT_TABLE_SIZE];
+uint num_in_flight = 0;
+
+// Number of probes which timed out
+uint num_lost = 0;
 
-// Packet send time
-volatile uint send_time;
-volatile uint recv_time;
 
 // Packet callback on slave
 void
 bounce_mc_packet(uint key, uint _1)
 {
-	spin1_send_mc_packet(XYPD_TO_KEY(0,0,1,KEY_TO_D(key)), 0, USE_PAYLOAD);
-	io_printf(IO_BUF, "Returning bounce from %08x\n", key);
+	// Probes only use the NUM_DIM_ORDERS dimension orders: ignore background
+	// traffic (nearest-neighbour and long-range keys, only generated in a load
+	// sweep) whose return keys would not route back to the master.
+	if (KEY_TO_D(key) >= NUM_DIM_ORDERS)
+		return;
+	
+	// Send the key back to the master (the return version of the key routes back
+	// to the master using the same dimension order).
+	spin1_send_mc_packet(RETURN_KEY(key), key, USE_PAYLOAD);
 }
 
 
-// Packet callback on master
-void
-on_master_mc_packet(uint key, uint remote_key)
+// The in-flight table slot preferred by a given key
+static inline uint
+in_flight_hash(uint key)
 {
-	recv_time = tc2[TC_COUNT];
-	got_reply = 1;
+	return (key * 2654435761u) >> (32 - IN_FLIGHT_TABLE_BITS);
 }
 
 
-// Timer callback on master
-void
-on_tick(uint _1, uint _2)
+// Find the slot holding the given key or the empty slot where it would go
+static uint
+in_flight_find(uint key)
 {
-	// Store results
-	if (got_reply)
-		*(RESULT_ADDR(dest_x,dest_y,dest_p,dest_dim_order)) = -(recv_time-send_time);
+	uint i = in_flight_hash(key);
+	while (in_flight[i].key != EMPTY_KEY && in_flight[i].key != key)
+		i = (i + 1) & (IN_FLIGHT_TABLE_SIZE - 1);
+	return i;
+}
+
+
+// Remove the probe in slot i, moving later probes in the same run back so that
+// no lookup is broken by the gap.
+static void
+in_flight_remove(uint i)
+{
+	uint j = i;
+	while (1) {
+		in_flight[i].key = EMPTY_KEY;
+		
+		uint preferred;
+		do {
+			j = (j + 1) & (IN_FLIGHT_TABLE_SIZE - 1);
+			if (in_flight[j].key == EMPTY_KEY) {
+				num_in_flight--;
+				return;
+			}
+			preferred = in_flight_hash(in_flight[j].key);
+			// Leave the probe at j where it is if its preferred slot lies cyclically
+			// in (i, j].
+		} while ((i <= j) ? ((i < preferred) && (preferred <= j))
+		                  : ((i < preferred) || (preferred <= j)));
+		
+		in_flight[i] = in_flight[j];
+		i = j;
+	}
+}
+
+
+// Sort a (short) array of samples
+static void
+sort_samples(ushort *samples, uint n)
+{
+	for (uint i = 1; i < n; i++) {
+		ushort sample = samples[i];
+		uint j = i;
+		for (; j > 0 && samples[j-1] > sample; j--)
+			samples[j] = samples[j-1];
+		samples[j] = sample;
+	}
+}
+
+
+// Record a sample (or a lost probe) for a path and, if it was the last sample,
+// summarise the path's results.
+static void
+record_sample(path_result_t *result, uint roundtrip, uint lost)
+{
+	if (lost)
+		result->num_lost++;
 	else
-		*(RESULT_ADDR(dest_x,dest_y,dest_p,dest_dim_order)) = 0;
+		result->samples[result->num_received++] = MIN(roundtrip, MAX_ROUNDTRIP);
+	
+	uint n = result->num_received;
+	if (n + result->num_lost < SAMPLES_PER_PATH || n == 0)
+		return;
+	
+	sort_samples(result->samples, n);
+	result->min    = result->samples[0];
+	result->median = result->samples[(n - 1) / 2];
+	result->p99    = result->samples[(((99 * n) + 99) / 100) - 1];
+	result->max    = result->samples[n - 1];
+}
+
+
+// Record a sample (or a lost probe) for a step of the load sweep
+static void
+record_load_sample(int step, uint roundtrip, uint lost)
+{
+	if (step == LOAD_STEP_DISCARD)
+		return;
+	
+	load_step_result_t *result = LOAD_STEP_RESULT_ADDR(step);
+	if (lost)
+		result->num_lost++;
+	else {
+		result->num_received++;
+		result->hist[MIN(roundtrip / LOAD_HIST_BIN_WIDTH, LOAD_HIST_BINS - 1)]++;
+	}
+}
+
+
+// Set the router's wait periods
+static void
+set_router_wait(uint wait1, uint wait2)
+{
+	volatile uint *control_reg = (uint*)(RTR_BASE+RTR_CONTROL);
+	uint control = *control_reg;
+	control &= 0xFFFF;
+	control |= (wait2<<24) | (wait1<<16);
+	*control_reg = control;
+}
+
+
+// Move on to the next step of the load sweep when its time comes, changing the
+// router wait settings and (on traffic generators) traffic rate. Returns TRUE
+// once the sweep is complete.
+static uint
+update_load_step(void)
+{
+	if (load_step < 0)
+		load_sweep_start_ms = sv->clock_ms;
+	
+	uint step = (sv->clock_ms - load_sweep_start_ms) / LOAD_STEP_DURATION;
+	if (step >= NUM_LOAD_STEPS)
+		return TRUE;
+	if ((int)step == load_step)
+		return FALSE;
+	load_step = step;
+	
+	uint packets_per_sec = LOAD_SWEEP_RATES[step % NUM_LOAD_SWEEP_RATES];
+	const uint *wait = LOAD_SWEEP_WAITS[step / NUM_LOAD_SWEEP_RATES];
+	
+	if (leadAp)
+		set_router_wait(wait[0], wait[1]);
+	
+	if (my_x == 0 && my_y == 0 && my_p == 1) {
+		load_step_result_t *result = LOAD_STEP_RESULT_ADDR(step);
+		result->packets_per_sec = packets_per_sec;
+		result->wait1 = wait[0];
+		result->wait2 = wait[1];
+		io_printf(IO_BUF, "Load step %d: %d packets/s, wait %02x %02x (%d lost so far).\n"
+		         , step, packets_per_sec, wait[0], wait[1], num_lost);
+	} else {
+		tgen_set_rate(packets_per_sec);
+	}
 	
-	// Advance through the system
+	return FALSE;
+}
+
+
+// The load sweep step a probe sent now should be recorded against
+static int
+get_measurement_step(void)
+{
+	uint step_time = (sv->clock_ms - load_sweep_start_ms) - (load_step * LOAD_STEP_DURATION);
+	return (load_step >= 0 && step_time >= LOAD_STEP_SETTLE) ? load_step : LOAD_STEP_DISCARD;
+}
+
+
+// Advance to the next destination in the sweep
+static void
+advance_dest(void)
+{
 	if (++dest_dim_order >= NUM_DIM_ORDERS) {
 		dest_dim_order = 0;
 		if (++dest_p > CORES_PER_CHIP) {
@@ -87,22 +375,138 @@ on_tick(uint _1, uint _2)
 				dest_x = 0;
 				if (++dest_y >= HEIGHT) {
 					dest_y = 0;
+					if (++pass >= SAMPLES_PER_PATH && !LOAD_SWEEP)
+						all_sent = TRUE;
 				}
-				io_printf(IO_BUF, "Up to %d %d %d.\n", dest_x, dest_y, dest_p);
+				if (!LOAD_SWEEP)
+					io_printf(IO_BUF, "Pass %d up to %d %d %d (%d lost).\n"
+					         , pass, dest_x, dest_y, dest_p, num_lost);
 			}
 		}
 	}
+}
+
+
+// Send probes until MAX_IN_FLIGHT are in flight or every destination has been
+// probed. Must be called with interrupts disabled.
+static void
+send_probes(void)
+{
+	while (!all_sent && num_in_flight < MAX_IN_FLIGHT) {
+		// Don't send to ourselves (our results remain zero)
+		if (dest_x == my_x && dest_y == my_y && dest_p == my_p) {
+			advance_dest();
+			continue;
+		}
+		
+		uint key = XYPD_TO_KEY(dest_x,dest_y,dest_p-1, dest_dim_order);
+		uint i = in_flight_find(key);
+		probe_t *probe = &(in_flight[i]);
+		probe->key = key;
+		probe->x = dest_x;
+		probe->y = dest_y;
+		probe->p = dest_p;
+		probe->d = dest_dim_order;
+		probe->step = LOAD_SWEEP ? get_measurement_step() : LOAD_STEP_DISCARD;
+		num_in_flight++;
+		
+		// Send an empty packet to the remote to ping back. If the outgoing queue is
+		// full, try again when the next reply arrives.
+		probe->send_time = tc2[TC_COUNT];
+		if (!spin1_send_mc_packet(key, 0, USE_PAYLOAD)) {
+			in_flight_remove(i);
+			break;
+		}
+		if (probe->step != LOAD_STEP_DISCARD)
+			LOAD_STEP_RESULT_ADDR(probe->step)->num_sent++;
+		
+		advance_dest();
+	}
+}
+
+
+// Packet callback on master
+void
+on_master_mc_packet(uint return_key, uint _1)
+{
+	uint recv_time = tc2[TC_COUNT];
+	
+	// The probe's key is the reply's key with the return bit set
+	uint key = RETURN_MASK(return_key);
+	uint i = in_flight_find(key);
+	
+	// Ignore replies to probes which have already timed out
+	if (in_flight[i].key != key)
+		return;
+	
+	probe_t *probe = &(in_flight[i]);
+	if (LOAD_SWEEP)
+		record_load_sample(probe->step, -(recv_time-probe->send_time), FALSE);
+	else
+		record_sample(RESULT_ADDR(probe->x,probe->y,probe->p,probe->d)
+		             , -(recv_time-probe->send_time), FALSE);
+	in_flight_remove(i);
+	
+	send_probes();
+}
+
+
+// Timer callback on master: times out lost probes
+void
+on_tick(uint _1, uint _2)
+{
+	uint cpsr = spin1_irq_disable();
 	
-	// Stop after sending once to everyone
-	if (dest_x == my_x && dest_y == my_y && dest_p == my_p && dest_dim_order == 0) {
+	// Stop sending probes once the load sweep is over
+	if (LOAD_SWEEP && update_load_step())
+		all_sent = TRUE;
+	
+	uint now = tc2[TC_COUNT];
+	uint timeout = PROBE_TIMEOUT * sv->cpu_clk;
+	
+	for (uint i = 0; i < IN_FLIGHT_TABLE_SIZE; i++) {
+		// The counter counts down
+		while ( in_flight[i].key != EMPTY_KEY
+		        && (in_flight[i].send_time - now) > timeout
+		      ) {
+			probe_t *probe = &(in_flight[i]);
+			if (LOAD_SWEEP)
+				record_load_sample(probe->step, 0, TRUE);
+			else
+				record_sample(RESULT_ADDR(probe->x,probe->y,probe->p,probe->d), 0, TRUE);
+			num_lost++;
+			// Removal may move another probe into this slot so check it again
+			in_flight_remove(i);
+		}
+	}
+	
+	send_probes();
+	
+	// Stop once every probe has been sent and returned (or timed out)
+	if (all_sent && num_in_flight == 0) {
+		io_printf(IO_BUF, "Done (%d lost).\n", num_lost);
 		spin1_exit(0);
 	}
 	
-	// Send an empty packet to the remote to ping back
-	uint key = XYPD_TO_KEY(dest_x,dest_y,dest_p, dest_dim_order);
-	got_reply = 0;
-	spin1_send_mc_packet(key, 0, USE_PAYLOAD);
-	send_time = tc2[TC_COUNT];
+	spin1_mode_restore(cpsr);
+}
+
+
+// Timer callback on background traffic generators (load sweep only)
+void
+on_gen_tick(uint _1, uint _2)
+{
+	if (update_load_step()) {
+		// Stop generating traffic but keep answering the master's last probes
+		// for a while before exiting.
+		tgen_set_rate(0);
+		if ( (sv->clock_ms - load_sweep_start_ms)
+		     >= (NUM_LOAD_STEPS * LOAD_STEP_DURATION) + LOAD_STEP_SETTLE
+		   )
+			spin1_exit(0);
+	} else {
+		tgen_on_tick();
+	}
 }
 
 
@@ -117,24 +521,34 @@ c_main() {
 	io_printf(IO_BUF, "Starting latency_experiment as %d %d %d...\n", my_x, my_y, my_p);
 	
 	if (leadAp) {
-		setup_routing_tables();
-		
-		// Set router timeout
-		volatile uint *control_reg = (uint*)(RTR_BASE+RTR_CONTROL);
-		uint control = *control_reg;
-		control &= 0xFFFF;
-		control |= (WAIT2<<24) | (WAIT1<<16);
-		*control_reg = control;
+		setup_routing_tables(my_x, my_y, CORES_PER_CHIP);
+		set_router_wait(WAIT1, WAIT2);
 	}
 	
 	// Set up callbacks
 	if (my_x == 0 && my_y == 0 && my_p == 1) {
+		for (uint i = 0; i < IN_FLIGHT_TABLE_SIZE; i++)
+			in_flight[i].key = EMPTY_KEY;
+		
+		// Results are accumulated so must start from zero
+		if (LOAD_SWEEP)
+			sark_word_set( (void *)SDRAM_BASE_BUF, 0
+			             , NUM_LOAD_STEPS * sizeof(load_step_result_t)
+			             );
+		else
+			sark_word_set( (void *)SDRAM_BASE_BUF, 0
+			             , WIDTH * HEIGHT * CORES_PER_CHIP * NUM_DIM_ORDERS * sizeof(path_result_t)
+			             );
+		
 		spin1_set_timer_tick(MASTER_TIMER_TICK);
-		spin1_callback_on(TIMER_TICK, on_tick, 0);
+		spin1_callback_on(TIMER_TICK, on_tick, 1);
+		
+		// Replies are handled immediately (rather than queued) to keep the
+		// measurement accurate.
 		if (USE_PAYLOAD)
-			spin1_callback_on(MCPL_PACKET_RECEIVED, on_master_mc_packet, 1);
+			spin1_callback_on(MCPL_PACKET_RECEIVED, on_master_mc_packet, 0);
 		else
-			spin1_callback_on(MC_PACKET_RECEIVED, on_master_mc_packet, 1);
+			spin1_callback_on(MC_PACKET_RECEIVED, on_master_mc_packet, 0);
 		
 		// Set up fine-grained timer for latency measurement
 		tc2[TC_CONTROL] = (0 << 0) // Wrapping counter
@@ -144,6 +558,14 @@ c_main() {
 		                | (0 << 6) // Free-running
 		                | (1 << 7) // Enabled
 		                ;
+	} else if (LOAD_SWEEP) {
+		tgen_initialise(my_x, my_y, my_p, GEN_USE_PAYLOAD, GEN_TIMER_NOISE_RANGE);
+		tgen_set_pattern(GEN_PATTERN, WIDTH, HEIGHT);
+		spin1_callback_on(TIMER_TICK, on_gen_tick, 1);
+		
+		// Background traffic arrives as well as probes
+		spin1_callback_on(MCPL_PACKET_RECEIVED, bounce_mc_packet, 1);
+		spin1_callback_on(MC_PACKET_RECEIVED,   bounce_mc_packet, 1);
 	} else {
 		if (USE_PAYLOAD)
 			spin1_callback_on(MCPL_PACKET_RECEIVED, bounce_mc_packet, 1);
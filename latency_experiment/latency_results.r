@@ -97,12 +97,15 @@ count_board_to_board_links <- function( target_x,target_y
 # Latency data dump loader
 ################################################################################
 
-# Read the script's arguments
+# Read the results dump. Each path has a summary of SAMPLES_PER_PATH samples:
+# the number received and lost and the min, median, 99th percentile and max
+# roundtrip. The roundtrip column is the median.
 read.latencyResults <- function ( filename
                                 , width_chips
                                 , height_chips
                                 , cores_per_chip = 16
                                 , num_dim_orders = 6
+                                , samples_per_path = 16
                                 ) {
 	# Get the x/y/p/d columns of the results table
 	results <- expand.grid( d=c(0:(num_dim_orders-1))
@@ -111,18 +114,29 @@ read.latencyResults <- function ( filename
 	                      , y=c(0:(height_chips-1))
 	                      )
 	
-	# Read the roundtrips from the file
+	# Read the path results from the file (one row per path)
+	words_per_path <- 6 + samples_per_path
 	f = file(filename,"rb")
-	results$roundtrip <- readBin( f
-	                            , integer()
-	                            , n=nrow(results)
-	                            , size=4
-	                            , endian="little"
-	                            )
+	raw <- matrix( readBin( f
+	                      , integer()
+	                      , n=nrow(results)*words_per_path
+	                      , size=2
+	                      , signed=FALSE
+	                      , endian="little"
+	                      )
+	             , ncol=words_per_path
+	             , byrow=TRUE
+	             )
 	close(f)
+	results$received <- raw[,1]
+	results$lost     <- raw[,2]
+	results$min      <- raw[,3]
+	results$median   <- raw[,4]
+	results$p99      <- raw[,5]
+	results$max      <- raw[,6]
 	
-	# Remove null results
-	results <- results[results$roundtrip!=0,]
+	# Remove paths with no replies
+	results <- results[results$received!=0,]
 	
 	# Remove the "bounceback" results
 	results <- results[results$x!=0 | results$y!=0 | results$p!=0,]
@@ -135,7 +149,12 @@ read.latencyResults <- function ( filename
 	                          )
 	
 	# Scale to us
-	results$roundtrip <- results$roundtrip * 0.005
+	for (col in c("min", "median", "p99", "max"))
+		results[[col]] <- results[[col]] * 0.005
+	results$roundtrip <- results$median
+	
+	# Jitter measure
+	results$jitter <- results$p99 - results$min
 	
 	return(results)
 }
@@ -0,0 +1,284 @@
+/**
+ * SpiNNaker application which measures the roundtrip over every link in the
+ * system at once. Every chip probes each of its six neighbours in turn and
+ * records the distribution of roundtrips for each link in its own SDRAM.
+ *
+ * Probes and replies are nearest-neighbour packets (see NEAREST_NEIGHBOUR_KEY
+ * in dor.h) so no routes beyond those set up by setup_routing_tables are
+ * needed and every chip can probe simultaneously. A nearest-neighbour packet
+ * reaches all six neighbours: the link being probed is given in the payload
+ * and only the neighbour on that link replies. Replies carry the coordinates
+ * of the chip which sent the probe so that only it accepts them.
+ *
+ * One probe is in flight at a time: probes are sent every PROBE_PERIOD (after
+ * SETTLE_TIME for every chip's routing tables to be set up) and those not
+ * answered by the time the next is due are recorded as lost. Probes are
+ * answered and replies timestamped by FIQ handlers so that callback scheduling
+ * delays do not add to the measured roundtrips.
+ *
+ * Once SAMPLES_PER_LINK probes have been sent over every link the results are
+ * marked complete (see link_map_result_t). The chip then keeps answering its
+ * neighbours' probes for a further LINGER_TIME before exiting since they may
+ * have started slightly later.
+ */
+
+#include <sark.h>
+#include <spin1_api.h>
+
+#include "dor.h"
+
+// Size of the (rectangular) system. Probes over links which wrap around the
+// edges of the system are sent too and are simply lost if those links are
+// not present.
+#define WIDTH  96
+#define HEIGHT 60
+
+// Only core 1 of each chip is used
+#define CORES_PER_CHIP 1
+
+// Router wait periods
+#define WAIT1 0x00
+#define WAIT2 0x00
+
+// Interval between probes (us). Also the time after which a probe is
+// considered lost.
+#define PROBE_PERIOD 100
+
+// Number of probes to send over each link
+#define SAMPLES_PER_LINK 1024
+
+// Time to wait before sending the first probe (us). Until every chip has set
+// up its routing tables, nearest-neighbour packets may be default routed
+// straight through a chip to one further away.
+#define SETTLE_TIME 100000
+
+// Time to keep answering neighbours' probes after finishing (us)
+#define LINGER_TIME 1000000
+
+// Roundtrip histogram for each link (in timer ticks, i.e. CPU clock cycles).
+// The last bin also counts all longer roundtrips.
+#define LINK_HIST_BINS      256
+#define LINK_HIST_BIN_WIDTH 4
+
+// Number of links from each chip (in the order of the route bits in dor.h)
+#define NUM_LINKS 6
+
+// Offsets to the chip at the other end of each link
+const int LINK_DX[NUM_LINKS] = {+1, +1,  0, -1, -1,  0};
+const int LINK_DY[NUM_LINKS] = { 0, +1, +1,  0, -1, -1};
+
+// The key of probes from, and replies to, the chip (x,y) sent by a chip of the
+// given colour. These are nearest-neighbour keys whose (otherwise unused) Y
+// and Z fields hold the coordinates of the probing chip.
+#define LINK_PROBE_KEY(colour, x, y) (XYZPD_TO_KEY((colour), (x), (y), 0, 7))
+#define KEY_TO_PROBER_X(k) KEY_TO_Y(k)
+#define KEY_TO_PROBER_Y(k) KEY_TO_Z(k)
+
+// The payload of probes and replies: a bit marking replies, the link being
+// probed and a sequence number to tell late replies from current ones.
+#define PL_REPLY_BIT (1u<<31)
+#define PL_SEQ_MASK  0x0FFFFFFF
+#define LINK_SEQ_TO_PL(link, seq) ((((link) & 0x7) << 28) | ((seq) & PL_SEQ_MASK))
+#define PL_TO_LINK(pl) (((pl) >> 28) & 0x7)
+#define PL_TO_SEQ(pl)  ((pl) & PL_SEQ_MASK)
+
+// The results for a single link (in timer ticks). min and max are valid once
+// num_received is non-zero.
+typedef struct {
+	// Probes sent and replies received
+	uint num_sent;
+	uint num_received;
+	
+	uint min;
+	uint max;
+	
+	uint hist[LINK_HIST_BINS];
+} link_result_t;
+
+// The results for every link from a chip
+typedef struct {
+	// Set to LINK_MAP_COMPLETE once every probe has been sent (and zero before)
+	uint complete;
+	
+	link_result_t links[NUM_LINKS];
+} link_map_result_t;
+
+#define LINK_MAP_COMPLETE 0xDEADBEEF
+
+// Address in SDRAM to store this chip's results
+#define RESULT_ADDR ((link_map_result_t *)SDRAM_BASE_BUF)
+
+// The position of this chip in the system
+uint my_x = -1;
+uint my_y = -1;
+uint my_p = -1;
+
+// The probe in flight (if any): its sequence number, the link it was sent over
+// and the time it was sent.
+uint probe_in_flight = FALSE;
+uint probe_seq = 0;
+uint probe_link = 0;
+uint probe_send_time;
+
+// Set by the FIQ handler when the reply to the probe in flight arrives, with
+// the time it arrived.
+volatile uint reply_received = FALSE;
+volatile uint reply_time;
+
+// Number of probes sent so far (over all links)
+uint num_probes = 0;
+
+// Number of timer ticks before the first probe and since every probe was sent
+uint settle_ticks = 0;
+uint linger_ticks = 0;
+
+
+// Set the router's wait periods
+static void
+set_router_wait(uint wait1, uint wait2)
+{
+	volatile uint *control_reg = (uint*)(RTR_BASE+RTR_CONTROL);
+	uint control = *control_reg;
+	control &= 0xFFFF;
+	control |= (wait2<<24) | (wait1<<16);
+	*control_reg = control;
+}
+
+
+// Is this chip the neighbour of the chip (x,y) on the given link?
+static uint
+is_neighbour(uint x, uint y, uint link)
+{
+	return ((x + WIDTH  + LINK_DX[link]) % WIDTH)  == my_x
+	    && ((y + HEIGHT + LINK_DY[link]) % HEIGHT) == my_y;
+}
+
+
+// Packet FIQ handler: answer probes over the link to this chip immediately and
+// timestamp replies to this chip's probe on arrival.
+void
+on_mc_packet_fiq(uint key, uint payload)
+{
+	uint now = tc2[TC_COUNT];
+	
+	uint prober_x = KEY_TO_PROBER_X(key);
+	uint prober_y = KEY_TO_PROBER_Y(key);
+	
+	if (payload & PL_REPLY_BIT) {
+		if ( prober_x == my_x && prober_y == my_y
+		     && probe_in_flight && PL_TO_SEQ(payload) == PL_TO_SEQ(probe_seq)
+		   ) {
+			reply_time = now;
+			reply_received = TRUE;
+		}
+	} else if (is_neighbour(prober_x, prober_y, PL_TO_LINK(payload))) {
+		spin1_send_mc_packet( LINK_PROBE_KEY(XY_TO_COLOUR(my_x,my_y), prober_x, prober_y)
+		                    , payload | PL_REPLY_BIT
+		                    , TRUE
+		                    );
+	}
+}
+
+
+// Record the outcome of the probe in flight
+static void
+record_probe(void)
+{
+	link_result_t *result = &(RESULT_ADDR->links[probe_link]);
+	result->num_sent++;
+	if (!reply_received)
+		return;
+	
+	// The counter counts down
+	uint roundtrip = probe_send_time - reply_time;
+	if (result->num_received == 0 || roundtrip < result->min)
+		result->min = roundtrip;
+	if (result->num_received == 0 || roundtrip > result->max)
+		result->max = roundtrip;
+	result->hist[MIN(roundtrip / LINK_HIST_BIN_WIDTH, LINK_HIST_BINS - 1)]++;
+	result->num_received++;
+}
+
+
+// Timer callback: record the last probe's outcome and send the next
+void
+on_tick(uint _1, uint _2)
+{
+	uint cpsr = spin1_fiq_disable();
+	if (probe_in_flight) {
+		record_probe();
+		probe_in_flight = FALSE;
+		reply_received = FALSE;
+	}
+	spin1_mode_restore(cpsr);
+	
+	if (settle_ticks < SETTLE_TIME / PROBE_PERIOD) {
+		settle_ticks++;
+		return;
+	}
+	
+	if (num_probes >= SAMPLES_PER_LINK * NUM_LINKS) {
+		if (linger_ticks++ == 0) {
+			RESULT_ADDR->complete = LINK_MAP_COMPLETE;
+			for (uint link = 0; link < NUM_LINKS; link++)
+				io_printf( IO_BUF, "Link %d: %d of %d received, min %d max %d.\n"
+				         , link
+				         , RESULT_ADDR->links[link].num_received
+				         , RESULT_ADDR->links[link].num_sent
+				         , RESULT_ADDR->links[link].min
+				         , RESULT_ADDR->links[link].max
+				         );
+		}
+		if (linger_ticks >= LINGER_TIME / PROBE_PERIOD)
+			spin1_exit(0);
+		return;
+	}
+	
+	// Probe each link in turn
+	cpsr = spin1_fiq_disable();
+	probe_link = num_probes % NUM_LINKS;
+	probe_seq = LINK_SEQ_TO_PL(probe_link, num_probes);
+	probe_in_flight = TRUE;
+	probe_send_time = tc2[TC_COUNT];
+	spin1_send_mc_packet( LINK_PROBE_KEY(XY_TO_COLOUR(my_x,my_y), my_x, my_y)
+	                    , probe_seq
+	                    , TRUE
+	                    );
+	spin1_mode_restore(cpsr);
+	num_probes++;
+}
+
+
+void
+c_main() {
+	// Discover this core's position in the system
+	uint chip_id = spin1_get_chip_id();
+	my_x = (chip_id >> 8) & 0xFF;
+	my_y = chip_id & 0xFF;
+	my_p = spin1_get_core_id();
+	
+	io_printf(IO_BUF, "Starting link_latency_map as %d %d %d...\n", my_x, my_y, my_p);
+	
+	if (leadAp) {
+		setup_routing_tables(my_x, my_y, CORES_PER_CHIP);
+		set_router_wait(WAIT1, WAIT2);
+	}
+	
+	// Results are accumulated so must start from zero
+	sark_word_set((void *)SDRAM_BASE_BUF, 0, sizeof(link_map_result_t));
+	
+	spin1_set_timer_tick(PROBE_PERIOD);
+	spin1_callback_on(TIMER_TICK, on_tick, 1);
+	spin1_callback_on(MCPL_PACKET_RECEIVED, on_mc_packet_fiq, -1);
+	
+	// Set up fine-grained timer for latency measurement
+	tc2[TC_CONTROL] = (0 << 0) // Wrapping counter
+	                | (1 << 1) // 32-bit counter
+	                | (0 << 2) // Clock divider (/1 = 0, /16 = 1, /256 = 2)
+	                | (0 << 5) // No interrupt
+	                | (0 << 6) // Free-running
+	                | (1 << 7) // Enabled
+	                ;
+	
+	spin1_start(TRUE);
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env python
+
+"""
+Assemble the per-chip memory dumps written by link_latency_map.c (see
+dump_link_map.sh) into a map of every link in the system: a table with columns
+x,y,link,neighbour_x,neighbour_y,sent,received,lost,min,median,p99,max
+with one row per link from each chip (links are numbered in the order of the
+route bits in dor.h). Roundtrips are in ticks (CPU clock cycles). The median
+and 99th percentile are estimated from the link's histogram (the lower edge of
+the bin containing the given quantile). Links with no replies (e.g. those
+which wrap around the edges of a system without wrap-around links) have empty
+roundtrip columns. Chips whose results are missing or incomplete are skipped.
+
+Usage:
+	python unpack_link_map.py width height [hist_bins] [bin_width] > link_map.tsv
+"""
+
+import math
+import sys
+import struct
+
+width     = int(sys.argv[1])
+height    = int(sys.argv[2])
+hist_bins = int(sys.argv[3]) if len(sys.argv) > 3 else 256
+bin_width = int(sys.argv[4]) if len(sys.argv) > 4 else 4
+
+# Must match link_latency_map.c
+LINK_MAP_COMPLETE = 0xDEADBEEF
+LINK_DX = [+1, +1,  0, -1, -1,  0]
+LINK_DY = [ 0, +1, +1,  0, -1, -1]
+
+# Layout of a link_map_result_t: complete followed by a link_result_t (sent,
+# received, min, max, histogram) per link
+complete_word = struct.Struct("<L")
+link_result = struct.Struct("<4L%dL"%hist_bins)
+
+
+# Get the roundtrip at the given quantile of a histogram
+def hist_quantile(hist, num_samples, q):
+	target = max(1, int(math.ceil(q*num_samples)))
+	seen = 0
+	for i, count in enumerate(hist):
+		seen += count
+		if seen >= target:
+			return i * bin_width
+	return None
+
+
+print("x\ty\tlink\tneighbour_x\tneighbour_y\tsent\treceived\tlost\tmin\tmedian\tp99\tmax")
+
+for y in range(height):
+	for x in range(width):
+		try:
+			f = open("link_map/link_map_%d_%d.dat"%(x,y), "rb")
+		except IOError:
+			continue
+		
+		with f:
+			data = f.read(complete_word.size)
+			if len(data) < complete_word.size or \
+			   complete_word.unpack(data)[0] != LINK_MAP_COMPLETE:
+				continue
+			
+			for link in range(len(LINK_DX)):
+				data = f.read(link_result.size)
+				if len(data) < link_result.size:
+					break
+				
+				fields = link_result.unpack(data)
+				sent, received, min_rt, max_rt = fields[:4]
+				hist = fields[4:]
+				
+				neighbour_x = (x + LINK_DX[link]) % width
+				neighbour_y = (y + LINK_DY[link]) % height
+				
+				if received:
+					roundtrips = "%d\t%d\t%d\t%d"%(
+						min_rt,
+						hist_quantile(hist, received, 0.5),
+						hist_quantile(hist, received, 0.99),
+						max_rt)
+				else:
+					roundtrips = "\t\t\t"
+				
+				print("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%s"%(
+					x, y, link, neighbour_x, neighbour_y,
+					sent, received, sent - received, roundtrips))
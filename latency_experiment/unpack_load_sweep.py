@@ -0,0 +1,58 @@
+#!/usr/bin/env python
+
+"""
+Convert a memory dump of load sweep results (latency_experiment.c with
+LOAD_SWEEP set) into a table with columns
+packets_per_sec,wait1,wait2,sent,received,lost,drop_rate,min,median,p99,max
+with one row per step. Roundtrips are in ticks and are estimated from the
+step's histogram (the lower edge of the bin containing the given quantile).
+
+Usage:
+	python unpack_load_sweep.py result_file num_steps [hist_bins] [bin_width]
+"""
+
+import math
+import sys
+import struct
+
+result_file = sys.argv[1]
+num_steps   = int(sys.argv[2])
+hist_bins   = int(sys.argv[3]) if len(sys.argv) > 3 else 256
+bin_width   = int(sys.argv[4]) if len(sys.argv) > 4 else 64
+
+# Layout of a load_step_result_t
+step_result = struct.Struct("<6L%dL"%hist_bins)
+
+
+# Get the roundtrip at the given quantile of a histogram
+def hist_quantile(hist, num_samples, q):
+	target = max(1, int(math.ceil(q*num_samples)))
+	seen = 0
+	for i, count in enumerate(hist):
+		seen += count
+		if seen >= target:
+			return i * bin_width
+	return None
+
+
+print("packets_per_sec\twait1\twait2\tsent\treceived\tlost\tdrop_rate\tmin\tmedian\tp99\tmax")
+
+with open(result_file, "rb") as f:
+	for step in range(num_steps):
+		data = f.read(step_result.size)
+		if len(data) < step_result.size:
+			break
+		
+		fields = step_result.unpack(data)
+		packets_per_sec, wait1, wait2, sent, received, lost = fields[:6]
+		hist = fields[6:]
+		
+		drop_rate = float(lost) / (received + lost) if received + lost else 0.0
+		if received:
+			quantiles = "\t".join(str(hist_quantile(hist, received, q))
+			                      for q in (0.0, 0.5, 0.99, 1.0))
+		else:
+			quantiles = "\t\t\t"
+		
+		print("%d\t%d\t%d\t%d\t%d\t%d\t%f\t%s"%(
+			packets_per_sec, wait1, wait2, sent, received, lost, drop_rate, quantiles))
@@ -2,45 +2,41 @@
 
 """
 Convert a memory dump from SpiNNaker into a table with columns
-x,y,p,dimension_order,roundtrip
-(ticks).
+x,y,p,dimension_order,received,lost,min,median,p99,max
+(roundtrips in ticks). Paths with no replies have empty roundtrip columns.
+
+Usage:
+	python unpack_results.py result_file width height cores_per_chip [samples_per_path]
 """
 
 import sys
 import struct
 
-result_file    = sys.argv[1]
-width          = int(sys.argv[2])
-height         = int(sys.argv[3])
-cores_per_chip = int(sys.argv[4])
-num_dim_orders = 6
+result_file      = sys.argv[1]
+width            = int(sys.argv[2])
+height           = int(sys.argv[3])
+cores_per_chip   = int(sys.argv[4])
+samples_per_path = int(sys.argv[5]) if len(sys.argv) > 5 else 16
+num_dim_orders   = 6
+
+# Layout of a path_result_t: received, lost, min, median, p99, max, samples...
+path_result = struct.Struct("<%dH"%(6 + samples_per_path))
 
-print("x\ty\tp\td\troundtrip")
+print("x\ty\tp\td\treceived\tlost\tmin\tmedian\tp99\tmax")
 
 with open(result_file, "rb") as f:
-	x = 0
-	y = 0
-	p = 0
-	d = 0
-	roundtrips = []
-	while True:
-		data = f.read(4)
-		if not data:
-			break
-		
-		roundtrip = struct.unpack("<L", data)[0]
-		print("%d\t%d\t%d\t%d\t%d"%(x,y,p,d,roundtrip))
-		
-		d += 1
-		if d >= num_dim_orders:
-			d = 0
-			p += 1
-			if p >= cores_per_chip:
-				p = 0
-				roundtrips = []
-				x += 1
-				if x >= width:
-					x = 0
-					y += 1
-					if y >= height:
-						y = 0
+	for y in range(height):
+		for x in range(width):
+			for p in range(cores_per_chip):
+				for d in range(num_dim_orders):
+					data = f.read(path_result.size)
+					if len(data) < path_result.size:
+						sys.exit(0)
+					
+					fields = path_result.unpack(data)
+					received, lost, min_rt, median, p99, max_rt = fields[:6]
+					if received:
+						print("%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d"%(
+							x,y,p,d, received,lost, min_rt,median,p99,max_rt))
+					else:
+						print("%d\t%d\t%d\t%d\t%d\t%d\t\t\t\t"%(x,y,p,d, received,lost))
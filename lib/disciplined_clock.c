@@ -8,32 +8,163 @@
 #define MAX(a,b) (((a)<(b)) ? (b) : (a))
 #endif
 
+#ifndef ABS
+#define ABS(a) (((a)<0) ? -(a) : (a))
+#endif
+
+// Corrections are clamped to this magnitude before being used in the lock
+// quality estimates to keep the variance calculation in range.
+#define DCLK_LOCK_MAX_SAMPLE ((1<<15) - 1)
+
+
+/**
+ * Reset the lock quality estimates, e.g. after the clock has been stepped.
+ */
+static void
+dclk_reset_lock_quality(volatile dclk_state_t *state)
+{
+	state->phase_error_mean = 0;
+	state->phase_error_variance = 0;
+	state->freq_stability = 0;
+	state->error_bound = 0;
+	state->num_corrections = 0;
+	state->locked = 0;
+	state->lock_count = 0;
+	state->relocking = 0;
+}
+
+
+/**
+ * Integer square root (rounded down).
+ */
+static uint32_t
+dclk_isqrt(uint64_t n)
+{
+	uint64_t root = 0;
+	uint64_t bit = 1ull << 62;
+	
+	while (bit > n)
+		bit >>= 2;
+	
+	while (bit) {
+		if (n >= root + bit) {
+			n -= root + bit;
+			root = (root >> 1) + bit;
+		} else {
+			root >>= 1;
+		}
+		bit >>= 2;
+	}
+	
+	return (uint32_t)root;
+}
+
+
+/**
+ * Update the lock quality estimates and lock state given a new correction and
+ * the resulting adjustment to the correction frequency.
+ */
+static void
+dclk_update_lock_quality( volatile dclk_state_t *state
+                        , dclk_offset_t correction
+                        , dclk_fp_freq_t correction_freq_adjustment
+                        )
+{
+	// Corrections received while the weights are still being ramped down are
+	// dominated by the initial frequency error and say little about the lock
+	// which will eventually be achieved.
+	if ( state->freq_correction_weight > DCLK_FREQ_CORRECTION_WEIGHT_TARGET
+	     || state->phase_correction_weight > DCLK_PHASE_CORRECTION_WEIGHT_TARGET
+	   )
+		return;
+	
+	correction = MAX(MIN(correction, DCLK_LOCK_MAX_SAMPLE), -DCLK_LOCK_MAX_SAMPLE);
+	dclk_dfp_phase_t sample = ((dclk_dfp_phase_t)correction) << DCLK_FP_PHASE_FBITS;
+	correction_freq_adjustment = ABS(correction_freq_adjustment);
+	
+	// Move each estimate a fraction of the way towards the new sample. Until
+	// enough samples have arrived the estimates are simple averages of the
+	// samples so far so that the first sample does not dominate.
+	state->num_corrections++;
+	uint32_t weight = MIN(state->num_corrections, 1u << DCLK_LOCK_FILTER_SHIFT);
+	
+	dclk_dfp_phase_t deviation = sample - state->phase_error_mean;
+	state->phase_error_mean += deviation / weight;
+	state->phase_error_variance += ( ((deviation * deviation) >> DCLK_FP_PHASE_FBITS)
+	                               - state->phase_error_variance
+	                               ) / weight;
+	state->freq_stability += ( correction_freq_adjustment
+	                         - state->freq_stability
+	                         ) / (dclk_fp_freq_t)weight;
+	
+	// The square root of a 16.16 variance is an 8.8 standard deviation
+	dclk_time_t sd = dclk_isqrt(state->phase_error_variance) >> (DCLK_FP_PHASE_FBITS / 2);
+	state->error_bound = (dclk_time_t)(ABS(state->phase_error_mean) >> DCLK_FP_PHASE_FBITS)
+	                   + (DCLK_ERROR_BOUND_SDS * sd);
+	
+	// Lock state machine with hysteresis
+	if (state->locked) {
+		if (state->error_bound > DCLK_LOCK_EXIT_BOUND) {
+			state->locked = 0;
+			state->lock_count = 0;
+		}
+	} else {
+		dclk_time_t enter_bound = state->relocking ? DCLK_LOCK_EXIT_BOUND
+		                                           : DCLK_LOCK_ENTER_BOUND;
+		if (state->error_bound <= enter_bound) {
+			state->lock_count++;
+		} else {
+			state->lock_count = 0;
+			state->relocking = 0;
+		}
+		
+		if (state->lock_count >= DCLK_LOCK_HOLDOFF) {
+			state->locked = 1;
+			state->relocking = 0;
+		}
+	}
+}
+
 
 void
 dclk_initialise_state(volatile dclk_state_t *state)
 {
 	state->last_update_time = dclk_read_raw_time();
 	state->last_corrected_time = dclk_read_raw_time();
+	state->last_fp_time = ((dclk_fp_time_t)state->last_corrected_time) << DCLK_FP_TIME_FBITS;
 	state->offset = 0;
 	state->correction_freq = 0;
 	state->correction_phase_accumulator = 0;
 	state->freq_correction_weight = DCLK_FREQ_CORRECTION_WEIGHT_START;
 	state->phase_correction_weight = DCLK_PHASE_CORRECTION_WEIGHT_START;
+	state->generation = 0;
+	dclk_reset_lock_quality(state);
+#if DCLK_FREQ_WINDOW
+	state->freq_window_count = 0;
+	state->freq_window_next = 0;
+#endif
 }
 
 
-dclk_time_t
-dclk_get_time(volatile dclk_state_t *state)
+/**
+ * Update the corrected time for the current raw time, incorporating as much of
+ * the accumulated phase correction as monotonicity allows. Returns the
+ * corrected time and sets *freq_fraction to the fraction of a tick (with
+ * DCLK_FP_TIME_FBITS fractional bits) truncated from the frequency correction.
+ */
+static inline dclk_time_t
+dclk_update_time(volatile dclk_state_t *state, uint32_t *freq_fraction)
 {
 	dclk_time_t raw_time = dclk_read_raw_time();
 	
 	// Work out the correction for frequency since the last frequency correction
 	dclk_time_t delta_raw_ticks = raw_time - state->last_update_time;
-	dclk_offset_t freq_correction = (dclk_offset_t)( ( ((dclk_dfp_freq_t)delta_raw_ticks)
-	                                                 * ((dclk_dfp_freq_t)state->correction_freq)
-	                                                 )
-	                                               >> DCLK_FP_FREQ_FBITS
-	                                               );
+	dclk_dfp_freq_t fp_freq_correction = ((dclk_dfp_freq_t)delta_raw_ticks)
+	                                   * ((dclk_dfp_freq_t)state->correction_freq);
+	dclk_offset_t freq_correction = (dclk_offset_t)(fp_freq_correction >> DCLK_FP_FREQ_FBITS);
+	*freq_fraction = (uint32_t)( (fp_freq_correction & ((1ll<<DCLK_FP_FREQ_FBITS)-1))
+	                           << (DCLK_FP_TIME_FBITS-DCLK_FP_FREQ_FBITS)
+	                           );
 	
 	// Apply any accumulated phase error while ensuring time monotonicity.
 	if (state->correction_phase_accumulator > 0) {
@@ -62,6 +193,97 @@ dclk_get_time(volatile dclk_state_t *state)
 }
 
 
+dclk_time_t
+dclk_get_time(volatile dclk_state_t *state)
+{
+	uint32_t freq_fraction;
+	return dclk_update_time(state, &freq_fraction);
+}
+
+
+dclk_fp_time_t
+dclk_get_time_fp(volatile dclk_state_t *state)
+{
+	uint32_t freq_fraction;
+	dclk_time_t time = dclk_update_time(state, &freq_fraction);
+	dclk_fp_time_t fp_time = (((dclk_fp_time_t)time) << DCLK_FP_TIME_FBITS) + freq_fraction;
+	
+	// Any positive phase correction left in the accumulator is less than a tick
+	// and would be applied at the next whole tick: include it now.
+	if (state->correction_phase_accumulator > 0)
+		fp_time += ((dclk_fp_time_t)state->correction_phase_accumulator)
+		           << (DCLK_FP_TIME_FBITS-DCLK_FP_PHASE_FBITS);
+	
+	// The fractional parts may go backwards while negative phase corrections
+	// hold the corrected time still (or when a correction empties the
+	// accumulator) so never return a value before the last.
+	if ((int64_t)(fp_time - state->last_fp_time) < 0)
+		fp_time = state->last_fp_time;
+	state->last_fp_time = fp_time;
+	return fp_time;
+}
+
+
+/**
+ * The corrected time at the given raw time once all accumulated phase
+ * correction has been incorporated. Sets *freq_fraction to the fraction of a
+ * tick truncated (as in dclk_update_time).
+ */
+static inline dclk_time_t
+dclk_corrected_time_at( const volatile dclk_state_t *state
+                      , dclk_time_t raw_time
+                      , uint32_t *freq_fraction
+                      )
+{
+	dclk_time_t delta_raw_ticks = raw_time - state->last_update_time;
+	dclk_dfp_freq_t fp_freq_correction = ((dclk_dfp_freq_t)delta_raw_ticks)
+	                                   * ((dclk_dfp_freq_t)state->correction_freq);
+	dclk_offset_t freq_correction = (dclk_offset_t)(fp_freq_correction >> DCLK_FP_FREQ_FBITS);
+	*freq_fraction = (uint32_t)( (fp_freq_correction & ((1ll<<DCLK_FP_FREQ_FBITS)-1))
+	                           << (DCLK_FP_TIME_FBITS-DCLK_FP_FREQ_FBITS)
+	                           );
+	
+	// Phase corrections are incorporated by dclk_get_time a whole tick at a time
+	dclk_offset_t phase_correction = state->correction_phase_accumulator
+	                                 / (1 << DCLK_FP_PHASE_FBITS);
+	
+	return raw_time + state->offset + freq_correction + phase_correction;
+}
+
+
+dclk_time_t
+dclk_peek_time(const volatile dclk_state_t *state)
+{
+	uint32_t freq_fraction;
+	return dclk_corrected_time_at(state, dclk_read_raw_time(), &freq_fraction);
+}
+
+
+dclk_time_t
+dclk_get_raw_time_at(const volatile dclk_state_t *state, dclk_time_t time)
+{
+	// Work from the present (rather than the last update) to keep the
+	// difference within the range of dclk_offset_t.
+	uint32_t freq_fraction;
+	dclk_time_t raw_time = dclk_read_raw_time();
+	dclk_offset_t delta_ticks = time - dclk_corrected_time_at(state, raw_time, &freq_fraction);
+	
+	// The number of raw ticks (in fixed point) until the untruncated corrected
+	// time reaches the given time: the frequency correction over delta raw ticks
+	// is (to first order) that over delta corrected ticks. Round up to the first
+	// raw tick at which the time has been reached.
+	dclk_dfp_freq_t fp_raw_ticks = ( ((dclk_dfp_freq_t)delta_ticks) << DCLK_FP_FREQ_FBITS )
+	                             - (freq_fraction >> (DCLK_FP_TIME_FBITS-DCLK_FP_FREQ_FBITS))
+	                             - ( ((dclk_dfp_freq_t)delta_ticks)
+	                               * ((dclk_dfp_freq_t)state->correction_freq)
+	                               );
+	
+	return raw_time + (dclk_offset_t)( (fp_raw_ticks + (1ll<<DCLK_FP_FREQ_FBITS) - 1)
+	                                   >> DCLK_FP_FREQ_FBITS
+	                                 );
+}
+
+
 dclk_time_t
 dclk_get_ticks_until_time(volatile dclk_state_t *state, dclk_time_t target_time)
 {
@@ -77,7 +299,8 @@ dclk_get_ticks_until_time(volatile dclk_state_t *state, dclk_time_t target_time)
 	// Given that the clock is really running at a different frequency, find out
 	// how many ticks will be added/removed due to frequency corrections (assuming
 	// the frequency correction rate remains constant over the period) and update
-	// our estimate.
+	// our estimate: the raw clock need not count the ticks which the corrections
+	// will add.
 	//
 	// TODO: Could take advantage of knowing *when* frequency corrections are
 	// actually due to be applied (assuming freq doesn't change).
@@ -86,7 +309,7 @@ dclk_get_ticks_until_time(volatile dclk_state_t *state, dclk_time_t target_time)
 	                                                 )
 	                                               >> DCLK_FP_FREQ_FBITS
 	                                               );
-	delta_ticks += freq_correction;
+	delta_ticks -= freq_correction;
 	
 	// How much phase error correction is (currently) due to be applied? Assume
 	// the phase error won't change and simply apply as much as possible in the
@@ -96,8 +319,8 @@ dclk_get_ticks_until_time(volatile dclk_state_t *state, dclk_time_t target_time)
 		// Positive, integral phase errors can be incorporated immediately without
 		// any impact on monotonicity. (Note that code should never be called since
 		// calling dclk_get_time will have already incorporated this.)
-		phase_correction = state->correction_phase_accumulator
-		                   >> DCLK_FP_PHASE_FBITS;
+		phase_correction = -(state->correction_phase_accumulator
+		                     >> DCLK_FP_PHASE_FBITS);
 	} else if (state->correction_phase_accumulator < 0) {
 		// Negative, integral phase errors can be incorporated only at the rate at
 		// which corrected time is expected to elapse (thus the phase correction can
@@ -124,13 +347,123 @@ dclk_correct_phase_now(volatile dclk_state_t *state, dclk_offset_t correction)
 	// since correction_phase_accumulator is zero, will only account for the
 	// current frequency correction meaning future calls will be monotonic.
 	dclk_get_time(state);
+	state->last_fp_time = ((dclk_fp_time_t)state->last_corrected_time) << DCLK_FP_TIME_FBITS;
 	
 	// Mark now as the last update time such that the frequency estimate in the
 	// next true update is usable.
 	state->last_update_time = dclk_read_raw_time();
+	
+	// Errors observed before the step say nothing about the lock afterwards
+	dclk_reset_lock_quality(state);
+#if DCLK_FREQ_WINDOW
+	state->freq_window_count = 0;
+#endif
+	
+	state->generation++;
 }
 
 
+#if DCLK_FREQ_WINDOW
+/**
+ * The slope (with DCLK_FP_FREQ_FBITS fractional bits) of the least squares line
+ * through num corrections in the frequency window, starting with the first'th
+ * oldest. raw_time and raw_offset are those of the newest correction. Returns
+ * zero if the corrections' times are too close together for a slope.
+ */
+static uint32_t
+dclk_fit_slope( volatile dclk_state_t *state
+              , dclk_time_t raw_time
+              , dclk_offset_t raw_offset
+              , uint32_t first
+              , uint32_t num
+              , dclk_fp_freq_t *slope
+              )
+{
+	// Regress the offsets against the age of each correction (in units of
+	// 2^DCLK_FREQ_WINDOW_TIME_SHIFT ticks), both relative to the newest
+	// correction to keep the sums small.
+	dclk_dfp_freq_t sum_age = 0;
+	dclk_dfp_freq_t sum_age_sq = 0;
+	dclk_dfp_freq_t sum_offset = 0;
+	dclk_dfp_freq_t sum_age_offset = 0;
+	for (uint32_t n = 0; n < num; n++) {
+		uint32_t i = (state->freq_window_next + first + n) % DCLK_FREQ_WINDOW;
+		dclk_dfp_freq_t age = (dclk_dfp_freq_t)( (raw_time - state->freq_window_time[i])
+		                                       >> DCLK_FREQ_WINDOW_TIME_SHIFT
+		                                       );
+		dclk_dfp_freq_t offset = (dclk_offset_t)(state->freq_window_offset[i] - raw_offset);
+		sum_age += age;
+		sum_age_sq += age * age;
+		sum_offset += offset;
+		sum_age_offset += age * offset;
+	}
+	
+	// The slope is numerator/denominator offset ticks per age unit. Its sign is
+	// inverted since age runs backwards in time.
+	dclk_dfp_freq_t numerator = (sum_age * sum_offset) - (num * sum_age_offset);
+	dclk_dfp_freq_t denominator = (num * sum_age_sq) - (sum_age * sum_age);
+	
+	// Scale the numerator up as far as possible (and the denominator down for
+	// the remainder) to give a quotient with DCLK_FP_FREQ_FBITS fractional bits
+	// per tick without overflow.
+	int32_t shift = DCLK_FP_FREQ_FBITS - DCLK_FREQ_WINDOW_TIME_SHIFT;
+	while (shift > 0 && ABS(numerator) < (1ll << 61)) {
+		numerator <<= 1;
+		shift--;
+	}
+	denominator >>= shift;
+	if (denominator <= 0)
+		return 0;
+	
+	*slope = (dclk_fp_freq_t)(numerator / denominator);
+	return 1;
+}
+
+
+/**
+ * Record the offset of the raw clock from the reference measured by a
+ * correction at the given raw time and, once DCLK_FREQ_WINDOW corrections have
+ * been recorded, estimate the current correction frequency from the slope of
+ * the least squares line through them. Returns zero (leaving *correction_freq
+ * untouched) until then.
+ */
+static uint32_t
+dclk_fit_freq( volatile dclk_state_t *state
+             , dclk_time_t raw_time
+             , dclk_offset_t raw_offset
+             , dclk_fp_freq_t *correction_freq
+             )
+{
+	state->freq_window_time[state->freq_window_next] = raw_time;
+	state->freq_window_offset[state->freq_window_next] = raw_offset;
+	state->freq_window_next = (state->freq_window_next + 1) % DCLK_FREQ_WINDOW;
+	if (state->freq_window_count < DCLK_FREQ_WINDOW)
+		state->freq_window_count++;
+	if (state->freq_window_count < DCLK_FREQ_WINDOW)
+		return 0;
+	
+#if DCLK_FREQ_WINDOW_DRIFT
+	// The slope of a line fitted to a window lags the frequency by half the
+	// window. Extrapolate from the slopes over each half of the window (which
+	// lag by a quarter and three quarters of it).
+	dclk_fp_freq_t older_slope;
+	dclk_fp_freq_t newer_slope;
+	if ( !dclk_fit_slope( state, raw_time, raw_offset
+	                    , 0, DCLK_FREQ_WINDOW / 2, &older_slope)
+	     || !dclk_fit_slope( state, raw_time, raw_offset
+	                       , DCLK_FREQ_WINDOW / 2, DCLK_FREQ_WINDOW / 2, &newer_slope)
+	   )
+		return 0;
+	*correction_freq = newer_slope + ((newer_slope - older_slope) / 2);
+	return 1;
+#else
+	return dclk_fit_slope( state, raw_time, raw_offset
+	                     , 0, DCLK_FREQ_WINDOW, correction_freq);
+#endif
+}
+#endif
+
+
 void
 dclk_add_correction(volatile dclk_state_t *state, dclk_offset_t correction)
 {
@@ -167,6 +500,22 @@ dclk_add_correction(volatile dclk_state_t *state, dclk_offset_t correction)
 	                                              )
 	                                            / ((dclk_dfp_freq_t)time_since_last_poll)
 	                                            );
+	
+#if DCLK_FREQ_WINDOW
+	// A single poll interval's estimate is dominated by jitter: once enough
+	// corrections have been seen, use the frequency measured over all of them
+	// instead. The offset of the raw clock from the reference is the correction
+	// plus the corrected time's offset when it was measured (including the
+	// frequency correction up to now and any phase correction not yet
+	// incorporated, as in dclk_peek_time) and so is independent of the
+	// corrections this clock has made.
+	dclk_offset_t raw_offset = state->offset
+	                         + (state->correction_phase_accumulator / (1 << DCLK_FP_PHASE_FBITS))
+	                         + correction;
+	dclk_fp_freq_t fitted_correction_freq;
+	if (dclk_fit_freq(state, raw_time, raw_offset, &fitted_correction_freq))
+		correction_freq_adjustment = fitted_correction_freq - state->correction_freq;
+#endif
 	state->correction_freq += correction_freq_adjustment;
 	
 	// Accumulate phase corrections of a fraction of the correction. By only
@@ -175,6 +524,8 @@ dclk_add_correction(volatile dclk_state_t *state, dclk_offset_t correction)
 	// converted into fixed point by multiplication with a fixed point number.
 	state->correction_phase_accumulator += correction * state->phase_correction_weight;
 	
+	dclk_update_lock_quality(state, correction, correction_freq_adjustment);
+	
 	// Move frequency/phase correction weights down from their starting values
 	// towards their target values each time a correction is added. This allows
 	// early corrections to be applied more harshly ensuring a quick initial lock.
@@ -189,4 +540,99 @@ dclk_add_correction(volatile dclk_state_t *state, dclk_offset_t correction)
 	state->phase_correction_weight = MAX( state->phase_correction_weight
 	                                    , DCLK_PHASE_CORRECTION_WEIGHT_TARGET
 	                                    );
+	
+	state->generation++;
+}
+
+
+uint32_t
+dclk_is_locked(volatile dclk_state_t *state)
+{
+	return state->locked;
+}
+
+
+void
+dclk_get_lock_quality(volatile dclk_state_t *state, dclk_lock_quality_t *quality)
+{
+	quality->locked               = state->locked;
+	quality->num_corrections      = state->num_corrections;
+	quality->phase_error_mean     = (dclk_fp_phase_t)state->phase_error_mean;
+	quality->phase_error_variance = state->phase_error_variance;
+	quality->freq_stability       = state->freq_stability;
+	quality->error_bound          = state->error_bound;
+}
+
+
+/**
+ * Checksum of a saved state (excluding the checksum itself).
+ */
+static uint32_t
+dclk_saved_state_checksum(const volatile dclk_saved_state_t *saved)
+{
+	const volatile uint32_t *words = (const volatile uint32_t *)saved;
+	uint32_t num_words = (sizeof(dclk_saved_state_t) / sizeof(uint32_t)) - 1;
+	
+	uint32_t sum = 0;
+	for (uint32_t i = 0; i < num_words; i++)
+		sum = ((sum << 5) | (sum >> 27)) ^ words[i];
+	return ~sum;
+}
+
+
+void
+dclk_save_state(volatile dclk_state_t *state, volatile dclk_saved_state_t *saved, uint32_t stamp)
+{
+	saved->magic                = DCLK_SAVED_STATE_MAGIC;
+	saved->stamp                = stamp;
+	saved->correction_freq      = state->correction_freq;
+	saved->phase_error_variance = state->phase_error_variance;
+	saved->freq_stability       = state->freq_stability;
+	saved->num_corrections      = state->num_corrections;
+	saved->locked               = state->locked;
+	saved->checksum             = dclk_saved_state_checksum(saved);
+}
+
+
+uint32_t
+dclk_restore_state( volatile dclk_state_t *state
+                  , const volatile dclk_saved_state_t *saved
+                  , uint32_t stamp
+                  , uint32_t max_age
+                  )
+{
+	// A stamp from before the stamp's source restarted appears to be in the
+	// future and so (modulo wrapping) very old.
+	if ( saved->magic != DCLK_SAVED_STATE_MAGIC
+	     || saved->checksum != dclk_saved_state_checksum(saved)
+	     || (uint32_t)(stamp - saved->stamp) > max_age
+	   )
+		return 0;
+	
+	state->correction_freq = saved->correction_freq;
+	state->freq_correction_weight = DCLK_FREQ_CORRECTION_WEIGHT_TARGET;
+	state->phase_correction_weight = DCLK_PHASE_CORRECTION_WEIGHT_TARGET;
+	
+	// The phase error is unknown until the next correction but its spread and
+	// the frequency's stability should be as before.
+	state->phase_error_mean = 0;
+	state->phase_error_variance = saved->phase_error_variance;
+	state->freq_stability = saved->freq_stability;
+	state->num_corrections = saved->num_corrections;
+	state->locked = 0;
+	state->lock_count = saved->locked ? (DCLK_LOCK_HOLDOFF - DCLK_LOCK_HOLDOFF_RESTORED) : 0;
+	state->relocking = saved->locked;
+	state->generation++;
+	
+	return 1;
+}
+
+
+void
+dclk_seed_frequency(volatile dclk_state_t *state, dclk_fp_freq_t correction_freq)
+{
+	state->correction_freq = correction_freq;
+	state->freq_correction_weight = DCLK_FREQ_CORRECTION_WEIGHT_TARGET;
+	state->phase_correction_weight = DCLK_PHASE_CORRECTION_WEIGHT_TARGET;
+	state->generation++;
 }
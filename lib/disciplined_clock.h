@@ -8,6 +8,14 @@
 #include <stdint.h>
 
 
+// The number of corrections over which the correction frequency is estimated
+// (see "Discipline Parameters" below). Defined here since the corrections are
+// kept in dclk_state_t.
+#ifndef DCLK_FREQ_WINDOW
+#define DCLK_FREQ_WINDOW 8
+#endif
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Type and function prototype definitions
 ////////////////////////////////////////////////////////////////////////////////
@@ -27,6 +35,10 @@ typedef  int32_t dclk_fp_phase_t;
 typedef  int64_t dclk_dfp_freq_t;
 typedef  int64_t dclk_dfp_phase_t;
 
+// Fixed point time (in timer ticks) with DCLK_FP_TIME_FBITS fractional bits.
+// Wraps with the same period as dclk_time_t.
+typedef uint64_t dclk_fp_time_t;
+
 /**
  * A structure which stores all persistent clock state. Not intended for public
  * access.
@@ -39,6 +51,9 @@ typedef struct {
 	// ensure monotonic time when incorporating phase corrections.
 	dclk_time_t last_corrected_time;
 	
+	// The last value returned by dclk_get_time_fp (used to keep it monotonic).
+	dclk_fp_time_t last_fp_time;
+	
 	// The current time offset from the raw clock source (correct at the time of
 	// last reading).
 	dclk_offset_t offset;
@@ -57,15 +72,113 @@ typedef struct {
 	// respectively.
 	dclk_fp_freq_t  freq_correction_weight;
 	dclk_fp_phase_t phase_correction_weight;
+	
+	// Running (exponentially weighted) estimates of the mean and variance of the
+	// phase error (i.e. the corrections received) and of the size of the
+	// adjustments made to the correction frequency.
+	dclk_dfp_phase_t phase_error_mean;
+	dclk_dfp_phase_t phase_error_variance;
+	dclk_fp_freq_t   freq_stability;
+	
+	// The estimated bound on the current phase error (in ticks), recomputed on
+	// each correction.
+	dclk_time_t error_bound;
+	
+	// The number of corrections which have contributed to the estimates above
+	// (corrections received while the correction weights are still ramping down
+	// are not included).
+	uint32_t num_corrections;
+	
+	// Is the clock considered locked? The clock becomes locked once the error
+	// bound has stayed within DCLK_LOCK_ENTER_BOUND for DCLK_LOCK_HOLDOFF
+	// consecutive corrections and becomes unlocked as soon as it exceeds
+	// DCLK_LOCK_EXIT_BOUND.
+	uint32_t locked;
+	uint32_t lock_count;
+	
+	// Non-zero while relocking a clock which was locked when its state was saved
+	// (see dclk_restore_state): the clock is held to DCLK_LOCK_EXIT_BOUND rather
+	// than DCLK_LOCK_ENTER_BOUND until it locks or the bound is exceeded.
+	uint32_t relocking;
+	
+	// Incremented whenever a correction changes the relationship between raw and
+	// corrected time so that values derived from it (e.g. by
+	// dclk_get_raw_time_at) can be recognised as stale.
+	uint32_t generation;
+	
+#if DCLK_FREQ_WINDOW
+	// The raw time of each of the last DCLK_FREQ_WINDOW corrections and the
+	// offset of the raw clock from the reference it measured (a circular
+	// buffer), from which the correction frequency is estimated.
+	dclk_time_t   freq_window_time[DCLK_FREQ_WINDOW];
+	dclk_offset_t freq_window_offset[DCLK_FREQ_WINDOW];
+	uint32_t freq_window_count;
+	uint32_t freq_window_next;
+#endif
 } dclk_state_t;
 
 
+/**
+ * A snapshot of the quality of a clock's lock, see dclk_get_lock_quality.
+ */
+typedef struct {
+	// Non-zero if the clock is considered locked.
+	uint32_t locked;
+	
+	// The number of corrections which have contributed to the estimates.
+	uint32_t num_corrections;
+	
+	// Estimated mean and variance of the phase error in ticks and ticks squared.
+	dclk_fp_phase_t  phase_error_mean;
+	dclk_dfp_phase_t phase_error_variance;
+	
+	// Estimated mean magnitude of the adjustments being made to the correction
+	// frequency (small values indicate a stable frequency estimate).
+	dclk_fp_freq_t freq_stability;
+	
+	// Estimated bound on the current phase error in ticks.
+	dclk_time_t error_bound;
+} dclk_lock_quality_t;
+
+
+/**
+ * The parts of a clock's state which remain valid across application restarts
+ * (the learned frequency correction and lock statistics), see dclk_save_state.
+ * Intended to be kept in memory which survives the application being reloaded
+ * (e.g. SDRAM).
+ */
+typedef struct {
+	// DCLK_SAVED_STATE_MAGIC when valid
+	uint32_t magic;
+	
+	// When the state was saved, in the caller's units (see dclk_save_state)
+	uint32_t stamp;
+	
+	dclk_fp_freq_t correction_freq;
+	
+	dclk_dfp_phase_t phase_error_variance;
+	dclk_fp_freq_t   freq_stability;
+	uint32_t num_corrections;
+	uint32_t locked;
+	
+	// Checksum of all of the above (see dclk_save_state)
+	uint32_t checksum;
+} dclk_saved_state_t;
+
+
 // The number of fractional bits in a fixed point value representing a frequency
 #define DCLK_FP_FREQ_FBITS 30
 
 // The number of fractional bits in a fixed point value representing a phase
 #define DCLK_FP_PHASE_FBITS 16
 
+// The number of fractional bits in a fixed point time
+#define DCLK_FP_TIME_FBITS 32
+
+// Identifies a valid dclk_saved_state_t. Change whenever its layout or meaning
+// changes so that state saved by older versions is ignored.
+#define DCLK_SAVED_STATE_MAGIC 0xDC1C0002
+
 // Conversions from doubles to fixed-point types (intended to be done in the
 // compiler).
 #define DCLK_DOUBLE_TO_FP_FREQ(d)    ((dclk_fp_freq_t)((d) * ((double)(1<<DCLK_FP_FREQ_FBITS))))
@@ -95,6 +208,29 @@ dclk_time_t dclk_read_raw_time(void);
 dclk_time_t dclk_get_time(volatile dclk_state_t *state);
 
 
+/**
+ * Get the current corrected time as a fixed point number of timer ticks (with
+ * DCLK_FP_TIME_FBITS fractional bits) including the fraction of a tick which
+ * dclk_get_time truncates. The integer part is never less than the value
+ * dclk_get_time would return at the same moment. Values are monotonic within
+ * the period of the timer (and are never less than the last value returned)
+ * until dclk_correct_phase_now is called.
+ */
+dclk_fp_time_t dclk_get_time_fp(volatile dclk_state_t *state);
+
+
+/**
+ * Get the current corrected time without modifying the clock state, including
+ * any phase correction still waiting to be incorporated (as dclk_get_time
+ * would once enough time has elapsed). Intended for interrupt handlers (e.g. a
+ * FIQ handler) which cannot safely call dclk_get_time. The result is not
+ * guaranteed to be monotonic and is meaningless if the call preempts any other
+ * function in this library which modifies the state: disable the interrupt
+ * around such calls.
+ */
+dclk_time_t dclk_peek_time(const volatile dclk_state_t *state);
+
+
 /**
  * Get the estimated number of raw ticks until a specified (corrected) timer
  * value will be reached.
@@ -109,6 +245,17 @@ dclk_time_t dclk_get_time(volatile dclk_state_t *state);
 dclk_time_t dclk_get_ticks_until_time(volatile dclk_state_t *state, dclk_time_t time);
 
 
+/**
+ * Get the raw time at which the specified (corrected) time will be reached,
+ * assuming no further corrections are made (i.e. while state->generation is
+ * unchanged) and any phase correction still accumulated has been incorporated.
+ * Unlike dclk_get_ticks_until_time this does not modify the state and the
+ * result does not depend on when it is computed so it may be computed in
+ * advance. The same caveats as for dclk_peek_time apply to interrupt handlers.
+ */
+dclk_time_t dclk_get_raw_time_at(const volatile dclk_state_t *state, dclk_time_t time);
+
+
 /**
  * When the clock first starts it may suffer from a large phase offset from the
  * master clock and so this function can be used to violate clock monotonicity
@@ -126,25 +273,165 @@ void dclk_correct_phase_now(volatile dclk_state_t *state, dclk_offset_t correcti
 void dclk_add_correction(volatile dclk_state_t *state, dclk_offset_t correction);
 
 
+/**
+ * Is the clock currently considered locked to the reference clock?
+ */
+uint32_t dclk_is_locked(volatile dclk_state_t *state);
+
+
+/**
+ * Get the current estimates of the clock's lock quality. These are updated only
+ * when corrections are added and so this call is cheap.
+ */
+void dclk_get_lock_quality(volatile dclk_state_t *state, dclk_lock_quality_t *quality);
+
+
+/**
+ * Save the learned parts of the clock state (with a magic number and checksum)
+ * so that they may be restored by dclk_restore_state after the application is
+ * restarted. Should be called periodically (e.g. after each correction) while
+ * the clock is locked. The stamp is the current time from a source which
+ * survives the restart and starts again from zero whenever the saved state
+ * should be forgotten (e.g. milliseconds since the machine booted).
+ */
+void dclk_save_state(volatile dclk_state_t *state, volatile dclk_saved_state_t *saved, uint32_t stamp);
+
+
+/**
+ * Restore the frequency correction and lock statistics saved by
+ * dclk_save_state, if valid, into a freshly initialised clock. The state is
+ * only valid if it was saved at most max_age before the given stamp (in the
+ * same units): older state, or state from before the stamp's source restarted
+ * (e.g. a reboot which left the memory intact), is stale. Since the
+ * frequency is already known the correction weights start at their target
+ * values rather than being ramped down, and if the clock was locked when saved
+ * it locks again after DCLK_LOCK_HOLDOFF_RESTORED corrections whose error
+ * bound is within DCLK_LOCK_EXIT_BOUND.
+ * The phase is not saved: call this after the initial dclk_correct_phase_now
+ * (which resets the lock statistics). Returns non-zero if the state was valid
+ * and restored and zero otherwise (leaving the clock untouched).
+ */
+uint32_t dclk_restore_state(volatile dclk_state_t *state, const volatile dclk_saved_state_t *saved, uint32_t stamp, uint32_t max_age);
+
+
+/**
+ * Set the frequency correction of a freshly initialised clock to one measured
+ * by other means (e.g. from a burst of exchanges with the reference at
+ * startup). As in dclk_restore_state the correction weights start at their
+ * target values since the frequency is already known but the lock statistics
+ * are left as they are. Call after the initial dclk_correct_phase_now (and
+ * after dclk_restore_state, if used).
+ */
+void dclk_seed_frequency(volatile dclk_state_t *state, dclk_fp_freq_t correction_freq);
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // Discipline Parameters
 ////////////////////////////////////////////////////////////////////////////////
 
+// The parameters below may be overridden at compile time (e.g. to try
+// alternative settings with disciplined_clock_tb/dclk_replay.c).
+
 // The weight with which the correction frequency updates are applied. This is
 // ramped down from DCLK_FREQ_CORRECTION_WEIGHT_START to
 // DCLK_FREQ_CORRECTION_WEIGHT_TARGET in steps of
 // DCLK_FREQ_CORRECTION_WEIGHT_STEP. This allows the system to quickly lock on
 // to roughly the right frequency and then later filter out noise.
+#ifndef DCLK_FREQ_CORRECTION_WEIGHT_TARGET
 #define DCLK_FREQ_CORRECTION_WEIGHT_TARGET DCLK_DOUBLE_TO_FP_FREQ(0.05)
+#endif
+#ifndef DCLK_FREQ_CORRECTION_WEIGHT_START
 #define DCLK_FREQ_CORRECTION_WEIGHT_START  DCLK_DOUBLE_TO_FP_FREQ(1.0)
+#endif
+#ifndef DCLK_FREQ_CORRECTION_WEIGHT_STEP
 #define DCLK_FREQ_CORRECTION_WEIGHT_STEP   DCLK_DOUBLE_TO_FP_FREQ(0.10)
+#endif
+
+// Once DCLK_FREQ_WINDOW corrections have been received, the correction
+// frequency is the slope of a least squares fit to the raw clock's offset from
+// the reference measured by each of them, rather than being updated from each
+// correction alone (which is dominated by jitter unless corrections are
+// frequent). The phase is still corrected by every correction. A longer window
+// allows less frequent corrections but follows changes in the oscillators'
+// frequencies more slowly. The window must span less than the period of the
+// timer and at most 64 corrections. 0 disables the fit.
+//
+// The fitted slope is the frequency half a window ago. If
+// DCLK_FREQ_WINDOW_DRIFT is non-zero the current frequency is instead
+// extrapolated from the slopes over each half of the window. This follows
+// drifting oscillators more closely (allowing a longer poll interval) at the
+// cost of more noise when corrections are frequent.
+//
+// The defaults suit spinn_time's 1 s corrections. With the window but without
+// DCLK_FREQ_WINDOW_DRIFT, corrections every 5.76 s (the Monte Carlo harness's
+// default) lock less often than with no window at all: 160 rather than 179 of
+// 200 trials. With DCLK_FREQ_WINDOW_DRIFT all 200 lock.
+//
+// Ages within the window are measured in units of 2^DCLK_FREQ_WINDOW_TIME_SHIFT
+// ticks to keep the fit's sums in range.
+#ifndef DCLK_FREQ_WINDOW_DRIFT
+#define DCLK_FREQ_WINDOW_DRIFT 0
+#endif
+#ifndef DCLK_FREQ_WINDOW_TIME_SHIFT
+#define DCLK_FREQ_WINDOW_TIME_SHIFT 8
+#endif
+
+#if DCLK_FREQ_WINDOW > 64
+#error "DCLK_FREQ_WINDOW must be at most 64"
+#endif
+#if DCLK_FREQ_WINDOW && DCLK_FREQ_WINDOW_DRIFT && DCLK_FREQ_WINDOW < 4
+#error "DCLK_FREQ_WINDOW_DRIFT requires a DCLK_FREQ_WINDOW of at least 4"
+#endif
 
 // The weight with which phase updates are applied. This is ramped down from
 // DCLK_PHASE_CORRECTION_WEIGHT_START to DCLK_PHASE_CORRECTION_WEIGHT_TARGET in
 // steps of DCLK_PHASE_CORRECTION_WEIGHT_STEP. This allows the system to quickly
 // lock on to roughly the right time and then later filter out noise.
+#ifndef DCLK_PHASE_CORRECTION_WEIGHT_TARGET
 #define DCLK_PHASE_CORRECTION_WEIGHT_TARGET DCLK_DOUBLE_TO_FP_PHASE(0.1)
+#endif
+#ifndef DCLK_PHASE_CORRECTION_WEIGHT_START
 #define DCLK_PHASE_CORRECTION_WEIGHT_START  DCLK_DOUBLE_TO_FP_PHASE(1.0)
+#endif
+#ifndef DCLK_PHASE_CORRECTION_WEIGHT_STEP
 #define DCLK_PHASE_CORRECTION_WEIGHT_STEP   DCLK_DOUBLE_TO_FP_PHASE(0.2)
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Lock Quality Parameters
+////////////////////////////////////////////////////////////////////////////////
+
+// The phase error and frequency stability estimates move 1/(2^this) of the way
+// towards each new sample.
+#ifndef DCLK_LOCK_FILTER_SHIFT
+#define DCLK_LOCK_FILTER_SHIFT 3
+#endif
+
+// The error bound is the magnitude of the mean phase error plus this many
+// standard deviations.
+#ifndef DCLK_ERROR_BOUND_SDS
+#define DCLK_ERROR_BOUND_SDS 3
+#endif
+
+// The clock is considered locked when the error bound (ticks) has been within
+// DCLK_LOCK_ENTER_BOUND for DCLK_LOCK_HOLDOFF consecutive corrections and
+// unlocked when it exceeds DCLK_LOCK_EXIT_BOUND. The gap between the two
+// thresholds prevents the lock state chattering.
+#ifndef DCLK_LOCK_ENTER_BOUND
+#define DCLK_LOCK_ENTER_BOUND 16
+#endif
+#ifndef DCLK_LOCK_EXIT_BOUND
+#define DCLK_LOCK_EXIT_BOUND  32
+#endif
+#ifndef DCLK_LOCK_HOLDOFF
+#define DCLK_LOCK_HOLDOFF 4
+#endif
+
+// The number of consecutive corrections within DCLK_LOCK_EXIT_BOUND needed to
+// lock after restoring a clock which was locked when saved.
+#ifndef DCLK_LOCK_HOLDOFF_RESTORED
+#define DCLK_LOCK_HOLDOFF_RESTORED 1
+#endif
 
 #endif
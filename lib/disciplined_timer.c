@@ -11,19 +11,13 @@
 volatile static dtimer_state_t dtimer;
 
 
-void
-dtimer_start_interrupts( volatile dclk_state_t *dclk
-                       , dclk_time_t next_interrupt_time
-                       , dclk_time_t interrupt_period
-                       )
+/**
+ * Set up the timer as a one-shot, 32-bit counter with interrupts but leave it
+ * disabled. The prescaler is not changed.
+ */
+static void
+dtimer_configure(void)
 {
-	// Set up the data structure
-	dtimer.dclk                = dclk;
-	dtimer.next_interrupt_time = next_interrupt_time;
-	dtimer.interrupt_period    = interrupt_period;
-	dtimer.stop                = FALSE;
-	
-	// Set up the timer (but do not enable and don't set the prescaler)
 	uint timer_control = DTIMER_TC[TC_CONTROL];
 	timer_control &= ~( (1 << 0) // One shot
 	                  | (1 << 1) // Timer Size
@@ -38,18 +32,122 @@ dtimer_start_interrupts( volatile dclk_state_t *dclk
 	                  | (0 << 7) // Not Enabled
 	                  );
 	DTIMER_TC[TC_CONTROL] = timer_control;
+}
+
+
+/**
+ * Convert a number of raw ticks into corrected ticks at the clock's current
+ * frequency correction.
+ */
+static inline dclk_offset_t
+dtimer_raw_to_corrected_ticks(dclk_offset_t raw_ticks)
+{
+	return raw_ticks + (dclk_offset_t)( ( ((dclk_dfp_freq_t)raw_ticks)
+	                                    * ((dclk_dfp_freq_t)dtimer.dclk->correction_freq)
+	                                    )
+	                                  >> DCLK_FP_FREQ_FBITS
+	                                  );
+}
+
+
+/**
+ * Load the timer to interrupt at the given (corrected) time, which the clock
+ * will reach at the given raw time, brought forward by the estimated interrupt
+ * latency.
+ */
+static void
+dtimer_load_raw(dclk_time_t time, dclk_time_t raw_time)
+{
+	// The compensation is small enough that the difference between raw and
+	// corrected ticks is negligible.
+	dclk_time_t compensation = dtimer_get_latency_compensation();
+	dtimer.loaded_deadline = time;
+	dtimer.loaded_time = time - compensation;
+	dtimer.loaded_raw_deadline = raw_time;
+	dtimer.loaded_raw_time = raw_time - compensation;
+	
+	// Reload the timer with the next interrupt time (make sure that the number of
+	// ticks is at least one to ensure the interrupt does happen).
+	dclk_time_t raw_now = dclk_read_raw_time();
+	dclk_offset_t ticks_til_interrupt = dtimer.loaded_raw_time - raw_now;
+	
+	if (ticks_til_interrupt > 0) {
+		DTIMER_TC[TC_LOAD] = ticks_til_interrupt;
+	} else {
+		DTIMER_TC[TC_LOAD] = 1;
+		
+		// The time requested has already passed so the interrupt will really occur
+		// now: don't mistake the delay for interrupt latency.
+		dtimer.loaded_time -= dtimer_raw_to_corrected_ticks(ticks_til_interrupt);
+		dtimer.loaded_raw_time = raw_now;
+	}
+}
+
+
+/**
+ * Load the timer to interrupt at the given (corrected) time, brought forward by
+ * the estimated interrupt latency.
+ */
+static void
+dtimer_load(dclk_time_t time)
+{
+	dtimer_load_raw(time, dclk_get_raw_time_at(dtimer.dclk, time));
+}
+
+
+void
+dtimer_start_interrupts( volatile dclk_state_t *dclk
+                       , dclk_time_t next_interrupt_time
+                       , dclk_time_t interrupt_period
+                       )
+{
+	// Set up the data structure
+	dtimer.dclk                = dclk;
+	dtimer.next_interrupt_time = next_interrupt_time;
+	dtimer.interrupt_period    = interrupt_period;
+	dtimer.stop                = FALSE;
+	dtimer.num_loaded          = 0;
+	dtimer.compensation        = dtimer_get_latency_compensation();
+	dtimer.num_latency_samples = dtimer.num_latency_samples_added;
+	
+	// Nothing has been precomputed for this period yet
+	for (int i = 0; i < DTIMER_SCHEDULE_SIZE; i++)
+		dtimer.schedule[i].valid = FALSE;
+	
+	// Set up the timer (but do not enable and don't set the prescaler)
+	dtimer_configure();
+	
+	// Schedule the first interrupt.
+	dtimer_load(dtimer.next_interrupt_time);
+	
+	// Enable the timer (and thus its interrupts)
+	DTIMER_TC[TC_CONTROL] |= (1<<7);
+}
+
+
+void
+dtimer_schedule_interrupt_at(volatile dclk_state_t *dclk, dclk_time_t time)
+{
+	dtimer.dclk = dclk;
+	dtimer.interrupt_period = 0;
+	
+	// Set up the timer (but do not enable and don't set the prescaler)
+	dtimer_configure();
 	
-	// Schedule the next interrupt. Note that the next_interrupt_time is
-	// decremented since dtimer_schedule_next_interrupt will set the interrupt for
-	// whatever time next_interrupt_time+interrupt_period is.
-	dtimer.next_interrupt_time -= dtimer.interrupt_period;
-	dtimer_schedule_next_interrupt();
+	dtimer_load(time);
 	
 	// Enable the timer (and thus its interrupts)
 	DTIMER_TC[TC_CONTROL] |= (1<<7);
 }
 
 
+void
+dtimer_cancel_interrupts(void)
+{
+	DTIMER_TC[TC_CONTROL] &= ~(1<<7);
+}
+
+
 void
 dtimer_stop_interrupts(dclk_time_t stop_time)
 {
@@ -59,6 +157,97 @@ dtimer_stop_interrupts(dclk_time_t stop_time)
 }
 
 
+/**
+ * Add a latency sample to a histogram.
+ */
+static void
+dtimer_add_to_histogram(volatile uint32_t *hist, dclk_offset_t latency)
+{
+	latency -= DTIMER_LATENCY_HIST_MIN;
+	if (latency < 0)
+		latency = 0;
+	
+	uint bin = latency / DTIMER_LATENCY_HIST_BIN_WIDTH;
+	if (bin >= DTIMER_LATENCY_HIST_BINS)
+		bin = DTIMER_LATENCY_HIST_BINS - 1;
+	
+	hist[bin]++;
+}
+
+
+/**
+ * Add a sample to the latency histograms and estimate given the latency of an
+ * interrupt relative to the time the timer was loaded for and its lateness
+ * relative to its deadline.
+ */
+static void
+dtimer_add_latency_sample(dclk_offset_t latency, dclk_offset_t lateness)
+{
+	if (dtimer.latency_hist) {
+		dtimer_add_to_histogram(dtimer.latency_hist->uncompensated, latency);
+		dtimer_add_to_histogram(dtimer.latency_hist->compensated, lateness);
+	}
+	
+	// Interrupts may appear to arrive early if the clock was slowed down after
+	// the timer was loaded: treat these as having no latency.
+	if (latency < 0)
+		latency = 0;
+	
+	// Move the estimate a fraction of the way towards the new sample
+	if (latency <= DTIMER_LATENCY_MAX)
+		dtimer.latency_estimate += ( (latency << DCLK_FP_PHASE_FBITS)
+		                           - dtimer.latency_estimate
+		                           ) >> DTIMER_LATENCY_FILTER_SHIFT;
+}
+
+
+void
+dtimer_measure_latency(dclk_time_t now)
+{
+	dtimer_add_latency_sample(now - dtimer.loaded_time, now - dtimer.loaded_deadline);
+}
+
+
+dclk_time_t
+dtimer_get_latency_compensation(void)
+{
+	if (!DTIMER_LATENCY_COMPENSATION)
+		return 0;
+	
+	dclk_time_t compensation = dtimer.latency_estimate >> DCLK_FP_PHASE_FBITS;
+	
+	// Never bring periodic interrupts forward so far that they might overtake the
+	// previous interrupt.
+	if (dtimer.interrupt_period && compensation > dtimer.interrupt_period / 2)
+		compensation = dtimer.interrupt_period / 2;
+	
+	return compensation;
+}
+
+
+void
+dtimer_record_latency_histograms(volatile dtimer_latency_hist_t *hist)
+{
+	if (hist) {
+		for (int i = 0; i < DTIMER_LATENCY_HIST_BINS; i++) {
+			hist->uncompensated[i] = 0;
+			hist->compensated[i] = 0;
+		}
+	}
+	
+	dtimer.latency_hist = hist;
+}
+
+
+uint
+dtimer_interrupt_due(void)
+{
+	// The timer counts raw ticks so it never interrupts before the raw time it
+	// was loaded for.
+	return (dclk_offset_t)(dclk_read_raw_time() - dtimer.loaded_raw_time) >= 0;
+}
+
+
 dclk_time_t
 dtimer_schedule_next_interrupt(void)
 {
@@ -66,6 +255,15 @@ dtimer_schedule_next_interrupt(void)
 	// returned to the user)
 	dclk_time_t nominal_time_now = dtimer.next_interrupt_time;
 	
+	// Note the latency for dtimer_update_schedule to add to the estimate. It is
+	// measured in raw ticks (which avoids reading, and so updating, the clock
+	// here): over so few ticks the difference from corrected ticks is
+	// negligible.
+	dclk_time_t raw_now = dclk_read_raw_time();
+	dtimer.latency_sample = raw_now - dtimer.loaded_raw_time;
+	dtimer.lateness_sample = raw_now - dtimer.loaded_raw_deadline;
+	dtimer.num_latency_samples++;
+	
 	// Stop the timer if required
 	dclk_time_t new_next_interrupt_time = nominal_time_now
 	                                    + dtimer.interrupt_period;
@@ -76,20 +274,99 @@ dtimer_schedule_next_interrupt(void)
 		// intentionally stopped).
 		DTIMER_TC[TC_CONTROL] &= ~(1<<7);
 	} else {
-		// Reload the timer with the next interrupt time (make sure that the number of
-		// ticks is at least one to ensure the interrupt does happen).
-		dclk_time_t ticks_til_next_interrupt
-			= dclk_get_ticks_until_time(dtimer.dclk, dtimer.next_interrupt_time);
-		
+		// Note: Assignment ordering is significant (see dtimer_update_schedule)
 		dtimer.next_interrupt_time = new_next_interrupt_time;
+		dtimer.num_loaded++;
 		
-		if (ticks_til_next_interrupt > 0)
-			DTIMER_TC[TC_LOAD] = ticks_til_next_interrupt;
-		else
-			DTIMER_TC[TC_LOAD] = 1;
+		// Use the precomputed deadline unless the clock has been corrected since
+		// (or it was never computed).
+		volatile dtimer_schedule_entry_t *entry
+			= &dtimer.schedule[dtimer.num_loaded % DTIMER_SCHEDULE_SIZE];
+		uint32_t generation = dtimer.dclk->generation;
+		dclk_time_t raw_deadline = entry->raw_deadline;
+		// Checked after the read in case dtimer_update_schedule rewrote the entry.
+		if ( entry->valid
+		     && entry->deadline == new_next_interrupt_time
+		     && entry->generation == generation
+		   ) {
+			// Bring the interrupt forward by the precomputed compensation (making
+			// sure that the number of ticks is at least one to ensure the interrupt
+			// does happen).
+			dtimer.loaded_raw_deadline = raw_deadline;
+			dtimer.loaded_raw_time = raw_deadline - dtimer.compensation;
+			raw_now = dclk_read_raw_time();
+			dclk_offset_t ticks_til_interrupt = dtimer.loaded_raw_time - raw_now;
+			if (ticks_til_interrupt > 0) {
+				DTIMER_TC[TC_LOAD] = ticks_til_interrupt;
+			} else {
+				DTIMER_TC[TC_LOAD] = 1;
+				dtimer.loaded_raw_time = raw_now;
+			}
+		} else {
+			dtimer_load(new_next_interrupt_time);
+		}
 	}
 	
 	return nominal_time_now;
 }
 
 
+void
+dtimer_update_schedule(void)
+{
+	// Only periodic interrupts can be scheduled in advance. If this preempted
+	// another call, that call will finish the job.
+	if (!dtimer.interrupt_period || dtimer.updating)
+		return;
+	dtimer.updating = TRUE;
+	
+	// Add the latency of the last interrupt to the estimate and precompute the
+	// compensation it implies.
+	uint32_t num_latency_samples = dtimer.num_latency_samples;
+	if (num_latency_samples != dtimer.num_latency_samples_added) {
+		dtimer_add_latency_sample(dtimer.latency_sample, dtimer.lateness_sample);
+		dtimer.num_latency_samples_added = num_latency_samples;
+	}
+	dtimer.compensation = dtimer_get_latency_compensation();
+	
+	// If the clock is corrected while the schedule is being computed (by
+	// anything which preempts this), start again.
+	uint32_t generation;
+	do {
+		// Get a consistent view of the last interrupt loaded in case the ISR
+		// preempts this function.
+		uint32_t num_loaded;
+		dclk_time_t next_interrupt_time;
+		do {
+			num_loaded = dtimer.num_loaded;
+			next_interrupt_time = dtimer.next_interrupt_time;
+		} while (num_loaded != dtimer.num_loaded);
+		
+		// Read before computing anything so that entries computed while a
+		// correction is being made are never mistaken for valid ones.
+		generation = dtimer.dclk->generation;
+		
+		for (uint32_t i = 1; i <= DTIMER_SCHEDULE_SIZE; i++) {
+			dclk_time_t deadline = next_interrupt_time + (i * dtimer.interrupt_period);
+			if (dtimer.stop && (dclk_offset_t)(dtimer.stop_time - deadline) < 0)
+				break;
+			
+			volatile dtimer_schedule_entry_t *entry
+				= &dtimer.schedule[(num_loaded + i) % DTIMER_SCHEDULE_SIZE];
+			if ( entry->valid
+			     && entry->deadline == deadline
+			     && entry->generation == generation
+			   )
+				continue;
+			
+			// Note: Assignment ordering is significant (the ISR may preempt this)
+			entry->valid = FALSE;
+			entry->deadline = deadline;
+			entry->generation = generation;
+			entry->raw_deadline = dclk_get_raw_time_at(dtimer.dclk, deadline);
+			entry->valid = TRUE;
+		}
+	} while (generation != dtimer.dclk->generation);
+	
+	dtimer.updating = FALSE;
+}
@@ -8,6 +8,49 @@
 
 #include "disciplined_clock.h"
 
+// Number of interrupt deadlines precomputed by dtimer_update_schedule
+#ifndef DTIMER_SCHEDULE_SIZE
+#define DTIMER_SCHEDULE_SIZE 8
+#endif
+
+// Number of bins in each interrupt latency histogram
+#define DTIMER_LATENCY_HIST_BINS 64
+
+// The latency (in corrected timer ticks) counted by the first bin of the
+// latency histograms and the width of each bin. Samples outside the range of
+// the histogram are counted in the first or last bin.
+#define DTIMER_LATENCY_HIST_MIN       (-32)
+#define DTIMER_LATENCY_HIST_BIN_WIDTH 2
+
+/**
+ * Histograms of interrupt latency.
+ */
+typedef struct {
+	// The latency between the time the timer was loaded to interrupt and the time
+	// the interrupt was handled, i.e. the lateness which would be seen without
+	// latency compensation.
+	uint32_t uncompensated[DTIMER_LATENCY_HIST_BINS];
+	
+	// The lateness of the interrupt being handled relative to the time it was
+	// supposed to occur, i.e. after latency compensation.
+	uint32_t compensated[DTIMER_LATENCY_HIST_BINS];
+} dtimer_latency_hist_t;
+
+/**
+ * A precomputed timer deadline, see dtimer_update_schedule.
+ */
+typedef struct {
+	// Non-zero when the fields below are consistent. Cleared while they are
+	// being written.
+	uint32_t valid;
+	
+	// The (corrected) time of the interrupt and the raw time at which it will
+	// occur given the clock's generation.
+	dclk_time_t deadline;
+	dclk_time_t raw_deadline;
+	uint32_t generation;
+} dtimer_schedule_entry_t;
+
 /**
  * A structure which stores all persistent timer discipline state. Not intended
  * for public access.
@@ -28,6 +71,44 @@ typedef struct {
 	
 	// If stop is TRUE, further interrupts will not be scheduled after this time.
 	dclk_time_t stop_time;
+	
+	// The time at which the pending interrupt is supposed to occur and the
+	// (earlier) time the timer was actually loaded to interrupt at to compensate
+	// for interrupt latency (corrected time). Not updated when a precomputed
+	// deadline is loaded (only used by dtimer_measure_latency).
+	dclk_time_t loaded_deadline;
+	dclk_time_t loaded_time;
+	
+	// The raw times corresponding with loaded_deadline and loaded_time.
+	dclk_time_t loaded_raw_deadline;
+	dclk_time_t loaded_raw_time;
+	
+	// The number of interrupts loaded since dtimer_start_interrupts. Interrupt n
+	// takes its deadline from schedule[n % DTIMER_SCHEDULE_SIZE].
+	uint32_t num_loaded;
+	dtimer_schedule_entry_t schedule[DTIMER_SCHEDULE_SIZE];
+	
+	// Non-zero while dtimer_update_schedule is running.
+	uint updating;
+	
+	// The latency compensation (in timer ticks) applied to precomputed
+	// deadlines, computed by dtimer_update_schedule.
+	dclk_time_t compensation;
+	
+	// The latency and lateness (see dtimer_latency_hist_t) of the last periodic
+	// interrupt, counted by num_latency_samples, for dtimer_update_schedule to
+	// add to the estimate (until num_latency_samples_added catches up).
+	dclk_offset_t latency_sample;
+	dclk_offset_t lateness_sample;
+	uint32_t num_latency_samples;
+	uint32_t num_latency_samples_added;
+	
+	// A running estimate of the interrupt latency (in fixed point corrected
+	// timer ticks).
+	dclk_fp_phase_t latency_estimate;
+	
+	// If not NULL, latency histograms are recorded here
+	volatile dtimer_latency_hist_t *latency_hist;
 } dtimer_state_t;
 
 
@@ -41,12 +122,13 @@ typedef struct {
  * timer used by the disciplined clock.
  *
  * Note that the timer ISR must call dtimer_schedule_next_interrupt on every
- * interrupt. The ISR must also (on average) take less time to complete than the
- * interrupt_period. Assuming these are met and that the disciplined clock
- * remains locked, the ISR is guarunteed to be called the correct number of
- * times given the interrupt period.
+ * interrupt (and should call dtimer_update_schedule after it). The ISR must
+ * also (on average) take less time to complete than the interrupt_period.
+ * Assuming these are met and that the disciplined clock remains locked, the ISR
+ * is guarunteed to be called the correct number of times given the interrupt
+ * period.
  *
- * See the documentation for dclk_get_ticks_until_time for further timing
+ * See the documentation for dclk_get_raw_time_at for further timing
  * guaruntees.
  */
 void dtimer_start_interrupts( volatile dclk_state_t *dclk
@@ -73,6 +155,10 @@ void dtimer_stop_interrupts(dclk_time_t stop_time);
  * function is not called, no further interrupts will occur. Returns the time at
  * which the interrupt was *supposed* to occur.
  *
+ * Provided dtimer_update_schedule is kept up to date, this takes a constant
+ * (and small) time: it only notes the interrupt's latency and loads the timer
+ * with a precomputed deadline.
+ *
  * This function must only be used after dtimer_start_interrupts has been
  * called.
  *
@@ -83,10 +169,88 @@ void dtimer_stop_interrupts(dclk_time_t stop_time);
  */
 dclk_time_t dtimer_schedule_next_interrupt(void);
 
+/**
+ * Returns non-zero if the timer has reached the time it was last loaded to
+ * interrupt at, i.e. if the interrupt being handled is really the timer's. An
+ * ISR which may also be called for another reason (e.g. for a spin1 timer tick
+ * still pending when the timer was taken over) should ignore the call, and not
+ * call dtimer_schedule_next_interrupt, if this returns zero.
+ */
+uint dtimer_interrupt_due(void);
+
+/**
+ * Precompute the raw times of the next DTIMER_SCHEDULE_SIZE interrupts and the
+ * latency compensation (adding the last interrupt's latency to the estimate)
+ * so that dtimer_schedule_next_interrupt need only load them into the timer.
+ * Entries already computed are only recomputed if the clock has been corrected
+ * since.
+ *
+ * This function should be called after every interrupt (e.g. at the end of the
+ * ISR, once the time-critical work is done) and after every correction of the
+ * clock, but not while the clock state is being modified. Calls may preempt
+ * the ISR and each other. A correction made after this call invalidates the
+ * schedule, in which case dtimer_schedule_next_interrupt falls back on
+ * computing the deadline itself until this is called again.
+ */
+void dtimer_update_schedule(void);
+
+/**
+ * Set up the timer such that it will produce a single interrupt at the given
+ * (corrected) time, replacing any interrupt previously scheduled. Unlike
+ * dtimer_start_interrupts, further interrupts are not scheduled automatically
+ * and so the ISR must not call dtimer_schedule_next_interrupt.
+ *
+ * As with dtimer_start_interrupts, the clock divider setting is not changed and
+ * if the time is in the past the interrupt will occur immediately.
+ */
+void dtimer_schedule_interrupt_at(volatile dclk_state_t *dclk, dclk_time_t time);
+
+/**
+ * Immediately disable the timer, cancelling any pending interrupt.
+ */
+void dtimer_cancel_interrupts(void);
+
+/**
+ * Record the latency of the interrupt currently being handled given the
+ * (corrected) time at which it was handled and update the latency estimate.
+ * This is done automatically for periodic interrupts (see
+ * dtimer_update_schedule) but must be called by ISRs for interrupts scheduled
+ * with dtimer_schedule_interrupt_at.
+ */
+void dtimer_measure_latency(dclk_time_t now);
+
+/**
+ * Get the number of (corrected) ticks by which interrupts are currently being
+ * brought forward to compensate for interrupt latency. An interrupt handled up
+ * to this many ticks before its deadline should be treated as on time since
+ * rescheduling it would only result in it occurring later.
+ */
+dclk_time_t dtimer_get_latency_compensation(void);
+
+/**
+ * Start recording histograms of interrupt latency with and without latency
+ * compensation in the supplied structure (which is zeroed). Recording stops if
+ * NULL is given.
+ */
+void dtimer_record_latency_histograms(volatile dtimer_latency_hist_t *hist);
+
 /**
  * Pointer to the specific timer to control.
  */
 #define DTIMER_TC (tc1)
 
+// Compensate for interrupt latency by bringing interrupts forward by the
+// estimated latency (TRUE) or only measure it (FALSE).
+#define DTIMER_LATENCY_COMPENSATION TRUE
+
+// The weight given to each new latency sample in the running estimate is
+// 1/(2**DTIMER_LATENCY_FILTER_SHIFT).
+#define DTIMER_LATENCY_FILTER_SHIFT 4
+
+// Latency samples larger than this (in corrected timer ticks) are treated as
+// outliers (e.g. due to a long running higher priority task) and do not affect
+// the latency estimate.
+#define DTIMER_LATENCY_MAX 1000
+
 #endif
 
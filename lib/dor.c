@@ -21,6 +21,34 @@
 	} while (0)
 
 
+/**
+ * Add routing entries which send keys whose 8-bit field at the given shift is
+ * within [lo, hi] (and which otherwise match key/mask) in the given direction.
+ * The range is covered by the fewest aligned power-of-two blocks, each of which
+ * needs one entry.
+ */
+static void
+add_range_rtr_entries(uint lo, uint hi, uint shift, uint key, uint mask, uint route)
+{
+	uint value = lo;
+	while (value <= hi && value <= 0xFF) {
+		// Find the largest aligned block starting here which fits in the range
+		uint size = 1;
+		while ( size < 0x100
+		        && (value & ((size << 1) - 1)) == 0
+		        && value + (size << 1) - 1 <= hi
+		      )
+			size <<= 1;
+		
+		ADD_RTR_ENTRY( key | (value << shift)
+		             , mask | (((0xFF & ~(size - 1))) << shift)
+		             , route
+		             );
+		value += size;
+	}
+}
+
+
 // Macros which expand to 0xFF if the given dimension (defined by dim_order) is
 // at that index or lower and zero otherwise. i.e. 0xFF if this dimension has
 // been used by the given index.
@@ -50,6 +78,16 @@ setup_routing_tables(uint my_x, uint my_y, uint cores_per_chip)
 	             , NEAREST_NEIGHBOUR_KEY(0xFF, 0)
 	             , EAST|NORTH|NORTH_EAST|WEST|SOUTH_WEST|SOUTH
 	             );
+	// Add entry to deliver local broadcasts to every core but the first (must
+	// come before the entry below which would also match)
+	uint local_cores = 0;
+	for (int p = 2; p <= cores_per_chip; p++)
+		local_cores |= CORE(p);
+	if (local_cores)
+		ADD_RTR_ENTRY( LOCAL_BROADCAST_KEY
+		             , NEAREST_NEIGHBOUR_KEY(0xFF, 0)
+		             , local_cores
+		             );
 	// Add entry to catch all incoming nearest neighbour messages (i.e. those with
 	// a different colour
 	for (int p = 1; p <= cores_per_chip; p++)
@@ -72,6 +110,35 @@ setup_routing_tables(uint my_x, uint my_y, uint cores_per_chip)
 		             , CORE(p)
 		             );
 	
+	// Add entries to accept traffic packets destined for this core. Those for
+	// chips on the X or Y axes are also matched by the entries above.
+	for (int p = 1; p <= cores_per_chip; p++)
+		ADD_RTR_ENTRY( TRAFFIC_KEY(my_x,my_y,p-1)
+		             , XYZPD_TO_KEY(0xFF,0xFF,0xFF,0x0F,0x07)
+		             , CORE(p)
+		             );
+	
+	// Route traffic packets along X until they reach the destination column and
+	// then along Y.
+	if (my_x > 0)
+		add_range_rtr_entries( 0, my_x - 1, 24
+		                     , TRAFFIC_KEY(0,0,0), XYZPD_TO_KEY(0,0,0xFF,0,0x07)
+		                     , WEST
+		                     );
+	add_range_rtr_entries( my_x + 1, 0xFF, 24
+	                     , TRAFFIC_KEY(0,0,0), XYZPD_TO_KEY(0,0,0xFF,0,0x07)
+	                     , EAST
+	                     );
+	if (my_y > 0)
+		add_range_rtr_entries( 0, my_y - 1, 16
+		                     , TRAFFIC_KEY(my_x,0,0), XYZPD_TO_KEY(0xFF,0,0xFF,0,0x07)
+		                     , SOUTH
+		                     );
+	add_range_rtr_entries( my_y + 1, 0xFF, 16
+	                     , TRAFFIC_KEY(my_x,0,0), XYZPD_TO_KEY(0xFF,0,0xFF,0,0x07)
+	                     , NORTH
+	                     );
+	
 	// Add entry to pick up return packets for the master
 	if (my_x == 0 && my_y == 0)
 		ADD_RTR_ENTRY( RETURN_KEY(XYZPD_TO_KEY(0,0,0,0,0))
@@ -82,6 +82,10 @@ const uint DIM_DIRECTIONS[3] = {
 #define KEY_TO_P(k) (((k) >>  4) & 0x0F)
 #define KEY_TO_D(k) (((k) >>  1) & 0x07)
 
+// Get the 2D chip coordinates from a key's minimal 3D hexagonal coordinate
+#define KEY_TO_CHIP_X(k) ((KEY_TO_X(k) - KEY_TO_Z(k)) & 0xFF)
+#define KEY_TO_CHIP_Y(k) ((KEY_TO_Y(k) - KEY_TO_Z(k)) & 0xFF)
+
 #define XYPD_TO_KEY(x,y,p,d) (XYZPD_TO_KEY( XY_TO_MIN_X((x),(y)) \
                                           , XY_TO_MIN_Y((x),(y)) \
                                           , XY_TO_MIN_Z((x),(y)) \
@@ -91,10 +95,20 @@ const uint DIM_DIRECTIONS[3] = {
 
 // A key which broadcasts to the same core in neighbouring chips
 #define NEAREST_NEIGHBOUR_KEY(colour, p) (XYZPD_TO_KEY((colour),0,0,(p),7))
+#define IS_NEAREST_NEIGHBOUR_KEY(k) (KEY_TO_D(k) == 7)
 
 // Convert the chip's X & Y coordinates into a colour
 #define XY_TO_COLOUR(x,y) (((x)+(y))%3)
 
+// A key which is delivered to every core on the sending chip except core 1
+// (which runs the master or slave in these experiments).
+#define LOCAL_BROADCAST_KEY (NEAREST_NEIGHBOUR_KEY(3, 0))
+
+// A key which routes from any chip to the given core on chip (x,y) (2D
+// coordinates) using X-then-Y routing, e.g. for long-range background traffic.
+// Dimension order 6 is used to distinguish these keys.
+#define TRAFFIC_KEY(x,y,p) (XYZPD_TO_KEY((x),(y),0,(p),6))
+
 // Convert a key into the "return" version which routes back to 0,0,0,1
 #define RETURN_KEY(k) (k & ~0x1)
 #define RETURN_MASK(k) (k | 0x1)
@@ -102,7 +116,8 @@ const uint DIM_DIRECTIONS[3] = {
 
 /**
  * Initialise the routing tables on this chip with a naive 0,0 to any, any to
- * 0,0 routing scheme. If a routing table entry cannot be allocated using
+ * 0,0 routing scheme (plus nearest-neighbour, local broadcast and any to any
+ * traffic keys). If a routing table entry cannot be allocated using
  * rtr_alloc, prints a warning in IO_BUF and otherwise continues blindly.
  */
 void setup_routing_tables(uint my_x, uint my_y, uint cores_per_chip);
@@ -0,0 +1,128 @@
+#include "piggyback_sync.h"
+
+
+/**
+ * Discard the corrections received so far this interval.
+ */
+static void
+psync_reset_corrections(volatile psync_state_t *state)
+{
+	state->best_correction = 0;
+	for (uint32_t i = 0; i <= PSYNC_FILTER_TICKS; i++)
+		state->num_corrections[i] = 0;
+}
+
+
+void
+psync_initialise(volatile psync_state_t *state, uint32_t stratum, dclk_fp_phase_t latency)
+{
+	state->stratum = stratum;
+	state->latency = latency;
+	state->residual = 0;
+	state->idle_intervals = 0;
+	psync_reset_corrections(state);
+}
+
+
+uint32_t
+psync_stamp(volatile psync_state_t *state, dclk_time_t time)
+{
+	return PSYNC_TO_PL(state->stratum, time);
+}
+
+
+void
+psync_receive(volatile psync_state_t *state, uint32_t payload, dclk_time_t time)
+{
+	uint32_t stratum = PL_TO_PSYNC_STRATUM(payload);
+	if (stratum == PSYNC_STRATUM_NONE)
+		return;
+	
+	// Adopt the stratum below the lowest heard, forgetting any corrections from
+	// the old stratum above.
+	if (stratum + 1 < state->stratum) {
+		state->stratum = stratum + 1;
+		psync_reset_corrections(state);
+	}
+	if (stratum + 1 != state->stratum)
+		return;
+	
+	// Reconstruct the sender's time at arrival from the truncated timestamp
+	// (sign extending the difference). The fraction of a tick of the latency is
+	// added in psync_get_correction.
+	dclk_offset_t latency = state->latency >> DCLK_FP_PHASE_FBITS;
+	uint32_t difference = (PL_TO_PSYNC_TIME(payload) + latency - time) & PSYNC_TIME_MASK;
+	dclk_offset_t correction = ((dclk_offset_t)(difference << PSYNC_STRATUM_BITS))
+	                           >> PSYNC_STRATUM_BITS;
+	
+	// Keep counts of the corrections received within PSYNC_FILTER_TICKS of the
+	// largest, moving them along when a larger one arrives.
+	uint32_t num_received = 0;
+	for (uint32_t i = 0; i <= PSYNC_FILTER_TICKS; i++)
+		num_received += state->num_corrections[i];
+	
+	if (num_received == 0) {
+		state->best_correction = correction;
+	} else if (correction > state->best_correction) {
+		dclk_offset_t shift = correction - state->best_correction;
+		for (int32_t i = PSYNC_FILTER_TICKS; i >= 0; i--)
+			state->num_corrections[i] = (i >= shift) ? state->num_corrections[i - shift] : 0;
+		state->best_correction = correction;
+	}
+	
+	dclk_offset_t below_best = state->best_correction - correction;
+	if (below_best <= PSYNC_FILTER_TICKS)
+		state->num_corrections[below_best]++;
+}
+
+
+uint32_t
+psync_get_correction(volatile psync_state_t *state, dclk_offset_t *correction)
+{
+	uint32_t num_received = 0;
+	uint32_t total_below_best = 0;
+	for (uint32_t i = 0; i <= PSYNC_FILTER_TICKS; i++) {
+		num_received += state->num_corrections[i];
+		total_below_best += i * state->num_corrections[i];
+	}
+	
+	if (num_received == 0) {
+		// The stratum below has gone quiet: look for another
+		if ( state->stratum != PSYNC_STRATUM_REFERENCE
+		     && ++state->idle_intervals >= PSYNC_HOLDOVER_INTERVALS
+		   )
+			state->stratum = PSYNC_STRATUM_NONE;
+		return 0;
+	}
+	
+	// The mean of the corrections near the best plus the fraction of a tick of
+	// the latency and whatever was left over by previous corrections, rounded
+	// to whole ticks. Corrections can be as large as the timestamps allow (e.g.
+	// on adopting a new stratum or after holdover) so this is done in double
+	// width (multiplying rather than shifting since they may be negative).
+	dclk_dfp_phase_t fp_correction = ( ((dclk_dfp_phase_t)state->best_correction)
+	                                 * (1 << DCLK_FP_PHASE_FBITS)
+	                                 )
+	                               - (dclk_dfp_phase_t)((((uint64_t)total_below_best) << DCLK_FP_PHASE_FBITS) / num_received)
+	                               + (state->latency & ((1 << DCLK_FP_PHASE_FBITS) - 1))
+	                               + state->residual;
+	*correction = (dclk_offset_t)( (fp_correction + (1 << (DCLK_FP_PHASE_FBITS - 1)))
+	                             >> DCLK_FP_PHASE_FBITS
+	                             );
+	state->residual = (dclk_fp_phase_t)( fp_correction
+	                                   - ( ((dclk_dfp_phase_t)*correction)
+	                                     * (1 << DCLK_FP_PHASE_FBITS)
+	                                     )
+	                                   );
+	
+	state->idle_intervals = 0;
+	psync_reset_corrections(state);
+	return 1;
+}
+
+
+uint32_t
+psync_get_stratum(volatile psync_state_t *state)
+{
+	return state->stratum;
+}
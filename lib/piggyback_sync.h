@@ -0,0 +1,128 @@
+/**
+ * Time transfer piggybacked on an application's nearest-neighbour multicast
+ * packets. Each packet's payload carries a compact timestamp of the sender's
+ * (disciplined) clock and each receiving core derives corrections for its own
+ * clock from the packets it receives anyway so no dedicated sync messages are
+ * required.
+ *
+ * Every core has a stratum: the number of hops between it and the reference
+ * clock (stratum 0). A core adopts a stratum one greater than the lowest it
+ * hears from its neighbours and takes corrections only from neighbours of the
+ * stratum below so that time flows outward from the reference.
+ *
+ * Since the transfer is one way, the latency of a packet from being stamped to
+ * being received must be known in advance. Packets delayed by contention only
+ * arrive late so in each interval the corrections are taken from the least
+ * delayed packets.
+ */
+
+#ifndef PIGGYBACK_SYNC_H
+#define PIGGYBACK_SYNC_H
+
+#include <stdint.h>
+
+#include "disciplined_clock.h"
+
+
+// The payload of a stamped packet: the sender's stratum in the top
+// PSYNC_STRATUM_BITS and the least significant PSYNC_TIME_BITS of its time when
+// the packet was sent. Receivers' clocks must be within half the range of the
+// time field of the sender's for the time to be reconstructed.
+#define PSYNC_STRATUM_BITS 7
+#define PSYNC_TIME_BITS    (32 - PSYNC_STRATUM_BITS)
+#define PSYNC_TIME_MASK    ((1u << PSYNC_TIME_BITS) - 1)
+
+#define PSYNC_TO_PL(stratum, time) ( (((uint32_t)(stratum)) << PSYNC_TIME_BITS) \
+                                   | (((uint32_t)(time)) & PSYNC_TIME_MASK) \
+                                   )
+#define PL_TO_PSYNC_STRATUM(pl) (((uint32_t)(pl)) >> PSYNC_TIME_BITS)
+#define PL_TO_PSYNC_TIME(pl)    (((uint32_t)(pl)) & PSYNC_TIME_MASK)
+
+// The stratum of the reference clock and that advertised by cores which have
+// not (yet) heard from any neighbour with a stratum.
+#define PSYNC_STRATUM_REFERENCE 0
+#define PSYNC_STRATUM_NONE      ((1u << PSYNC_STRATUM_BITS) - 1)
+
+// Corrections are the mean of those within this many ticks of the least
+// delayed packet in each interval. Must be small: it need only cover the
+// quantisation of both ends' timestamps.
+#ifndef PSYNC_FILTER_TICKS
+#define PSYNC_FILTER_TICKS 1
+#endif
+
+// The number of consecutive intervals without packets from the stratum below
+// after which a core forgets its stratum (and so will adopt a new one from
+// whichever neighbours it hears next).
+#ifndef PSYNC_HOLDOVER_INTERVALS
+#define PSYNC_HOLDOVER_INTERVALS 4
+#endif
+
+
+/**
+ * The state of a core's piggybacked time transfer. Not intended for public
+ * access.
+ */
+typedef struct {
+	// This core's stratum
+	uint32_t stratum;
+	
+	// The latency (ticks, fixed point) of a packet from being stamped to being
+	// received
+	dclk_fp_phase_t latency;
+	
+	// The largest (i.e. least delayed) correction received this interval and
+	// the number received at each number of ticks below it (up to
+	// PSYNC_FILTER_TICKS).
+	dclk_offset_t best_correction;
+	uint32_t num_corrections[PSYNC_FILTER_TICKS + 1];
+	
+	// The fraction of a tick by which the corrections issued so far fall short
+	// of those measured (fixed point). Carried forward so that the latency
+	// need not be a whole number of ticks.
+	dclk_fp_phase_t residual;
+	
+	// The number of consecutive intervals without any corrections
+	uint32_t idle_intervals;
+} psync_state_t;
+
+
+/**
+ * Initialise the state of a core. The core holding the reference clock has
+ * stratum PSYNC_STRATUM_REFERENCE and all others PSYNC_STRATUM_NONE. latency
+ * is the expected time (ticks, in the same fixed point format as
+ * dclk_fp_phase_t) from a packet being stamped by one core to its being
+ * received by the next.
+ */
+void psync_initialise(volatile psync_state_t *state, uint32_t stratum, dclk_fp_phase_t latency);
+
+
+/**
+ * Get the payload for a packet sent at the given (disciplined) time.
+ */
+uint32_t psync_stamp(volatile psync_state_t *state, dclk_time_t time);
+
+
+/**
+ * Process the payload of a stamped packet received at the given (disciplined)
+ * time. Intended to be called from the packet's FIQ handler with
+ * dclk_peek_time's result to minimise the latency to be compensated for.
+ */
+void psync_receive(volatile psync_state_t *state, uint32_t payload, dclk_time_t time);
+
+
+/**
+ * To be called once per correction interval (with packet reception disabled).
+ * Returns non-zero and sets *correction to the correction for the clock (to be
+ * passed to dclk_add_correction) if any suitable packets were received since
+ * the last call.
+ */
+uint32_t psync_get_correction(volatile psync_state_t *state, dclk_offset_t *correction);
+
+
+/**
+ * Get the core's current stratum.
+ */
+uint32_t psync_get_stratum(volatile psync_state_t *state);
+
+
+#endif
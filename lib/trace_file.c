@@ -0,0 +1,402 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace_file.h"
+
+// Initial number of records allocated by a writer
+#define TRACE_INITIAL_CAPACITY 1024
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Writing
+////////////////////////////////////////////////////////////////////////////////
+
+trace_writer_t *
+trace_writer_create(uint32_t num_fields, const char * const *field_names)
+{
+	trace_writer_t *writer = calloc(1, sizeof(trace_writer_t));
+	if (!writer)
+		return NULL;
+	
+	writer->num_fields = num_fields;
+	writer->field_names = calloc(num_fields ? num_fields : 1, TRACE_FIELD_NAME_LEN);
+	if (!writer->field_names) {
+		free(writer);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < num_fields; i++)
+		strncpy(writer->field_names[i], field_names[i], TRACE_FIELD_NAME_LEN - 1);
+	
+	writer->sorted = 1;
+	return writer;
+}
+
+
+/**
+ * Make room for at least one more record.
+ */
+static int
+trace_writer_grow(trace_writer_t *writer)
+{
+	if (writer->num_records < writer->capacity)
+		return 0;
+	
+	uint64_t capacity = writer->capacity ? writer->capacity * 2 : TRACE_INITIAL_CAPACITY;
+	
+	int32_t *ids = realloc(writer->ids, capacity * 2 * sizeof(int32_t));
+	if (!ids)
+		return -1;
+	writer->ids = ids;
+	
+	int64_t *time_us = realloc(writer->time_us, capacity * sizeof(int64_t));
+	if (!time_us)
+		return -1;
+	writer->time_us = time_us;
+	
+	if (writer->num_fields) {
+		int32_t *fields = realloc(writer->fields, capacity * writer->num_fields * sizeof(int32_t));
+		if (!fields)
+			return -1;
+		writer->fields = fields;
+	}
+	
+	writer->capacity = capacity;
+	return 0;
+}
+
+
+/**
+ * Compare the (series, time) of two records, -ve if a comes first.
+ */
+static int
+trace_writer_compare( const int32_t *ids_a, int64_t time_a
+                    , const int32_t *ids_b, int64_t time_b
+                    )
+{
+	if (ids_a[0] != ids_b[0])
+		return (ids_a[0] < ids_b[0]) ? -1 : 1;
+	if (ids_a[1] != ids_b[1])
+		return (ids_a[1] < ids_b[1]) ? -1 : 1;
+	if (time_a != time_b)
+		return (time_a < time_b) ? -1 : 1;
+	return 0;
+}
+
+
+int
+trace_writer_append( trace_writer_t *writer
+                   , int32_t id_a, int32_t id_b
+                   , int64_t time_us
+                   , const int32_t *values
+                   )
+{
+	if (trace_writer_grow(writer))
+		return -1;
+	
+	uint64_t i = writer->num_records++;
+	writer->ids[(2*i) + 0] = id_a;
+	writer->ids[(2*i) + 1] = id_b;
+	writer->time_us[i] = time_us;
+	memcpy(&(writer->fields[i * writer->num_fields]), values, writer->num_fields * sizeof(int32_t));
+	
+	if ( i > 0
+	     && trace_writer_compare( &(writer->ids[2*(i-1)]), writer->time_us[i-1]
+	                            , &(writer->ids[2*i]), writer->time_us[i]
+	                            ) > 0
+	   )
+		writer->sorted = 0;
+	
+	return 0;
+}
+
+
+// A record's sort key (and original position, to keep the sort stable)
+typedef struct {
+	int32_t ids[2];
+	int64_t time_us;
+	uint64_t record;
+} trace_sort_key_t;
+
+
+static int
+trace_sort_key_compare(const void *a_, const void *b_)
+{
+	const trace_sort_key_t *a = a_;
+	const trace_sort_key_t *b = b_;
+	int order = trace_writer_compare(a->ids, a->time_us, b->ids, b->time_us);
+	if (order)
+		return order;
+	return (a->record < b->record) ? -1 : (a->record > b->record);
+}
+
+
+/**
+ * Get the order in which records are to be written (NULL if out of memory).
+ */
+static uint64_t *
+trace_writer_get_order(trace_writer_t *writer)
+{
+	uint64_t n = writer->num_records;
+	uint64_t *order = malloc((n ? n : 1) * sizeof(uint64_t));
+	if (!order)
+		return NULL;
+	
+	if (writer->sorted) {
+		for (uint64_t i = 0; i < n; i++)
+			order[i] = i;
+		return order;
+	}
+	
+	trace_sort_key_t *keys = malloc((n ? n : 1) * sizeof(trace_sort_key_t));
+	if (!keys) {
+		free(order);
+		return NULL;
+	}
+	for (uint64_t i = 0; i < n; i++) {
+		keys[i].ids[0] = writer->ids[(2*i) + 0];
+		keys[i].ids[1] = writer->ids[(2*i) + 1];
+		keys[i].time_us = writer->time_us[i];
+		keys[i].record = i;
+	}
+	qsort(keys, n, sizeof(trace_sort_key_t), trace_sort_key_compare);
+	for (uint64_t i = 0; i < n; i++)
+		order[i] = keys[i].record;
+	free(keys);
+	
+	return order;
+}
+
+
+int
+trace_writer_write(trace_writer_t *writer, const char *path)
+{
+	uint64_t n = writer->num_records;
+	uint64_t *order = trace_writer_get_order(writer);
+	if (!order)
+		return -1;
+	
+	// Build the series index
+	uint32_t num_series = 0;
+	trace_series_t *index = malloc((n ? n : 1) * sizeof(trace_series_t));
+	if (!index) {
+		free(order);
+		return -1;
+	}
+	for (uint64_t i = 0; i < n; i++) {
+		const int32_t *ids = &(writer->ids[2*order[i]]);
+		if ( num_series == 0
+		     || index[num_series-1].id_a != ids[0]
+		     || index[num_series-1].id_b != ids[1]
+		   ) {
+			index[num_series].id_a = ids[0];
+			index[num_series].id_b = ids[1];
+			index[num_series].first = i;
+			index[num_series].count = 0;
+			num_series++;
+		}
+		index[num_series-1].count++;
+	}
+	
+	// Write to a temporary file and move it into place once complete
+	size_t tmp_path_len = strlen(path) + 5;
+	char *tmp_path = malloc(tmp_path_len);
+	if (!tmp_path) {
+		free(order);
+		free(index);
+		return -1;
+	}
+	snprintf(tmp_path, tmp_path_len, "%s.tmp", path);
+	
+	FILE *f = fopen(tmp_path, "wb");
+	int error = !f;
+	if (f) {
+		trace_header_t header = { TRACE_MAGIC, TRACE_VERSION
+		                        , writer->num_fields, num_series, n
+		                        };
+		error |= fwrite(&header, sizeof(header), 1, f) != 1;
+		error |= fwrite(writer->field_names, TRACE_FIELD_NAME_LEN, writer->num_fields, f)
+		         != writer->num_fields;
+		error |= fwrite(index, sizeof(trace_series_t), num_series, f) != num_series;
+		
+		for (uint64_t i = 0; i < n && !error; i++)
+			error |= fwrite(&(writer->time_us[order[i]]), sizeof(int64_t), 1, f) != 1;
+		
+		for (uint32_t field = 0; field < writer->num_fields; field++)
+			for (uint64_t i = 0; i < n && !error; i++)
+				error |= fwrite( &(writer->fields[(order[i] * writer->num_fields) + field])
+				               , sizeof(int32_t), 1, f
+				               ) != 1;
+		
+		error |= fclose(f) != 0;
+		error = error || rename(tmp_path, path) != 0;
+		if (error)
+			unlink(tmp_path);
+	}
+	
+	free(tmp_path);
+	free(order);
+	free(index);
+	return error ? -1 : 0;
+}
+
+
+void
+trace_writer_free(trace_writer_t *writer)
+{
+	if (!writer)
+		return;
+	free(writer->field_names);
+	free(writer->ids);
+	free(writer->time_us);
+	free(writer->fields);
+	free(writer);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+int
+trace_open(trace_file_t *trace, const char *path)
+{
+	memset(trace, 0, sizeof(trace_file_t));
+	
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(trace_header_t)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	
+	trace->map_size = st.st_size;
+	trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (trace->map == MAP_FAILED) {
+		trace->map = NULL;
+		return -1;
+	}
+	
+	const char *base = trace->map;
+	trace->header = (const trace_header_t *)base;
+	const trace_header_t *h = trace->header;
+	
+	size_t names_offset  = sizeof(trace_header_t);
+	size_t index_offset  = names_offset + ((size_t)h->num_fields * TRACE_FIELD_NAME_LEN);
+	size_t time_offset   = index_offset + ((size_t)h->num_series * sizeof(trace_series_t));
+	size_t fields_offset = time_offset + ((size_t)h->num_records * sizeof(int64_t));
+	size_t expected_size = fields_offset
+	                     + ((size_t)h->num_records * h->num_fields * sizeof(int32_t));
+	
+	if ( h->magic != TRACE_MAGIC
+	     || h->version != TRACE_VERSION
+	     || expected_size != trace->map_size
+	   ) {
+		trace_close(trace);
+		errno = EINVAL;
+		return -1;
+	}
+	
+	trace->field_names = (const void *)(base + names_offset);
+	trace->index       = (const trace_series_t *)(base + index_offset);
+	trace->time_us     = (const int64_t *)(base + time_offset);
+	trace->fields      = (const int32_t *)(base + fields_offset);
+	
+	return 0;
+}
+
+
+void
+trace_close(trace_file_t *trace)
+{
+	if (trace->map)
+		munmap(trace->map, trace->map_size);
+	memset(trace, 0, sizeof(trace_file_t));
+}
+
+
+int
+trace_field_index(const trace_file_t *trace, const char *name)
+{
+	for (uint32_t i = 0; i < trace->header->num_fields; i++)
+		if (strncmp(trace->field_names[i], name, TRACE_FIELD_NAME_LEN) == 0)
+			return i;
+	return -1;
+}
+
+
+const int32_t *
+trace_field(const trace_file_t *trace, uint32_t field)
+{
+	return trace->fields + ((size_t)field * trace->header->num_records);
+}
+
+
+const trace_series_t *
+trace_find_series(const trace_file_t *trace, int32_t id_a, int32_t id_b)
+{
+	// Binary search the (sorted) index
+	uint32_t lo = 0;
+	uint32_t hi = trace->header->num_series;
+	while (lo < hi) {
+		uint32_t mid = lo + ((hi - lo) / 2);
+		const trace_series_t *s = &(trace->index[mid]);
+		if (s->id_a < id_a || (s->id_a == id_a && s->id_b < id_b))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	
+	if ( lo < trace->header->num_series
+	     && trace->index[lo].id_a == id_a
+	     && trace->index[lo].id_b == id_b
+	   )
+		return &(trace->index[lo]);
+	else
+		return NULL;
+}
+
+
+/**
+ * Index of the first record in [first, first+count) with a time no earlier than
+ * the given time.
+ */
+static uint64_t
+trace_lower_bound(const trace_file_t *trace, uint64_t first, uint64_t count, int64_t time_us)
+{
+	uint64_t lo = first;
+	uint64_t hi = first + count;
+	while (lo < hi) {
+		uint64_t mid = lo + ((hi - lo) / 2);
+		if (trace->time_us[mid] < time_us)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+
+uint64_t
+trace_find_time_range( const trace_file_t *trace
+                     , const trace_series_t *series
+                     , int64_t start_us, int64_t end_us
+                     , uint64_t *first
+                     )
+{
+	uint64_t start = trace_lower_bound(trace, series->first, series->count, start_us);
+	uint64_t end   = trace_lower_bound(trace, series->first, series->count, end_us);
+	*first = start;
+	return (end > start) ? end - start : 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * A (host-side) library for reading and writing compact, indexed, columnar
+ * binary files of timestamped experimental results ("trace files").
+ *
+ * A trace file holds a number of series, each identified by a pair of integers
+ * (e.g. a chip's x and y coordinates). Each record in a series has a time (in
+ * us) and a fixed set of named 32-bit integer fields. Records are stored
+ * grouped by series and in time order within each series, one column per field,
+ * and the file begins with an index of the series so that a single series (or
+ * a time range within it) can be read without parsing the rest of the file.
+ *
+ * Layout (all values little-endian):
+ *
+ *   trace_header_t
+ *   char field_names[num_fields][TRACE_FIELD_NAME_LEN]
+ *   trace_series_t index[num_series]        (sorted by id_a then id_b)
+ *   int64_t time_us[num_records]
+ *   int32_t field[num_fields][num_records]
+ */
+
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TRACE_MAGIC   0x43525453 // "STRC"
+#define TRACE_VERSION 1
+
+// Maximum length of a field name (including the null terminator)
+#define TRACE_FIELD_NAME_LEN 32
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t num_fields;
+	uint32_t num_series;
+	uint64_t num_records;
+} trace_header_t;
+
+typedef struct {
+	// Identifier for the series
+	int32_t id_a;
+	int32_t id_b;
+	
+	// The index of the series' first record and the number of records
+	uint64_t first;
+	uint64_t count;
+} trace_series_t;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Writing
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A trace under construction. Not intended for public access.
+ */
+typedef struct {
+	uint32_t num_fields;
+	char (*field_names)[TRACE_FIELD_NAME_LEN];
+	
+	// Records in the order they were appended. Each record is (id_a, id_b,
+	// time_us, fields...).
+	uint64_t num_records;
+	uint64_t capacity;
+	int32_t *ids;
+	int64_t *time_us;
+	int32_t *fields;
+	
+	// Have records been appended in (series, time) order so far?
+	int sorted;
+} trace_writer_t;
+
+/**
+ * Create a new, empty trace with the given fields. Returns NULL on failure.
+ */
+trace_writer_t *trace_writer_create(uint32_t num_fields, const char * const *field_names);
+
+/**
+ * Append a record to a series (which is created if it does not exist). Records
+ * may be appended in any order. Returns 0 on success and -1 on failure.
+ */
+int trace_writer_append( trace_writer_t *writer
+                       , int32_t id_a, int32_t id_b
+                       , int64_t time_us
+                       , const int32_t *values
+                       );
+
+/**
+ * Write the records appended so far to a file. The file is written under a
+ * temporary name and then renamed so that readers never see a partial file.
+ * May be called repeatedly (e.g. to checkpoint a long-running recording).
+ * Returns 0 on success and -1 on failure (with errno set).
+ */
+int trace_writer_write(trace_writer_t *writer, const char *path);
+
+/**
+ * Free a trace under construction.
+ */
+void trace_writer_free(trace_writer_t *writer);
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Reading
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A trace file opened for reading (by memory-mapping the file).
+ */
+typedef struct {
+	void *map;
+	size_t map_size;
+	
+	const trace_header_t *header;
+	const char (*field_names)[TRACE_FIELD_NAME_LEN];
+	const trace_series_t *index;
+	const int64_t *time_us;
+	const int32_t *fields;
+} trace_file_t;
+
+/**
+ * Open and validate a trace file. Returns 0 on success and -1 on failure.
+ */
+int trace_open(trace_file_t *trace, const char *path);
+
+/**
+ * Close a trace file.
+ */
+void trace_close(trace_file_t *trace);
+
+/**
+ * Get the index of the named field or -1 if there is no such field.
+ */
+int trace_field_index(const trace_file_t *trace, const char *name);
+
+/**
+ * Get the column of values for the given field (indexed by record number).
+ */
+const int32_t *trace_field(const trace_file_t *trace, uint32_t field);
+
+/**
+ * Find a series or return NULL if it does not exist.
+ */
+const trace_series_t *trace_find_series(const trace_file_t *trace, int32_t id_a, int32_t id_b);
+
+/**
+ * Find the records of a series with times in [start_us, end_us). Sets *first
+ * to the index of the first such record and returns the number of records.
+ */
+uint64_t trace_find_time_range( const trace_file_t *trace
+                              , const trace_series_t *series
+                              , int64_t start_us, int64_t end_us
+                              , uint64_t *first
+                              );
+
+#endif
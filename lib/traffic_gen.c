@@ -0,0 +1,207 @@
+#include <sark.h>
+#include <spin1_api.h>
+
+#include "dor.h"
+#include "traffic_gen.h"
+
+// log2(1 + i/16) for i = 0..16 (16.16 fixed point)
+static const uint TGEN_LOG2_TABLE[17] = {
+	    0,  5732, 11136, 16248, 21098, 25711, 30109, 34312,
+	38336, 42196, 45904, 49472, 52911, 56229, 59434, 62534,
+	65536
+};
+
+// ln(2) (16.16 fixed point)
+#define TGEN_LN2 45426
+
+// The key to broadcast nearest-neighbour packets with
+static uint tgen_key;
+
+// This core's number
+static uint tgen_p;
+
+static uint tgen_use_payload;
+static uint tgen_noise_range;
+
+static uint tgen_pattern = TGEN_PATTERN_REGULAR;
+static uint tgen_width = 1;
+static uint tgen_height = 1;
+
+// Mean timer tick period (us) or zero when idle
+static uint tgen_tick_period = 0;
+static uint tgen_rate = 0;
+
+// In the burst pattern, the number of packets to send per burst is rate *
+// TGEN_BURST_PERIOD / 1000000. The remainder is carried between bursts so that
+// the average rate is exact.
+static uint tgen_burst_remainder = 0;
+
+static uint tgen_num_sent = 0;
+static uint tgen_num_failed = 0;
+
+
+/**
+ * Draw an exponentially distributed interval with the given mean (us).
+ */
+static uint
+tgen_exp_interval(uint mean)
+{
+	// The interval is -mean * ln(u) for u uniform in (0, 1]. Here u = r / 2**32
+	// so -ln(u) = (32 - log2(r)) * ln(2) where log2(r) is found from the position
+	// of the most significant bit plus an interpolated lookup of the following
+	// bits.
+	uint r = spin1_rand() | 1;
+	uint msb = 31 - __builtin_clz(r);
+	uint normalised = r << (31 - msb);
+	uint i = (normalised >> 27) & 0xF;
+	uint frac = (normalised >> 11) & 0xFFFF;
+	uint log2_r = (msb << 16)
+	            + TGEN_LOG2_TABLE[i]
+	            + (((TGEN_LOG2_TABLE[i+1] - TGEN_LOG2_TABLE[i]) * frac) >> 16);
+	
+	return (uint)(((((uint64_t)mean * ((32 << 16) - log2_r) * TGEN_LN2) >> 31) + 1) >> 1);
+}
+
+
+/**
+ * Get the key for the next packet to be sent.
+ */
+static uint
+tgen_next_key(void)
+{
+	uint x, y;
+	if (tgen_pattern == TGEN_PATTERN_HOTSPOT) {
+		x = 0;
+		y = 0;
+	} else if (tgen_pattern == TGEN_PATTERN_UNIFORM) {
+		x = spin1_rand() % tgen_width;
+		y = spin1_rand() % tgen_height;
+	} else {
+		return tgen_key;
+	}
+	
+	// Never target the master
+	if (x == 0 && y == 0 && tgen_p == 1)
+		return TRAFFIC_KEY(x, y, 2-1);
+	else
+		return TRAFFIC_KEY(x, y, tgen_p-1);
+}
+
+
+/**
+ * Send a single packet, counting whether it was sent.
+ */
+static void
+tgen_send(void)
+{
+	if (spin1_send_mc_packet(tgen_next_key(), 0, tgen_use_payload))
+		tgen_num_sent++;
+	else
+		tgen_num_failed++;
+}
+
+
+void
+tgen_initialise(uint my_x, uint my_y, uint my_p, uint use_payload, uint noise_range)
+{
+	tgen_key = NEAREST_NEIGHBOUR_KEY(XY_TO_COLOUR(my_x,my_y), my_p-1);
+	tgen_p = my_p;
+	tgen_use_payload = use_payload;
+	tgen_noise_range = noise_range;
+	tgen_pattern = TGEN_PATTERN_REGULAR;
+	tgen_num_sent = 0;
+	tgen_num_failed = 0;
+	tgen_set_rate(0);
+}
+
+
+void
+tgen_set_pattern(uint pattern, uint width, uint height)
+{
+	tgen_pattern = pattern;
+	tgen_width = MAX(width, 1);
+	tgen_height = MAX(height, 1);
+}
+
+
+void
+tgen_set_rate(uint packets_per_sec)
+{
+	tgen_rate = packets_per_sec;
+	tgen_tick_period = packets_per_sec ? MAX(1000000 / packets_per_sec, 1) : 0;
+	tgen_burst_remainder = 0;
+	
+	// Bursts are not driven by the timer
+	if (tgen_pattern == TGEN_PATTERN_BURST || !tgen_tick_period)
+		spin1_set_timer_tick(TGEN_IDLE_TICK);
+	else
+		spin1_set_timer_tick(tgen_tick_period);
+}
+
+
+uint
+tgen_get_rate(void)
+{
+	return tgen_rate;
+}
+
+
+void
+tgen_on_tick(void)
+{
+	if (!tgen_tick_period || tgen_pattern == TGEN_PATTERN_BURST)
+		return;
+	
+	int tick_period = tgen_tick_period;
+	if (tgen_pattern == TGEN_PATTERN_REGULAR) {
+		tgen_send();
+		
+		// Cause the clock tick to vary randomly
+		if (tgen_noise_range)
+			tick_period += ( spin1_rand()%(2*tgen_noise_range)
+			               - tgen_noise_range
+			               );
+	} else {
+		// Send a packet for every arrival within the minimum tick and then wait
+		// until the next arrival.
+		tick_period = 0;
+		do {
+			tgen_send();
+			tick_period += tgen_exp_interval(tgen_tick_period);
+		} while (tick_period < TGEN_MIN_TICK);
+	}
+	
+	if (tick_period > 0)
+		spin1_set_timer_tick(tick_period);
+	else
+		spin1_set_timer_tick(1);
+}
+
+
+void
+tgen_on_burst(void)
+{
+	if (tgen_pattern != TGEN_PATTERN_BURST || !tgen_rate)
+		return;
+	
+	tgen_burst_remainder += tgen_rate * (TGEN_BURST_PERIOD / 1000);
+	uint num_packets = tgen_burst_remainder / 1000;
+	tgen_burst_remainder %= 1000;
+	
+	while (num_packets--)
+		tgen_send();
+}
+
+
+uint
+tgen_get_num_sent(void)
+{
+	return tgen_num_sent;
+}
+
+
+uint
+tgen_get_num_failed(void)
+{
+	return tgen_num_failed;
+}
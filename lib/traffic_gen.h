@@ -0,0 +1,96 @@
+/**
+ * A simple background traffic generator for SpiNNaker which sends multicast
+ * packets following one of several patterns (see TGEN_PATTERN_*) at a given
+ * rate. Used to load the network in clock synchronisation and latency
+ * experiments.
+ */
+
+#ifndef TRAFFIC_GEN_H
+#define TRAFFIC_GEN_H
+
+// Timer tick used while the generator is idle (rate of zero) so that the
+// application's timer callback continues to be called (us).
+#define TGEN_IDLE_TICK 1000
+
+// Nearest-neighbour broadcasts at a regular rate (with uniform random noise
+// added to each period). The default.
+#define TGEN_PATTERN_REGULAR 0
+
+// Nearest-neighbour broadcasts with exponentially distributed intervals (i.e.
+// a Poisson process).
+#define TGEN_PATTERN_POISSON 1
+
+// Nearest-neighbour broadcasts sent back-to-back in bursts, one burst each time
+// tgen_on_burst is called. The application is responsible for calling
+// tgen_on_burst every TGEN_BURST_PERIOD us, e.g. from a synchronised timer so
+// that bursts from every chip coincide as in a time-stepped neural simulation.
+#define TGEN_PATTERN_BURST 2
+
+// Poisson traffic sent to chip (0,0) across the network.
+#define TGEN_PATTERN_HOTSPOT 3
+
+// Poisson traffic sent to a uniformly random chip in the system.
+#define TGEN_PATTERN_UNIFORM 4
+
+// The period at which tgen_on_burst is expected to be called in the burst
+// pattern (us).
+#define TGEN_BURST_PERIOD 1000
+
+// Shortest timer tick used by the Poisson-based patterns (us). Packets whose
+// intervals would be shorter than this are sent together in a single tick.
+#define TGEN_MIN_TICK 10
+
+/**
+ * Initialise the generator for the core at the given position. Packets carry a
+ * (zero) payload if use_payload is non-zero. In the regular pattern each timer
+ * tick period is perturbed by a uniform random value in (-noise_range,
+ * noise_range) us. The generator starts idle using the regular pattern.
+ */
+void tgen_initialise(uint my_x, uint my_y, uint my_p, uint use_payload, uint noise_range);
+
+/**
+ * Select the traffic pattern (one of TGEN_PATTERN_*). The system size is used
+ * by the uniform pattern to pick destinations. Long-range patterns (hotspot and
+ * uniform) send to the same core number as the sender on the destination chip
+ * except that core 1 on chip (0,0), the master in these experiments, is never
+ * targeted: core 2 is used instead.
+ *
+ * Takes effect from the next call to tgen_set_rate.
+ */
+void tgen_set_pattern(uint pattern, uint width, uint height);
+
+/**
+ * Set the rate at which packets are generated (packets per second, zero to stop
+ * generating packets). Sets the timer tick accordingly.
+ */
+void tgen_set_rate(uint packets_per_sec);
+
+/**
+ * Get the current packet generation rate.
+ */
+uint tgen_get_rate(void);
+
+/**
+ * To be called from the application's timer tick callback. Sends packets (if
+ * not idle) and re-randomises the timer tick period.
+ */
+void tgen_on_tick(void);
+
+/**
+ * To be called every TGEN_BURST_PERIOD us when using the burst pattern. Sends
+ * a burst of packets (if not idle). Does nothing in other patterns.
+ */
+void tgen_on_burst(void);
+
+/**
+ * Get the number of packets sent so far.
+ */
+uint tgen_get_num_sent(void);
+
+/**
+ * Get the number of packets which could not be sent so far because the
+ * outgoing packet queue was full.
+ */
+uint tgen_get_num_failed(void);
+
+#endif
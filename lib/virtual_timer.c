@@ -0,0 +1,221 @@
+// Timer state is shared with the timer ISR and so must only be modified with
+// the timer interrupt masked. Host testbenches may define these to do nothing.
+#ifndef VTIMER_IRQ_DISABLE
+#include <spinnaker.h>
+#include <spin1_api.h>
+#define VTIMER_IRQ_DISABLE()     spin1_irq_disable()
+#define VTIMER_IRQ_RESTORE(cpsr) spin1_mode_restore(cpsr)
+#endif
+
+#include "disciplined_clock.h"
+#include "disciplined_timer.h"
+#include "virtual_timer.h"
+
+// Is (corrected) time a before time b?
+#define VTIMER_BEFORE(a,b) (((dclk_offset_t)((a) - (b))) < 0)
+
+/**
+ * The disciplined clock used as the time reference.
+ */
+static volatile dclk_state_t *vtimer_dclk;
+
+/**
+ * A binary min-heap of active timers ordered by deadline. The timer with the
+ * nearest deadline is at the root, vtimer_heap[0].
+ */
+static vtimer_t *vtimer_heap[VTIMER_MAX_TIMERS];
+static uint32_t vtimer_heap_size = 0;
+
+
+/**
+ * Place a timer at the given heap position.
+ */
+static void
+vtimer_heap_set(uint32_t i, vtimer_t *timer)
+{
+	vtimer_heap[i] = timer;
+	timer->heap_index = i;
+}
+
+
+/**
+ * Move the timer at position i towards the root until the heap property is
+ * restored.
+ */
+static void
+vtimer_sift_up(uint32_t i)
+{
+	vtimer_t *timer = vtimer_heap[i];
+	while (i > 0) {
+		uint32_t parent = (i - 1) / 2;
+		if (!VTIMER_BEFORE(timer->deadline, vtimer_heap[parent]->deadline))
+			break;
+		vtimer_heap_set(i, vtimer_heap[parent]);
+		i = parent;
+	}
+	vtimer_heap_set(i, timer);
+}
+
+
+/**
+ * Move the timer at position i away from the root until the heap property is
+ * restored.
+ */
+static void
+vtimer_sift_down(uint32_t i)
+{
+	vtimer_t *timer = vtimer_heap[i];
+	while (1) {
+		uint32_t child = (2 * i) + 1;
+		if (child >= vtimer_heap_size)
+			break;
+		
+		// Pick the earlier of the two children
+		if ( child + 1 < vtimer_heap_size
+		     && VTIMER_BEFORE(vtimer_heap[child + 1]->deadline, vtimer_heap[child]->deadline)
+		   )
+			child++;
+		
+		if (!VTIMER_BEFORE(vtimer_heap[child]->deadline, timer->deadline))
+			break;
+		vtimer_heap_set(i, vtimer_heap[child]);
+		i = child;
+	}
+	vtimer_heap_set(i, timer);
+}
+
+
+/**
+ * Remove the timer at position i from the heap.
+ */
+static void
+vtimer_heap_remove(uint32_t i)
+{
+	vtimer_heap[i]->heap_index = VTIMER_INACTIVE;
+	
+	// Fill the hole with the last timer in the heap and move it to wherever it
+	// belongs.
+	if (i != --vtimer_heap_size) {
+		vtimer_heap_set(i, vtimer_heap[vtimer_heap_size]);
+		vtimer_sift_up(i);
+		vtimer_sift_down(vtimer_heap[i]->heap_index);
+	}
+}
+
+
+/**
+ * Aim the hardware timer at the nearest deadline (or disable it if no timers
+ * are active).
+ */
+static void
+vtimer_reschedule(void)
+{
+	if (vtimer_heap_size)
+		dtimer_schedule_interrupt_at(vtimer_dclk, vtimer_heap[0]->deadline);
+	else
+		dtimer_cancel_interrupts();
+}
+
+
+void
+vtimer_initialise(volatile dclk_state_t *dclk)
+{
+	vtimer_dclk = dclk;
+	vtimer_heap_size = 0;
+	dtimer_cancel_interrupts();
+}
+
+
+void
+vtimer_init_timer(vtimer_t *timer, vtimer_callback_t callback, uint32_t arg)
+{
+	timer->callback = callback;
+	timer->arg = arg;
+	timer->heap_index = VTIMER_INACTIVE;
+}
+
+
+uint32_t
+vtimer_start(vtimer_t *timer, dclk_time_t first_time, dclk_time_t period)
+{
+	uint32_t cpsr = VTIMER_IRQ_DISABLE();
+	
+	uint32_t was_nearest = timer->heap_index == 0;
+	
+	if (timer->heap_index != VTIMER_INACTIVE)
+		vtimer_heap_remove(timer->heap_index);
+	
+	if (vtimer_heap_size >= VTIMER_MAX_TIMERS) {
+		VTIMER_IRQ_RESTORE(cpsr);
+		return 0;
+	}
+	
+	timer->deadline = first_time;
+	timer->period = period;
+	vtimer_heap_set(vtimer_heap_size++, timer);
+	vtimer_sift_up(timer->heap_index);
+	
+	// Only the hardware timer need be touched if the nearest deadline changed:
+	// either this timer is now the nearest or it was and has been moved later.
+	if (was_nearest || vtimer_heap[0] == timer)
+		vtimer_reschedule();
+	
+	VTIMER_IRQ_RESTORE(cpsr);
+	return 1;
+}
+
+
+void
+vtimer_cancel(vtimer_t *timer)
+{
+	uint32_t cpsr = VTIMER_IRQ_DISABLE();
+	
+	if (timer->heap_index != VTIMER_INACTIVE) {
+		uint32_t was_nearest = timer->heap_index == 0;
+		vtimer_heap_remove(timer->heap_index);
+		if (was_nearest)
+			vtimer_reschedule();
+	}
+	
+	VTIMER_IRQ_RESTORE(cpsr);
+}
+
+
+void
+vtimer_handle_interrupt(void)
+{
+	dclk_time_t now = dclk_get_time(vtimer_dclk);
+	dtimer_measure_latency(now);
+	
+	// Interrupts are brought forward to compensate for interrupt latency so
+	// deadlines this close will not be reached any sooner by rescheduling.
+	dclk_time_t expire_before = now + dtimer_get_latency_compensation();
+	
+	uint32_t cpsr = VTIMER_IRQ_DISABLE();
+	
+	// Expire every timer whose deadline has been reached. Note that the interrupt
+	// may arrive slightly early if the clock was corrected after the hardware
+	// timer was loaded, in which case nothing is expired and the timer is simply
+	// reloaded below.
+	while (vtimer_heap_size && !VTIMER_BEFORE(expire_before, vtimer_heap[0]->deadline)) {
+		vtimer_t *timer = vtimer_heap[0];
+		dclk_time_t deadline = timer->deadline;
+		
+		// Reinsert periodic timers before calling the callback so that the callback
+		// is free to cancel or restart its own timer.
+		if (timer->period) {
+			timer->deadline += timer->period;
+			vtimer_sift_down(0);
+		} else {
+			vtimer_heap_remove(0);
+		}
+		
+		VTIMER_IRQ_RESTORE(cpsr);
+		timer->callback(timer, deadline);
+		cpsr = VTIMER_IRQ_DISABLE();
+	}
+	
+	vtimer_reschedule();
+	
+	VTIMER_IRQ_RESTORE(cpsr);
+}
@@ -0,0 +1,92 @@
+/**
+ * Any number of periodic and one-shot synchronised timers multiplexed onto the
+ * single timer controlled by the disciplined timer library.
+ */
+
+#ifndef VIRTUAL_TIMER_H
+#define VIRTUAL_TIMER_H
+
+#include <stdint.h>
+
+#include "disciplined_clock.h"
+
+
+// The maximum number of timers which may be active at once.
+#ifndef VTIMER_MAX_TIMERS
+#define VTIMER_MAX_TIMERS 32
+#endif
+
+// Value of heap_index for timers which are not active.
+#define VTIMER_INACTIVE ((uint32_t)-1)
+
+struct vtimer;
+
+/**
+ * Callback function called when a timer expires. The time given is the
+ * (corrected) time at which the timer was *supposed* to expire.
+ */
+typedef void (*vtimer_callback_t)(struct vtimer *timer, dclk_time_t time);
+
+/**
+ * A virtual timer. The storage for timers is provided by the user and must
+ * remain valid while the timer is active. Not intended for public access other
+ * than via the arg field.
+ */
+typedef struct vtimer {
+	// The (corrected) time at which the timer is next due to expire
+	dclk_time_t deadline;
+
+	// The period between expiries (in corrected timer ticks) or zero for a
+	// one-shot timer.
+	dclk_time_t period;
+
+	// The function to call on expiry
+	vtimer_callback_t callback;
+
+	// A value for the user's own use
+	uint32_t arg;
+
+	// The position of the timer in the heap of active timers or VTIMER_INACTIVE.
+	uint32_t heap_index;
+} vtimer_t;
+
+
+/**
+ * Initialise the virtual timer system to use the given disciplined clock. No
+ * timers will be active.
+ */
+void vtimer_initialise(volatile dclk_state_t *dclk);
+
+/**
+ * Initialise a timer structure. This must be done once before the timer is
+ * first started.
+ */
+void vtimer_init_timer(vtimer_t *timer, vtimer_callback_t callback, uint32_t arg);
+
+/**
+ * Start a timer which will first expire at the given (corrected) time and from
+ * then onwards at intervals of period (or just once if period is zero). If the
+ * timer is already active it is restarted. Returns zero if VTIMER_MAX_TIMERS
+ * timers are already active and non-zero otherwise.
+ *
+ * All active deadlines must lie within half the range of dclk_time_t of each
+ * other to be ordered correctly.
+ */
+uint32_t vtimer_start(vtimer_t *timer, dclk_time_t first_time, dclk_time_t period);
+
+/**
+ * Stop a timer. Has no effect if the timer is not active.
+ */
+void vtimer_cancel(vtimer_t *timer);
+
+/**
+ * To be called from the disciplined timer's ISR (after the interrupt flag has
+ * been cleared) in place of dtimer_schedule_next_interrupt. Calls the callback
+ * of every timer which has expired and then schedules the next interrupt for
+ * the nearest remaining deadline.
+ *
+ * Callbacks may freely start and cancel timers, including their own.
+ */
+void vtimer_handle_interrupt(void);
+
+#endif
@@ -0,0 +1,253 @@
+/**
+ * A discrete-event model of the spinn_time clock synchronisation experiment
+ * running on a large SpiNNaker system.
+ *
+ * The unmodified spinn_time application (compiled for the host against the
+ * headers in host_emulation/include into a shared object) is run on the
+ * application core (core 1) of every chip of a machine emulated by
+ * host_emulation/emu_machine.c. Each chip's oscillator has a random fixed
+ * frequency offset and a slow sinusoidal wander, and multicast packets are
+ * routed hop-by-hop through the routing tables built by the application's own
+ * setup_routing_tables.
+ *
+ * The traffic generator cores (2 and up) are not run. Instead, the load they
+ * place on each link (nearest-neighbour broadcasts at GEN_PACKETS_PER_SEC from
+ * every generator) is modelled statistically: a packet sent on a link finds it
+ * busy with generator traffic with a probability equal to the link's
+ * utilisation by the generators, in which case it waits for the remainder of a
+ * generator packet.
+ *
+ * Usage:
+ *   network_sim [-d duration_s] [-s seed] [-S sample_period_s] [-g] [-l] [-v] app.so
+ *
+ *   -g  Do not model generator traffic.
+ *   -l  Deliver the slaves' (LED) timer interrupts. Very slow: every slave is
+ *       interrupted every LED_TOGGLE_PERIOD_US.
+ *   -v  Print the output of every core (rather than just the master).
+ *
+ * Every sample period a line is printed to stdout giving the simulated time,
+ * the number of slaves which have received a correction, which are locked and
+ * which have started their LED timers, and the mean absolute, RMS and maximum
+ * absolute error (ns) of the synchronised slaves' clocks relative to the
+ * master's clock.
+ */
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "spin1_api.h"
+
+#include "spinn_time_common.h"
+#include "disciplined_clock.h"
+#include "traffic_gen.h"
+
+#include "emu_machine.h"
+
+
+// Default simulation duration and sample period (s)
+#define DEFAULT_DURATION      600.0
+#define DEFAULT_SAMPLE_PERIOD 1.0
+
+// Range of each chip's fixed frequency offset (+/- ppm). Note that spinn_time
+// ignores corrections of more than 1000 ticks so a slave whose clock runs more
+// than 80 ppm fast or slow relative to the master (at the default
+// UPDATE_INTERVAL) will never synchronise.
+#define MAX_FREQ_OFFSET_PPM 30.0
+
+// Range of the amplitude (ppm) of each chip's sinusoidal frequency wander and
+// its period (s). The phase of the wander is random.
+#define MAX_WANDER_PPM 0.1
+#define WANDER_PERIOD  (7.0*60.0)
+
+// Time to transmit a single bit over a chip-to-chip link (ps) and the size of
+// a multicast packet with and without a payload (bits)
+#define LINK_BIT_PS         4000
+#define PACKET_BITS         40
+#define PACKET_PAYLOAD_BITS 72
+
+// The only core on each chip which runs application code
+#define APP_CORE 1
+
+// Conversion from disciplined clock ticks to ns
+#define TICKS_TO_NS ((1000.0 * TC_DIVIDER_VAL) / EMU_CPU_CLK_MHZ)
+
+
+// The application's function for reading a (copy of a) disciplined clock
+static dclk_time_t (*app_dclk_get_time)(volatile dclk_state_t *state);
+
+
+static void *
+app_symbol(void *symbol, const char *name)
+{
+	if (!symbol) {
+		fprintf(stderr, "Application does not define %s.\n", name);
+		exit(1);
+	}
+	return symbol;
+}
+
+
+/**
+ * The value of a chip's disciplined clock timer (i.e. TIMER_VALUE).
+ */
+static dclk_time_t
+chip_timer_value(emu_core_t *core)
+{
+	emu_core_t *caller = emu_machine_set_current(core);
+	dclk_time_t value = -tc2[TC_COUNT];
+	emu_machine_set_current(caller);
+	return value;
+}
+
+
+/**
+ * Print the current error of every synchronised slave.
+ */
+static void
+sample_errors(double time)
+{
+	dclk_time_t master_time = chip_timer_value(emu_machine_get_core(0, 0, APP_CORE));
+	
+	uint num_synced = 0;
+	uint num_locked = 0;
+	uint num_started = 0;
+	double sum_error = 0.0;
+	double sum_sq_error = 0.0;
+	double max_error = 0.0;
+	
+	for (uint x = 0; x < WIDTH; x++) {
+		for (uint y = 0; y < HEIGHT; y++) {
+			emu_core_t *core = emu_machine_get_core(x, y, APP_CORE);
+			if ((x == 0 && y == 0) || !emu_machine_core_started(core))
+				continue;
+			if (!*(uint *)app_symbol(emu_machine_core_global(core, "result_count"), "result_count"))
+				continue;
+			
+			// Read the slave's clock from a copy of its state
+			dclk_state_t dclk = *(dclk_state_t *)app_symbol(emu_machine_core_global(core, "dclk"), "dclk");
+			emu_core_t *caller = emu_machine_set_current(core);
+			dclk_time_t slave_time = app_dclk_get_time(&dclk);
+			emu_machine_set_current(caller);
+			
+			double error = fabs((dclk_offset_t)(master_time - slave_time) * TICKS_TO_NS);
+			sum_error += error;
+			sum_sq_error += error * error;
+			if (error > max_error)
+				max_error = error;
+			
+			num_synced++;
+			num_locked += dclk.locked != 0;
+			num_started += *(uint *)app_symbol(emu_machine_core_global(core, "started"), "started") != 0;
+		}
+	}
+	
+	printf( "%f\t%u\t%u\t%u\t%f\t%f\t%f\n"
+	      , time
+	      , num_synced
+	      , num_locked
+	      , num_started
+	      , num_synced ? sum_error / num_synced : NAN
+	      , num_synced ? sqrt(sum_sq_error / num_synced) : NAN
+	      , num_synced ? max_error : NAN
+	      );
+	fflush(stdout);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	double duration = DEFAULT_DURATION;
+	double sample_period = DEFAULT_SAMPLE_PERIOD;
+	bool gen_traffic = true;
+	
+	emu_params_t params;
+	emu_machine_initialise_params(&params);
+	params.width = WIDTH;
+	params.height = HEIGHT;
+	params.cores_per_chip = APP_CORE;
+	params.max_offset_ppm = MAX_FREQ_OFFSET_PPM;
+	params.max_wander_ppm = MAX_WANDER_PPM;
+	params.wander_period = WANDER_PERIOD;
+	params.tc1_interrupts = false;
+	params.output = stderr;
+	params.quiet = true;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "d:s:S:glv")) != -1) {
+		if (opt == 'd') {
+			duration = atof(optarg);
+		} else if (opt == 's') {
+			params.seed = strtoull(optarg, NULL, 0);
+		} else if (opt == 'S') {
+			sample_period = atof(optarg);
+		} else if (opt == 'g') {
+			gen_traffic = false;
+		} else if (opt == 'l') {
+			params.tc1_interrupts = true;
+		} else if (opt == 'v') {
+			params.quiet = false;
+		} else {
+			fprintf(stderr, "usage: %s [-d duration_s] [-s seed] [-S sample_period_s] [-g] [-l] [-v] app.so\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "usage: %s [-d duration_s] [-s seed] [-S sample_period_s] [-g] [-l] [-v] app.so\n", argv[0]);
+		return 1;
+	}
+	
+	// Every generator core broadcasts to its nearest neighbours so each link
+	// carries the packets of every generator on the chip.
+	if (gen_traffic && GEN_PACKETS_PER_SEC > 0) {
+		if (GEN_PATTERN == TGEN_PATTERN_HOTSPOT || GEN_PATTERN == TGEN_PATTERN_UNIFORM)
+			fprintf(stderr, "Warning: generator traffic is modelled as nearest-neighbour traffic.\n");
+		params.link_load_bits = GEN_USE_PAYLOAD ? PACKET_PAYLOAD_BITS : PACKET_BITS;
+		params.link_load = (CORES_PER_CHIP - 1) * (double)GEN_PACKETS_PER_SEC
+		                 * params.link_load_bits * LINK_BIT_PS * 1e-12;
+		if (params.link_load >= 1.0) {
+			fprintf(stderr, "Warning: generator traffic saturates the links.\n");
+			params.link_load = 1.0;
+		}
+	}
+	
+	emu_machine_initialise(&params, argv[optind]);
+	app_dclk_get_time = (dclk_time_t (*)(volatile dclk_state_t *))
+		app_symbol(emu_machine_app_function("dclk_get_time"), "dclk_get_time");
+	
+	printf("#sim_time\tnum_synced\tnum_locked\tnum_started\tmean_abs_error\trms_error\tmax_abs_error\n");
+	
+	struct timespec wall_start, wall_end;
+	clock_gettime(CLOCK_MONOTONIC, &wall_start);
+	
+	// Stop at each sample time to measure the clocks
+	for (uint i = 1; i * sample_period <= duration; i++) {
+		if (!emu_machine_run(i * sample_period))
+			break;
+		sample_errors(i * sample_period);
+	}
+	emu_machine_run(duration);
+	
+	clock_gettime(CLOCK_MONOTONIC, &wall_end);
+	double wall = (wall_end.tv_sec - wall_start.tv_sec)
+	            + ((wall_end.tv_nsec - wall_start.tv_nsec) * 1e-9);
+	
+	emu_stats_t stats;
+	emu_machine_get_stats(&stats);
+	fprintf( stderr, "Simulated %f s of a %dx%d system in %f s (%.2fx real time): "
+	                 "%llu events, %llu hops, %llu packets dropped.\n"
+	       , duration, WIDTH, HEIGHT, wall, duration / wall
+	       , (unsigned long long)stats.num_events
+	       , (unsigned long long)stats.num_hops
+	       , (unsigned long long)stats.num_dropped
+	       );
+	
+	return 0;
+}
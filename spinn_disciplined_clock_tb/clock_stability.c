@@ -0,0 +1,638 @@
+/**
+ * Compute the overlapping Allan deviation (ADEV), time deviation (TDEV) and
+ * maximum time interval error (MTIE) of every chip's clock error over a range
+ * of observation intervals (tau) and aggregate them by board.
+ *
+ * The input is a time error series per chip sampled at regular intervals
+ * (tau0): either a trace file (see lib/trace_file.h) such as that produced by
+ * pack_spinn_time_results (whose corrections are the chip's error before each
+ * correction) or a CSV of x,y,num,value lines such as corrections.csv from
+ * read_spinn_time_results.py or the offsets inferred by dclk_replay. Values are
+ * in timer ticks.
+ *
+ * Each chip's series is streamed once, on one of several threads, through
+ * accumulators for each tau = m * tau0 with m = 1, 2, 4, ... up to max_m. These
+ * need the last 3 * max_m samples (as running sums) and, for MTIE, a sliding
+ * window minimum and maximum for each tau. Only each chip's per-tau sums and
+ * maxima are kept, so boards (and the whole machine) are summarised by pooling
+ * them: deviations are computed from the pooled sums of squares and MTIE is the
+ * largest of any chip.
+ *
+ * Usage:
+ *   clock_stability [-f field] [-p tau0_s] [-m max_m] [-j threads] [-c] input
+ *
+ *   -f  The trace file field to analyse (default "correction").
+ *   -p  The sample interval. Defaults to the interval between the records of
+ *       each series in a trace file or 1 s (UPDATE_INTERVAL) for CSV input.
+ *   -m  The largest tau analysed in samples (default 4096).
+ *   -c  Also print the results of every chip.
+ *
+ * Results are printed to stdout with one line per board (identified by the
+ * chip at its origin) and tau, followed by the same for the whole machine
+ * (board -1, -1).
+ */
+
+#include <math.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "trace_file.h"
+
+
+// Default field analysed in trace files
+#define DEFAULT_FIELD "correction"
+
+// Default sample interval for CSV input (s), matching UPDATE_INTERVAL in
+// spinn_time_common.h.
+#define DEFAULT_TAU0 1.0
+
+// Default largest tau (samples). Rounded down to a power of two.
+#define DEFAULT_MAX_M 4096
+
+// Conversion from clock ticks to ns
+#define TICKS_TO_NS 80.0
+
+// Number of chips along each side of the rectangle of chips repeated by
+// (three-board) machines.
+#define TRIAD_SIZE 12
+
+// Given an x and y chip position modulo TRIAD_SIZE, the offset of the board's
+// bottom-left chip from the chip's position subtract its modulo (ported from
+// latency_experiment/gen_b2b_link_count_table.py).
+// Usage: CENTER_OFFSET[y][x][dimension] where dimension is 0 for x and 1 for y.
+static const int CENTER_OFFSET[TRIAD_SIZE][TRIAD_SIZE][2] = {
+	{{+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}},
+	{{+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}},
+	{{+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}},
+	{{+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+4,-4}, {+4,-4}, {+4,-4}, {+4,-4}},
+	{{-4,+4}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+8,+4}, {+8,+4}, {+8,+4}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+8,+4}, {+8,+4}, {+8,+4}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {-4,+4}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+8,+4}, {+8,+4}, {+8,+4}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {-4,+4}, {-4,+4}, {+0,+0}, {+0,+0}, {+0,+0}, {+0,+0}, {+8,+4}, {+8,+4}, {+8,+4}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {-4,+4}, {-4,+4}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+8,+4}, {+8,+4}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {-4,+4}, {-4,+4}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+8,+4}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {-4,+4}, {-4,+4}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+8,+4}},
+	{{-4,+4}, {-4,+4}, {-4,+4}, {-4,+4}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}, {+4,+8}},
+};
+
+// Maximum number of taus (i.e. log2(max_m) + 1)
+#define MAX_SCALES 32
+
+
+// The accumulated statistics of one or more chips for a single tau
+typedef struct {
+	// Sum of squared second differences of the phase (ADEV) and of their
+	// m-sample sums (TDEV), both in ticks squared, and the number of terms.
+	double adev_sum;
+	uint64_t adev_n;
+	double tdev_sum;
+	uint64_t tdev_n;
+	
+	// Largest peak-to-peak error in any window of the tau (ticks)
+	int64_t mtie;
+} tau_stats_t;
+
+// A chip's series of samples and its results
+typedef struct {
+	int32_t x;
+	int32_t y;
+	
+	// The samples (a range of a trace file's column or of the CSV values)
+	const int32_t *values;
+	uint64_t num_values;
+	
+	// Sample interval (s)
+	double tau0;
+	
+	tau_stats_t stats[MAX_SCALES];
+} chip_t;
+
+// A sliding window minimum or maximum: a ring buffer of the samples which may
+// yet become the extreme, in order of arrival.
+typedef struct {
+	uint64_t *index;
+	int64_t *value;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t count;
+} window_extreme_t;
+
+// The streaming state for one chip (reused by a thread for every chip it
+// analyses).
+typedef struct {
+	uint32_t num_scales;
+	
+	// Running sums of the samples: sums[k % ring_size] is the sum of the first
+	// k samples.
+	int64_t *sums;
+	uint64_t ring_size;
+	
+	// Window minima and maxima for each tau
+	window_extreme_t min[MAX_SCALES];
+	window_extreme_t max[MAX_SCALES];
+} accumulators_t;
+
+// Work shared between analysis threads
+typedef struct {
+	chip_t *chips;
+	uint32_t num_chips;
+	uint32_t num_scales;
+	
+	pthread_mutex_t lock;
+	uint32_t next_chip;
+} analysis_work_t;
+
+
+/**
+ * Get the origin (bottom-left chip) of the board containing a chip in a
+ * machine of the given size (in chips).
+ */
+static void
+get_chip_board(int32_t x, int32_t y, int32_t width, int32_t height, int32_t *bx, int32_t *by)
+{
+	int32_t xx = x % TRIAD_SIZE;
+	int32_t yy = y % TRIAD_SIZE;
+	*bx = (((x - xx) + CENTER_OFFSET[yy][xx][0]) + width) % width;
+	*by = (((y - yy) + CENTER_OFFSET[yy][xx][1]) + height) % height;
+}
+
+
+static bool
+window_init(window_extreme_t *window, uint32_t capacity)
+{
+	window->index = malloc(capacity * sizeof(uint64_t));
+	window->value = malloc(capacity * sizeof(int64_t));
+	window->capacity = capacity;
+	window->head = 0;
+	window->count = 0;
+	return window->index && window->value;
+}
+
+
+static void
+window_free(window_extreme_t *window)
+{
+	free(window->index);
+	free(window->value);
+}
+
+
+/**
+ * Add sample k to a window of m + 1 samples, discarding samples which have left
+ * the window or can no longer be its extreme. If sign is 1 the window's
+ * maximum is tracked, if -1 its minimum. Returns the extreme.
+ */
+static int64_t
+window_add(window_extreme_t *window, uint64_t k, int64_t value, uint64_t m, int sign)
+{
+	while (window->count && window->index[window->head] + m < k) {
+		window->head = (window->head + 1) % window->capacity;
+		window->count--;
+	}
+	
+	while (window->count) {
+		uint32_t tail = (window->head + window->count - 1) % window->capacity;
+		if ((window->value[tail] - value) * sign > 0)
+			break;
+		window->count--;
+	}
+	
+	uint32_t tail = (window->head + window->count) % window->capacity;
+	window->index[tail] = k;
+	window->value[tail] = value;
+	window->count++;
+	
+	return window->value[window->head];
+}
+
+
+static bool
+accumulators_init(accumulators_t *acc, uint32_t num_scales)
+{
+	bool ok = true;
+	uint64_t max_m = 1ull << (num_scales - 1);
+	acc->num_scales = num_scales;
+	acc->ring_size = (3 * max_m) + 1;
+	acc->sums = malloc(acc->ring_size * sizeof(int64_t));
+	ok &= acc->sums != NULL;
+	for (uint32_t s = 0; s < num_scales; s++) {
+		ok &= window_init(&(acc->min[s]), (1u << s) + 1);
+		ok &= window_init(&(acc->max[s]), (1u << s) + 1);
+	}
+	return ok;
+}
+
+
+static void
+accumulators_free(accumulators_t *acc)
+{
+	free(acc->sums);
+	for (uint32_t s = 0; s < acc->num_scales; s++) {
+		window_free(&(acc->min[s]));
+		window_free(&(acc->max[s]));
+	}
+}
+
+
+/**
+ * Stream a chip's samples through the accumulators.
+ */
+static void
+analyse_chip(accumulators_t *acc, chip_t *chip)
+{
+	memset(chip->stats, 0, sizeof(chip->stats));
+	for (uint32_t s = 0; s < acc->num_scales; s++) {
+		acc->min[s].count = 0;
+		acc->max[s].count = 0;
+	}
+	
+	uint64_t ring_size = acc->ring_size;
+	int64_t *sums = acc->sums;
+	sums[0] = 0;
+	
+	for (uint64_t k = 0; k < chip->num_values; k++) {
+		int64_t x = chip->values[k];
+		int64_t sum = sums[k % ring_size] + x;
+		sums[(k + 1) % ring_size] = sum;
+		
+		for (uint32_t s = 0; s < acc->num_scales; s++) {
+			uint64_t m = 1ull << s;
+			tau_stats_t *stats = &(chip->stats[s]);
+			
+			// MTIE over the last m + 1 samples
+			int64_t max = window_add(&(acc->max[s]), k, x, m, 1);
+			int64_t min = window_add(&(acc->min[s]), k, x, m, -1);
+			if (k >= m && max - min > stats->mtie)
+				stats->mtie = max - min;
+			
+			// ADEV: x[k] - 2x[k-m] + x[k-2m]
+			if (k >= 2 * m) {
+				int64_t x_m  = sums[(k + 1 - m) % ring_size] - sums[(k - m) % ring_size];
+				int64_t x_2m = sums[(k + 1 - (2 * m)) % ring_size] - sums[(k - (2 * m)) % ring_size];
+				double d = (double)(x - (2 * x_m) + x_2m);
+				stats->adev_sum += d * d;
+				stats->adev_n++;
+			}
+			
+			// TDEV: the sum of the m second differences ending at k, i.e. the
+			// second difference of the m-sample sums ending at k.
+			if (k + 1 >= 3 * m) {
+				int64_t w_0  = sum - sums[(k + 1 - m) % ring_size];
+				int64_t w_m  = sums[(k + 1 - m) % ring_size] - sums[(k + 1 - (2 * m)) % ring_size];
+				int64_t w_2m = sums[(k + 1 - (2 * m)) % ring_size] - sums[(k + 1 - (3 * m)) % ring_size];
+				double dw = (double)(w_0 - (2 * w_m) + w_2m);
+				stats->tdev_sum += dw * dw;
+				stats->tdev_n++;
+			}
+		}
+	}
+}
+
+
+static void *
+analysis_thread(void *arg)
+{
+	analysis_work_t *work = arg;
+	
+	accumulators_t acc;
+	if (!accumulators_init(&acc, work->num_scales)) {
+		accumulators_free(&acc);
+		fprintf(stderr, "Out of memory.\n");
+		exit(1);
+	}
+	
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		uint32_t i = work->next_chip++;
+		pthread_mutex_unlock(&work->lock);
+		
+		if (i >= work->num_chips)
+			break;
+		
+		analyse_chip(&acc, &(work->chips[i]));
+	}
+	
+	accumulators_free(&acc);
+	return NULL;
+}
+
+
+/**
+ * Pool the statistics of a chip into an aggregate.
+ */
+static void
+pool_stats(tau_stats_t *pooled, const tau_stats_t *stats, uint32_t num_scales)
+{
+	for (uint32_t s = 0; s < num_scales; s++) {
+		pooled[s].adev_sum += stats[s].adev_sum;
+		pooled[s].adev_n   += stats[s].adev_n;
+		pooled[s].tdev_sum += stats[s].tdev_sum;
+		pooled[s].tdev_n   += stats[s].tdev_n;
+		if (stats[s].mtie > pooled[s].mtie)
+			pooled[s].mtie = stats[s].mtie;
+	}
+}
+
+
+/**
+ * Print a line for every tau with results.
+ */
+static void
+print_stats( const char *scope, int32_t x, int32_t y, uint32_t num_chips
+           , const tau_stats_t *stats, uint32_t num_scales, double tau0
+           )
+{
+	for (uint32_t s = 0; s < num_scales; s++) {
+		if (!stats[s].adev_n)
+			break;
+		
+		double m = (double)(1ull << s);
+		double tau = m * tau0;
+		double tau_ticks = tau * (1e9 / TICKS_TO_NS);
+		
+		// ADEV = sqrt(sum / (2 tau^2 (N - 2m))), TDEV = sqrt(sum / (6 m^2 (N - 3m + 1)))
+		double adev = sqrt(stats[s].adev_sum / (2.0 * stats[s].adev_n)) / tau_ticks;
+		double tdev = stats[s].tdev_n
+		              ? sqrt(stats[s].tdev_sum / (6.0 * m * m * stats[s].tdev_n)) * TICKS_TO_NS
+		              : NAN;
+		
+		printf( "%s\t%d\t%d\t%u\t%g\t%e\t%f\t%f\n"
+		      , scope, x, y, num_chips
+		      , tau
+		      , adev
+		      , tdev // ns
+		      , stats[s].mtie * TICKS_TO_NS // ns
+		      );
+	}
+}
+
+
+/**
+ * Compare CSV lines (x, y, num, value) by chip then number.
+ */
+static int
+compare_lines(const void *a_, const void *b_)
+{
+	const int32_t *a = a_;
+	const int32_t *b = b_;
+	for (int i = 0; i < 3; i++)
+		if (a[i] != b[i])
+			return (a[i] > b[i]) - (a[i] < b[i]);
+	return 0;
+}
+
+
+static int
+compare_chips(const void *a_, const void *b_)
+{
+	const chip_t *a = a_;
+	const chip_t *b = b_;
+	if (a->x != b->x)
+		return (a->x > b->x) - (a->x < b->x);
+	return (a->y > b->y) - (a->y < b->y);
+}
+
+
+/**
+ * Read a CSV of x,y,num,value lines (with a header line) into one series per
+ * chip, sorted by sample number. Returns the chips (whose values point into
+ * *values) or NULL on failure.
+ */
+static chip_t *
+read_csv(const char *filename, double tau0, int32_t **values, uint32_t *num_chips)
+{
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		return NULL;
+	}
+	
+	// Read every line as (x, y, num, value)
+	size_t capacity = 1024;
+	size_t num_lines = 0;
+	int32_t (*lines)[4] = malloc(capacity * sizeof(*lines));
+	char line[256];
+	uint32_t line_num = 0;
+	while (lines && fgets(line, sizeof(line), f)) {
+		line_num++;
+		int32_t l[4];
+		if (sscanf(line, "%d,%d,%d,%d", &l[0], &l[1], &l[2], &l[3]) != 4) {
+			if (line_num == 1)
+				continue;
+			fprintf(stderr, "%s:%u: malformed line\n", filename, line_num);
+			free(lines);
+			lines = NULL;
+			break;
+		}
+		
+		if (num_lines == capacity) {
+			capacity *= 2;
+			int32_t (*grown)[4] = realloc(lines, capacity * sizeof(*lines));
+			if (!grown) {
+				free(lines);
+				lines = NULL;
+				break;
+			}
+			lines = grown;
+		}
+		memcpy(lines[num_lines++], l, sizeof(l));
+	}
+	fclose(f);
+	if (!lines)
+		return NULL;
+	
+	// Sort by chip then number
+	qsort(lines, num_lines, sizeof(*lines), compare_lines);
+	
+	*values = malloc((num_lines ? num_lines : 1) * sizeof(int32_t));
+	chip_t *chips = calloc(num_lines ? num_lines : 1, sizeof(chip_t));
+	if (!*values || !chips) {
+		free(*values);
+		free(chips);
+		free(lines);
+		return NULL;
+	}
+	
+	chip_t *chip = NULL;
+	*num_chips = 0;
+	for (size_t i = 0; i < num_lines; i++) {
+		if (!chip || lines[i][0] != chip->x || lines[i][1] != chip->y) {
+			chip = &(chips[(*num_chips)++]);
+			chip->x = lines[i][0];
+			chip->y = lines[i][1];
+			chip->values = &((*values)[i]);
+			chip->tau0 = tau0;
+		}
+		(*values)[i] = lines[i][3];
+		chip->num_values++;
+	}
+	
+	free(lines);
+	return chips;
+}
+
+
+/**
+ * Get one series per chip from a trace file. Returns NULL on failure.
+ */
+static chip_t *
+read_trace(const trace_file_t *trace, const char *field, double tau0, uint32_t *num_chips)
+{
+	int field_index = trace_field_index(trace, field);
+	if (field_index < 0) {
+		fprintf(stderr, "Trace has no field '%s'.\n", field);
+		return NULL;
+	}
+	const int32_t *column = trace_field(trace, field_index);
+	
+	*num_chips = trace->header->num_series;
+	chip_t *chips = calloc(*num_chips ? *num_chips : 1, sizeof(chip_t));
+	if (!chips)
+		return NULL;
+	
+	for (uint32_t i = 0; i < *num_chips; i++) {
+		const trace_series_t *series = &(trace->index[i]);
+		chip_t *chip = &(chips[i]);
+		chip->x = series->id_a;
+		chip->y = series->id_b;
+		chip->values = &(column[series->first]);
+		chip->num_values = series->count;
+		
+		// Unless given, the interval is the mean interval between records
+		chip->tau0 = tau0;
+		if (isnan(tau0) && series->count > 1)
+			chip->tau0 = ( (trace->time_us[series->first + series->count - 1]
+			              - trace->time_us[series->first])
+			             / (double)(series->count - 1)
+			             ) * 1e-6;
+	}
+	
+	return chips;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	const char *field = DEFAULT_FIELD;
+	double tau0 = NAN;
+	uint64_t max_m = DEFAULT_MAX_M;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	bool print_chips = false;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "f:p:m:j:c")) != -1) {
+		switch (opt) {
+			case 'f': field = optarg; break;
+			case 'p': tau0 = strtod(optarg, NULL); break;
+			case 'm': max_m = strtoull(optarg, NULL, 0); break;
+			case 'j': num_threads = strtol(optarg, NULL, 0); break;
+			case 'c': print_chips = true; break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind != argc - 1 || max_m < 1) {
+		fprintf(stderr, "Usage: %s [-f field] [-p tau0_s] [-m max_m] [-j threads] [-c] input\n"
+		       , argv[0]);
+		return 1;
+	}
+	if (num_threads < 1)
+		num_threads = 1;
+	
+	uint32_t num_scales = 1;
+	while (num_scales < MAX_SCALES && (2ull << (num_scales - 1)) <= max_m)
+		num_scales++;
+	
+	// Trace files are read in place, anything else is treated as CSV
+	trace_file_t trace;
+	bool is_trace = trace_open(&trace, argv[optind]) == 0;
+	int32_t *csv_values = NULL;
+	uint32_t num_chips;
+	chip_t *chips;
+	if (is_trace)
+		chips = read_trace(&trace, field, tau0, &num_chips);
+	else
+		chips = read_csv(argv[optind], isnan(tau0) ? DEFAULT_TAU0 : tau0, &csv_values, &num_chips);
+	if (!chips)
+		return 1;
+	qsort(chips, num_chips, sizeof(chip_t), compare_chips);
+	
+	analysis_work_t work;
+	work.chips = chips;
+	work.num_chips = num_chips;
+	work.num_scales = num_scales;
+	work.next_chip = 0;
+	pthread_mutex_init(&work.lock, NULL);
+	
+	pthread_t threads[num_threads];
+	for (long i = 0; i < num_threads; i++)
+		pthread_create(&(threads[i]), NULL, analysis_thread, &work);
+	for (long i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	
+	// The machine is assumed to be made of whole triads of boards
+	int32_t width = TRIAD_SIZE;
+	int32_t height = TRIAD_SIZE;
+	for (uint32_t i = 0; i < num_chips; i++) {
+		while (chips[i].x >= width)
+			width += TRIAD_SIZE;
+		while (chips[i].y >= height)
+			height += TRIAD_SIZE;
+	}
+	
+	// Pool the chips of each board (indexed by the board's origin) and all chips
+	uint32_t num_boards = width * height;
+	tau_stats_t *board_stats = calloc((size_t)num_boards * MAX_SCALES, sizeof(tau_stats_t));
+	uint32_t *board_chips = calloc(num_boards, sizeof(uint32_t));
+	double *board_tau0 = calloc(num_boards, sizeof(double));
+	tau_stats_t machine_stats[MAX_SCALES];
+	memset(machine_stats, 0, sizeof(machine_stats));
+	if (!board_stats || !board_chips || !board_tau0)
+		return 1;
+	
+	printf("#scope\tx\ty\tchips\ttau\tadev\ttdev\tmtie\n");
+	for (uint32_t i = 0; i < num_chips; i++) {
+		const chip_t *chip = &(chips[i]);
+		if (chip->x < 0 || chip->y < 0)
+			continue;
+		if (print_chips)
+			print_stats("chip", chip->x, chip->y, 1, chip->stats, num_scales, chip->tau0);
+		
+		int32_t bx, by;
+		get_chip_board(chip->x, chip->y, width, height, &bx, &by);
+		uint32_t b = (by * width) + bx;
+		pool_stats(&(board_stats[b * MAX_SCALES]), chip->stats, num_scales);
+		board_chips[b]++;
+		board_tau0[b] = chip->tau0;
+		
+		pool_stats(machine_stats, chip->stats, num_scales);
+	}
+	
+	for (uint32_t b = 0; b < num_boards; b++)
+		if (board_chips[b])
+			print_stats( "board", b % width, b / width, board_chips[b]
+			           , &(board_stats[b * MAX_SCALES]), num_scales, board_tau0[b]
+			           );
+	print_stats( "machine", -1, -1, num_chips, machine_stats, num_scales
+	           , num_chips ? chips[0].tau0 : DEFAULT_TAU0
+	           );
+	
+	free(board_stats);
+	free(board_chips);
+	free(board_tau0);
+	free(chips);
+	free(csv_values);
+	if (is_trace)
+		trace_close(&trace);
+	pthread_mutex_destroy(&work.lock);
+	return 0;
+}
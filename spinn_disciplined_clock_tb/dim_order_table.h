@@ -0,0 +1,187 @@
+/**
+ * Dimension orders to use when routing from (0,0) to each chip in a 12x12
+ * system, ordered by the number of board-to-board links crossed (fewest
+ * first).
+ *
+ * Generated by gen_dim_order_table.py: do not edit by hand.
+ */
+
+#ifndef DIM_ORDER_TABLE_H
+#define DIM_ORDER_TABLE_H
+
+#define DIM_ORDER_TABLE_WIDTH  12
+#define DIM_ORDER_TABLE_HEIGHT 12
+
+// Usage: DIM_ORDER_PREFERENCE[x][y][rank]
+const unsigned char DIM_ORDER_PREFERENCE[12][12][6] = {
+	{ // x = 0
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 1
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 2
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 3
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 4
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{1, 4, 5, 0, 2, 3},
+		{1, 4, 5, 0, 2, 3},
+		{1, 4, 5, 0, 2, 3},
+		{1, 4, 5, 0, 2, 3},
+	},
+	{ // x = 5
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{1, 4, 5, 0, 2, 3},
+		{1, 4, 5, 0, 2, 3},
+		{1, 4, 5, 0, 2, 3},
+	},
+	{ // x = 6
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{1, 4, 5, 0, 2, 3},
+		{1, 4, 5, 0, 2, 3},
+	},
+	{ // x = 7
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{1, 4, 5, 0, 2, 3},
+	},
+	{ // x = 8
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 9
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{3, 4, 5, 0, 1, 2},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 10
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{3, 4, 5, 0, 1, 2},
+		{3, 4, 5, 0, 1, 2},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+	{ // x = 11
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{3, 4, 5, 0, 1, 2},
+		{3, 4, 5, 0, 1, 2},
+		{3, 4, 5, 0, 1, 2},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+		{0, 1, 2, 3, 4, 5},
+	},
+};
+
+#endif
@@ -2,7 +2,13 @@ for X in {0..95}; do
 	for Y in {0..59}; do
 		echo "sp $X $Y"
 		echo "sdump corrections/correction_log_${X}_${Y}.dat 70000000 fa0"
+		echo "sdump corrections/latency_hist_${X}_${Y}.dat 70100000 204"
 	done
 done | ybug 10.2.225.1
 
 python read_spinn_time_results.py 96 60 > corrections.csv
+python read_latency_histograms.py 96 60 > latency_histograms.csv
+
+# Alternatively, for large systems, pack the correction logs into a single
+# indexed trace file (see README.md)
+#./pack_spinn_time_results pack 96 60 corrections corrections.strc
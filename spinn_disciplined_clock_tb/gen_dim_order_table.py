@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+
+"""
+Generate a C header which lists, for every chip in a (non-toroidal) system, the
+dimension orders in order of preference for routing from (0,0). Dimension
+orders which cross the fewest board-to-board links are preferred since these
+links are the slowest and noisiest part of a path. Ties are broken in favour of
+the lower-numbered dimension order.
+
+Usage:
+	python gen_dim_order_table.py [sys_width] [sys_height] > dim_order_table.h
+"""
+
+import os
+import sys
+
+# Re-use the board-to-board link counting from the latency experiment
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                "..", "latency_experiment"))
+from gen_b2b_link_count_table import count_board_to_board_links, DIM_ORDER_INDEX
+
+
+# Get the list of dimension orders to route to a given chip, best first.
+def get_dim_order_preference(x,y):
+	return sorted( range(len(DIM_ORDER_INDEX))
+	             , key = lambda d: (count_board_to_board_links(x,y,d), d)
+	             )
+
+
+if __name__=="__main__":
+	width  = int(sys.argv[1])
+	height = int(sys.argv[2])
+
+	print("/**")
+	print(" * Dimension orders to use when routing from (0,0) to each chip in a %dx%d"%(
+		width, height))
+	print(" * system, ordered by the number of board-to-board links crossed (fewest")
+	print(" * first).")
+	print(" *")
+	print(" * Generated by gen_dim_order_table.py: do not edit by hand.")
+	print(" */")
+	print("")
+	print("#ifndef DIM_ORDER_TABLE_H")
+	print("#define DIM_ORDER_TABLE_H")
+	print("")
+	print("#define DIM_ORDER_TABLE_WIDTH  %d"%width)
+	print("#define DIM_ORDER_TABLE_HEIGHT %d"%height)
+	print("")
+	print("// Usage: DIM_ORDER_PREFERENCE[x][y][rank]")
+	print("const unsigned char DIM_ORDER_PREFERENCE[%d][%d][%d] = {"%(
+		width, height, len(DIM_ORDER_INDEX)))
+	for x in range(width):
+		print("\t{ // x = %d"%x)
+		for y in range(height):
+			print("\t\t{%s},"%(", ".join(map(str, get_dim_order_preference(x,y)))))
+		print("\t},")
+	print("};")
+	print("")
+	print("#endif")
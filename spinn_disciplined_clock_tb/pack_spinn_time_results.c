@@ -0,0 +1,270 @@
+/**
+ * Pack the per-chip correction log dumps produced by dump_drifts.sh into a
+ * single indexed trace file (see lib/trace_file.h) and query the result.
+ *
+ * Dumps are memory-mapped and decoded in parallel. Each chip's corrections
+ * become a series identified by the chip's (x, y) with fields "num" (the
+ * correction number) and "correction" (ticks). Record times are the correction
+ * number multiplied by the update interval.
+ *
+ * Usage:
+ *   pack_spinn_time_results pack width height dump_dir out.strc [update_interval_us [threads]]
+ *   pack_spinn_time_results query trace.strc [x y [start_us end_us]]
+ *
+ * Queries print CSV in the same format as read_spinn_time_results.py.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace_file.h"
+
+// The sentinel at the start of a valid correction log
+#define SENTINEL 0xDEADBEEFu
+
+// Default interval between corrections to a given chip (us), matching
+// UPDATE_INTERVAL in spinn_time_common.h.
+#define DEFAULT_UPDATE_INTERVAL 1000000
+
+#define DEFAULT_NUM_THREADS 8
+
+const char *FIELD_NAMES[] = {"num", "correction"};
+#define NUM_FIELDS 2
+
+
+// The decoded corrections of a single chip
+typedef struct {
+	int x, y;
+	int valid;
+	uint32_t num_corrections;
+	int32_t *corrections;
+} chip_log_t;
+
+// Work shared between decoding threads
+typedef struct {
+	const char *dump_dir;
+	chip_log_t *logs;
+	uint32_t num_logs;
+	
+	pthread_mutex_t lock;
+	uint32_t next_log;
+} decode_work_t;
+
+
+/**
+ * Decode a single chip's correction log dump.
+ */
+void
+decode_log(const char *dump_dir, chip_log_t *log)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/correction_log_%d_%d.dat", dump_dir, log->x, log->y);
+	
+	log->valid = 0;
+	log->num_corrections = 0;
+	log->corrections = NULL;
+	
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return;
+	}
+	
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < 8) {
+		fprintf(stderr, "%s is too short, skipping.\n", path);
+		close(fd);
+		return;
+	}
+	
+	const uint32_t *words = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (words == MAP_FAILED) {
+		fprintf(stderr, "Could not map %s: %s\n", path, strerror(errno));
+		return;
+	}
+	
+	uint32_t num_words = st.st_size / sizeof(uint32_t);
+	if (words[0] != SENTINEL) {
+		fprintf(stderr, "%s has no sentinel, skipping.\n", path);
+	} else {
+		// Always ignore the first value since it is just setting the clock
+		// initially
+		log->num_corrections = num_words - 2;
+		log->corrections = malloc((log->num_corrections ? log->num_corrections : 1) * sizeof(int32_t));
+		if (log->corrections) {
+			memcpy(log->corrections, words + 2, log->num_corrections * sizeof(int32_t));
+			log->valid = 1;
+		}
+	}
+	
+	munmap((void *)words, st.st_size);
+}
+
+
+void *
+decode_thread(void *arg)
+{
+	decode_work_t *work = arg;
+	
+	while (1) {
+		pthread_mutex_lock(&work->lock);
+		uint32_t i = work->next_log++;
+		pthread_mutex_unlock(&work->lock);
+		
+		if (i >= work->num_logs)
+			return NULL;
+		
+		decode_log(work->dump_dir, &(work->logs[i]));
+	}
+}
+
+
+int
+pack( int width, int height, const char *dump_dir, const char *out_path
+    , int64_t update_interval, int num_threads
+    )
+{
+	decode_work_t work;
+	work.dump_dir = dump_dir;
+	work.num_logs = width * height;
+	work.logs = calloc(work.num_logs, sizeof(chip_log_t));
+	work.next_log = 0;
+	pthread_mutex_init(&work.lock, NULL);
+	if (!work.logs)
+		return -1;
+	
+	for (int x = 0; x < width; x++) {
+		for (int y = 0; y < height; y++) {
+			work.logs[(x * height) + y].x = x;
+			work.logs[(x * height) + y].y = y;
+		}
+	}
+	
+	pthread_t threads[num_threads];
+	for (int i = 0; i < num_threads; i++)
+		pthread_create(&(threads[i]), NULL, decode_thread, &work);
+	for (int i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+	
+	// Logs are already in series order so the writer need not sort them
+	trace_writer_t *writer = trace_writer_create(NUM_FIELDS, FIELD_NAMES);
+	int error = !writer;
+	uint32_t num_valid = 0;
+	for (uint32_t i = 0; i < work.num_logs && !error; i++) {
+		chip_log_t *log = &(work.logs[i]);
+		if (!log->valid)
+			continue;
+		num_valid++;
+		
+		for (uint32_t num = 0; num < log->num_corrections && !error; num++) {
+			int32_t values[NUM_FIELDS] = {num, log->corrections[num]};
+			error = trace_writer_append( writer, log->x, log->y
+			                           , num * update_interval, values
+			                           );
+		}
+	}
+	
+	if (!error)
+		error = trace_writer_write(writer, out_path);
+	if (error)
+		fprintf(stderr, "Could not write %s: %s\n", out_path, strerror(errno));
+	else
+		fprintf(stderr, "Packed %u of %u chips.\n", num_valid, work.num_logs);
+	
+	trace_writer_free(writer);
+	for (uint32_t i = 0; i < work.num_logs; i++)
+		free(work.logs[i].corrections);
+	free(work.logs);
+	pthread_mutex_destroy(&work.lock);
+	
+	return error ? -1 : 0;
+}
+
+
+/**
+ * Print the records of a series in the given time range.
+ */
+void
+print_series( const trace_file_t *trace, const trace_series_t *series
+            , int64_t start_us, int64_t end_us
+            , const int32_t *num, const int32_t *correction
+            )
+{
+	uint64_t first;
+	uint64_t count = trace_find_time_range(trace, series, start_us, end_us, &first);
+	for (uint64_t i = first; i < first + count; i++)
+		printf("%d,%d,%d,%d\n", series->id_a, series->id_b, num[i], correction[i]);
+}
+
+
+int
+query(const char *path, int argc, char *argv[])
+{
+	trace_file_t trace;
+	if (trace_open(&trace, path)) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	
+	int num_field        = trace_field_index(&trace, "num");
+	int correction_field = trace_field_index(&trace, "correction");
+	if (num_field < 0 || correction_field < 0) {
+		fprintf(stderr, "%s is not a spinn_time results trace.\n", path);
+		trace_close(&trace);
+		return -1;
+	}
+	const int32_t *num        = trace_field(&trace, num_field);
+	const int32_t *correction = trace_field(&trace, correction_field);
+	
+	int64_t start_us = INT64_MIN;
+	int64_t end_us   = INT64_MAX;
+	if (argc >= 4) {
+		start_us = strtoll(argv[2], NULL, 10);
+		end_us   = strtoll(argv[3], NULL, 10);
+	}
+	
+	printf("x,y,num,correction\n");
+	
+	if (argc >= 2) {
+		const trace_series_t *series = trace_find_series(&trace, atoi(argv[0]), atoi(argv[1]));
+		if (series)
+			print_series(&trace, series, start_us, end_us, num, correction);
+	} else {
+		for (uint32_t i = 0; i < trace.header->num_series; i++)
+			print_series(&trace, &(trace.index[i]), start_us, end_us, num, correction);
+	}
+	
+	trace_close(&trace);
+	return 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	if (argc >= 6 && strcmp(argv[1], "pack") == 0) {
+		int64_t update_interval = (argc > 6) ? strtoll(argv[6], NULL, 10) : DEFAULT_UPDATE_INTERVAL;
+		int num_threads = (argc > 7) ? atoi(argv[7]) : DEFAULT_NUM_THREADS;
+		return pack( atoi(argv[2]), atoi(argv[3]), argv[4], argv[5]
+		           , update_interval, (num_threads > 0) ? num_threads : 1
+		           ) ? 1 : 0;
+	} else if (argc >= 3 && strcmp(argv[1], "query") == 0) {
+		return query(argv[2], argc - 3, argv + 3) ? 1 : 0;
+	} else {
+		fprintf(stderr, "Usage:\n"
+		                "  %s pack width height dump_dir out.strc [update_interval_us [threads]]\n"
+		                "  %s query trace.strc [x y [start_us end_us]]\n"
+		       , argv[0], argv[0]);
+		return 1;
+	}
+}
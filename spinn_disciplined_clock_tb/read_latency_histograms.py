@@ -0,0 +1,36 @@
+#!/usr/bin/env python
+
+"""
+Convert the LED timer latency histogram memory dumps from each chip in the
+system into a CSV of results. Latencies are given in timer ticks and are the
+lower bound of each histogram bin.
+"""
+
+import sys
+import struct
+
+WIDTH  = int(sys.argv[1])
+HEIGHT = int(sys.argv[2])
+
+# Must match disciplined_timer.h
+DTIMER_LATENCY_HIST_BINS      = 64
+DTIMER_LATENCY_HIST_MIN       = -32
+DTIMER_LATENCY_HIST_BIN_WIDTH = 2
+
+print("x,y,type,latency,count")
+
+for x in range(WIDTH):
+	for y in range(HEIGHT):
+		with open("corrections/latency_hist_%d_%d.dat"%(x,y),"rb") as f:
+			# Look for a sentinel value in the first word
+			if f.read(4) != b"\xDE\xAD\xBE\xEF"[::-1]:
+				continue
+			
+			for hist_type in ("uncompensated", "compensated"):
+				counts = struct.unpack("<%dI"%DTIMER_LATENCY_HIST_BINS,
+				                       f.read(4*DTIMER_LATENCY_HIST_BINS))
+				for i, count in enumerate(counts):
+					print("%d,%d,%s,%d,%d"%(
+						x, y, hist_type,
+						DTIMER_LATENCY_HIST_MIN + (i*DTIMER_LATENCY_HIST_BIN_WIDTH),
+						count))
@@ -6,11 +6,18 @@
 #include <spin1_api.h>
 
 #include "spinn_time_common.h"
+#include "dim_order_table.h"
+
+#if (DIM_ORDER_TABLE_WIDTH != WIDTH) || (DIM_ORDER_TABLE_HEIGHT != HEIGHT)
+#error "dim_order_table.h does not match the system size: regenerate it using gen_dim_order_table.py"
+#endif
 
 // XXX: Makefile is not very good...
 #include "dor.c"
 #include "disciplined_clock.c"
 #include "disciplined_timer.c"
+#include "traffic_gen.c"
+#include "piggyback_sync.c"
 
 // The position of this chip in the system
 uint my_x = -1;
@@ -22,29 +29,89 @@ uint my_p = -1;
 ////////////////////////////////////////////////////////////////////////////////
 
 
+// Publish the number of packets sent (and not sent due to a full queue) in
+// the core's VCPU block for inspection by the host.
+void
+update_gen_counters(void)
+{
+	sark.vcpu->user0 = tgen_get_num_sent();
+	sark.vcpu->user1 = tgen_get_num_failed();
+}
+
+
 void
 on_gen_tick(uint _1, uint _2)
 {
-	// Broadcast to nearest neighbours
-	spin1_send_mc_packet(NEAREST_NEIGHBOUR_KEY(XY_TO_COLOUR(my_x,my_y),my_p-1), 0, GEN_USE_PAYLOAD);
-	
-	// Cause the clock tick to vary randomly
-	int tick_period = GEN_TIMER_TICK
-	                + ( spin1_rand()%(2*GEN_TIMER_NOISE_RANGE)
-	                  - GEN_TIMER_NOISE_RANGE
-	                  )
-	                ;
-	if (tick_period > 0)
-		spin1_set_timer_tick(tick_period);
-	else
-		spin1_set_timer_tick(1);
+	tgen_on_tick();
+	update_gen_counters();
 }
 
 
 void
-on_gen_mc_packet(uint _1, uint _2)
+on_gen_mc_packet(uint key, uint _1)
 {
-	// Simply ignore the packet
+	// Bursts are triggered by the slave on this chip, other packets are simply
+	// ignored.
+	if (key == LOCAL_BROADCAST_KEY) {
+		tgen_on_burst();
+		update_gen_counters();
+	}
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Packet Timestamping
+////////////////////////////////////////////////////////////////////////////////
+
+// Sync packets are received by a FIQ handler which records their arrival time
+// (rather than that at which a callback eventually gets to run) and queues them
+// here for processing by a user event callback. Only the FIQ handler advances
+// rx_ring_head and only the callback advances rx_ring_tail.
+typedef struct {
+	uint key;
+	uint payload;
+	uint time;
+} rx_packet_t;
+
+volatile rx_packet_t rx_ring[RX_RING_SIZE];
+volatile uint rx_ring_head = 0;
+volatile uint rx_ring_tail = 0;
+
+
+// Queue a packet received at the given (raw timer) time. Called from FIQ.
+void
+rx_ring_push(uint key, uint payload, uint time)
+{
+	if (rx_ring_head - rx_ring_tail >= RX_RING_SIZE) {
+		// Publish the number of packets dropped for inspection by the host
+		sark.vcpu->user2++;
+		return;
+	}
+	
+	volatile rx_packet_t *packet = &(rx_ring[rx_ring_head % RX_RING_SIZE]);
+	packet->key = key;
+	packet->payload = payload;
+	packet->time = time;
+	rx_ring_head++;
+	
+	// Fails harmlessly if an event is already pending: it will drain the ring
+	spin1_trigger_user_event(0, 0);
+}
+
+
+// Take the oldest packet from the ring. Returns FALSE if it is empty.
+uint
+rx_ring_pop(rx_packet_t *packet)
+{
+	if (rx_ring_tail == rx_ring_head)
+		return FALSE;
+	
+	volatile rx_packet_t *next = &(rx_ring[rx_ring_tail % RX_RING_SIZE]);
+	packet->key = next->key;
+	packet->payload = next->payload;
+	packet->time = next->time;
+	rx_ring_tail++;
+	return TRUE;
 }
 
 
@@ -55,97 +122,426 @@ on_gen_mc_packet(uint _1, uint _2)
 // The current drift of the hardware counter/timer.
 int drift = 0;
 
-// Log the drift over time in SDRAM.
+// Log the drift over time in SDRAM. The number of corrections applied and the
+// number logged (see slave_log_correction) differ by those made while fast
+// locking.
 int *result_log;
 uint result_count = 0;
+uint num_logged = 0;
+
+// Have the LED interrupts been started?
+uint started = FALSE;
 
 // Disciplined clock algorithm state
 dclk_state_t dclk;
 
+// Piggybacked time transfer state (used in PIGGYBACK_SYNC mode)
+psync_state_t psync;
+
 dclk_time_t
 dclk_read_raw_time(void)
 {
 	return TIMER_VALUE;
 }
 
+void slave_add_correction(int correction, uint key);
+void slave_log_correction(int correction);
+
+// Fast lock state (see FAST_LOCK_MEASUREMENTS): whether this slave is still
+// fast locking (and so ignoring the master's corrections) or will stop at the
+// next period, the number of periods and timer ticks so far and the number of
+// bursts which have been answered.
+uint fast_locking = FAST_LOCK_MEASUREMENTS != 0;
+uint fast_lock_done = FALSE;
+uint fast_lock_periods = 0;
+uint fast_lock_ticks = 0;
+uint fast_lock_num_answered = 0;
+
+// The current burst: the number of replies received, whether a request is in
+// flight (and the raw time it was sent) and, for the reply with the shortest
+// roundtrip so far, the raw time it arrived, the offset of the master's time
+// from the raw time and the correction to the clock.
+volatile uint fast_lock_num_replies = 0;
+volatile uint fast_lock_in_flight = FALSE;
+volatile dclk_time_t fast_lock_send_time;
+volatile dclk_time_t fast_lock_min_roundtrip;
+volatile dclk_time_t fast_lock_recv_time;
+volatile dclk_offset_t fast_lock_offset;
+volatile dclk_offset_t fast_lock_correction;
+
+// The first measurement and the sums of the later measurements' times and
+// offsets (relative to the first) in each half of the measurements.
+dclk_time_t fast_lock_first_time;
+dclk_offset_t fast_lock_first_offset;
+int64_t fast_lock_sum_time[2] = {0, 0};
+int64_t fast_lock_sum_offset[2] = {0, 0};
+int64_t fast_lock_num[2] = {0, 0};
+
+
+// Send a request for the master's time. Called with the FIQ disabled (or from
+// the FIQ handler).
+void
+fast_lock_send_request(void)
+{
+	spin1_send_mc_packet( FAST_LOCK_REQUEST_KEY(my_x, my_y, DIM_ORDER_PREFERENCE[my_x][my_y][0])
+	                    , 0
+	                    , TRUE
+	                    );
+	fast_lock_send_time = dclk_read_raw_time();
+	fast_lock_in_flight = TRUE;
+}
+
+
+// Handle the master's reply to a fast lock request. Called from FIQ.
+void
+fast_lock_on_reply(uint payload)
+{
+	dclk_time_t recv_time = dclk_read_raw_time();
+	dclk_time_t now = dclk_peek_time(&dclk);
+	
+	// Ignore replies to requests given up on
+	if (!fast_lock_in_flight)
+		return;
+	fast_lock_in_flight = FALSE;
+	
+	dclk_time_t roundtrip = recv_time - fast_lock_send_time;
+	if (fast_lock_num_replies == 0 || roundtrip < fast_lock_min_roundtrip) {
+		fast_lock_min_roundtrip = roundtrip;
+		fast_lock_recv_time = recv_time;
+		fast_lock_offset = PL_TO_CORRECTION(payload + (roundtrip / 2) - recv_time);
+		fast_lock_correction = PL_TO_CORRECTION(payload + (roundtrip / 2) - now);
+	}
+	
+	if (++fast_lock_num_replies < FAST_LOCK_BURST)
+		fast_lock_send_request();
+}
+
+
+// Record the offset of the master's time from the raw time measured at the
+// given raw time.
+void
+fast_lock_measure(dclk_time_t time, dclk_offset_t offset)
+{
+	if (fast_lock_num_answered == 0) {
+		fast_lock_first_time = time;
+		fast_lock_first_offset = offset;
+	}
+	
+	uint half = (fast_lock_num_answered * 2) >= FAST_LOCK_MEASUREMENTS;
+	fast_lock_sum_time[half] += (int)(time - fast_lock_first_time);
+	fast_lock_sum_offset[half] += offset - fast_lock_first_offset;
+	fast_lock_num[half]++;
+}
+
+
+// Set the clock's phase and frequency from the measurements. The frequency is
+// the slope between the mean measurement of each half.
+void
+fast_lock_seed(void)
+{
+	int64_t n0 = fast_lock_num[0];
+	int64_t n1 = fast_lock_num[1];
+	dclk_fp_freq_t freq = (dclk_fp_freq_t)
+		( ((fast_lock_sum_offset[1] * n0 - fast_lock_sum_offset[0] * n1) << DCLK_FP_FREQ_FBITS)
+		/ (fast_lock_sum_time[1] * n0 - fast_lock_sum_time[0] * n1)
+		);
+	
+	// Extrapolate the offset from the second half's mean to now
+	uint cpsr = spin1_fiq_disable();
+	dclk_time_t raw_now = dclk_read_raw_time();
+	int64_t elapsed = (n1 * (int)(raw_now - fast_lock_first_time)) - fast_lock_sum_time[1];
+	dclk_offset_t offset = fast_lock_first_offset
+	                     + ( ( fast_lock_sum_offset[1]
+	                         + ((((int64_t)freq) * elapsed) >> DCLK_FP_FREQ_FBITS)
+	                         )
+	                       / n1
+	                       );
+	dclk_offset_t correction = offset - (dclk_peek_time(&dclk) - raw_now);
+	spin1_mode_restore(cpsr);
+	
+	slave_add_correction( correction
+	                    , XYPD_TO_KEY(my_x, my_y, my_p-1, DIM_ORDER_PREFERENCE[my_x][my_y][0])
+	                    );
+	
+	cpsr = spin1_fiq_disable();
+	dclk_seed_frequency(&dclk, freq);
+	spin1_mode_restore(cpsr);
+}
+
+
+// Timer tick before the LEDs start: once every FAST_LOCK_PERIOD_US (at a point
+// in the period which depends on the chip) take the last burst's measurement
+// or correction and start the next.
+void
+fast_lock_on_tick(void)
+{
+	uint period_ticks = FAST_LOCK_PERIOD_US / FAST_LOCK_TICK_US;
+	if ( !fast_locking
+	     || ((fast_lock_ticks++ + my_x + (my_y * WIDTH)) % period_ticks) != 0
+	   )
+		return;
+	
+	// Leave the rest to the master's scans a period after the last correction
+	// since corrections in quick succession upset the frequency estimate.
+	if (fast_lock_done) {
+		fast_locking = FALSE;
+		spin1_set_timer_tick(0);
+		return;
+	}
+	
+	uint cpsr = spin1_fiq_disable();
+	uint answered = fast_lock_num_replies > 0;
+	dclk_time_t recv_time = fast_lock_recv_time;
+	dclk_offset_t offset = fast_lock_offset;
+	dclk_offset_t correction = fast_lock_correction;
+	
+	// If a request is still unanswered it is probably lost: skip a period so
+	// that a late reply is not taken for the reply to the next request.
+	uint lost = fast_lock_in_flight;
+	fast_lock_in_flight = FALSE;
+	fast_lock_num_replies = 0;
+	spin1_mode_restore(cpsr);
+	
+	if (answered) {
+		if (fast_lock_num_answered < FAST_LOCK_MEASUREMENTS) {
+			fast_lock_measure(recv_time, offset);
+			if (fast_lock_num_answered == FAST_LOCK_MEASUREMENTS - 1)
+				fast_lock_seed();
+		} else {
+			slave_add_correction( correction
+			                    , XYPD_TO_KEY(my_x, my_y, my_p-1, DIM_ORDER_PREFERENCE[my_x][my_y][0])
+			                    );
+		}
+		fast_lock_num_answered++;
+	}
+	
+	fast_lock_done = ( fast_lock_num_answered >= FAST_LOCK_MEASUREMENTS + FAST_LOCK_CORRECTIONS
+	                   || ++fast_lock_periods >= FAST_LOCK_MAX_PERIODS
+	                 );
+	if (!fast_lock_done && !lost) {
+		cpsr = spin1_fiq_disable();
+		fast_lock_send_request();
+		spin1_mode_restore(cpsr);
+	}
+}
+
+
 // Flash the LEDs at a regular interval synchronised by the timer
 void
 on_slave_tick(uint _1, uint _2)
 {
+	// Until the LEDs start, ticks come from the spin1 timer (while fast locking)
+	if (!started) {
+		fast_lock_on_tick();
+		return;
+	}
+	
+	// Ignore a spin1 tick which was still pending when start_slave took over the
+	// timer: it is not an LED toggle.
+	if (!dtimer_interrupt_due())
+		return;
+	
 	spin1_led_control(LED_INV(0));
 	
-	// Set the LED state
+	// Set the LED state. (The timer only reads the clock state so the FIQ
+	// handler may interrupt this.)
 	dclk_time_t now = dtimer_schedule_next_interrupt();
 	dclk_time_t num_toggles = now / LED_TOGGLE_PERIOD_TICKS;
 	spin1_led_control((num_toggles%2) ? LED_ON(0) : LED_OFF(0));
 	
+	// Trigger a burst from the traffic generators on this chip once every burst
+	// period.
+	if ( GEN_PATTERN == TGEN_PATTERN_BURST
+	     && (num_toggles % (TGEN_BURST_PERIOD / LED_TOGGLE_PERIOD_US)) == 0
+	   )
+		spin1_send_mc_packet(LOCAL_BROADCAST_KEY, 0, FALSE);
+	
+	uint cpsr = spin1_fiq_disable();
 	now = dclk_get_time(&dclk);
+	spin1_mode_restore(cpsr);
+	
+	if (PIGGYBACK_SYNC) {
+		// Send this chip's share of application traffic, stamped with its time
+		if ((num_toggles % PIGGYBACK_SEND_TOGGLES) == 0)
+			spin1_send_mc_packet( NEAREST_NEIGHBOUR_KEY(XY_TO_COLOUR(my_x,my_y), my_p-1)
+			                    , psync_stamp(&psync, now)
+			                    , TRUE
+			                    );
+		
+		// Correct the clock from the stamps received from neighbours
+		if ((num_toggles % PIGGYBACK_UPDATE_TOGGLES) == 0) {
+			dclk_offset_t correction;
+			cpsr = spin1_fiq_disable();
+			uint have_correction = psync_get_correction(&psync, &correction);
+			spin1_mode_restore(cpsr);
+			if (have_correction) {
+				slave_add_correction(correction, 0);
+				slave_log_correction(correction);
+			}
+		}
+	}
+	
+	// Precompute the next interrupts' deadlines now the time-critical work is
+	// done (corrections arriving meanwhile recompute them, see
+	// slave_add_correction).
+	dtimer_update_schedule();
 }
 
 
-// Discipline the clock based on corrections from the master
+// Start the LED interrupts at the start time agreed by the master
 void
-on_slave_mc_packet(uint key, uint payload)
+start_slave(dclk_time_t start_time)
+{
+	// Start the timer
+	tc1[TC_CONTROL] &= ~(3 << 2);
+	tc1[TC_CONTROL] |= (TC_DIVIDER << 2);
+	
+	// If the start time has already passed (e.g. because this chip missed the
+	// start time the first time it was sent), start in step with everyone else at
+	// the next LED toggle.
+	uint cpsr = spin1_fiq_disable();
+	dclk_offset_t late = dclk_get_time(&dclk) - start_time;
+	if (late >= 0)
+		start_time += ((late / LED_TOGGLE_PERIOD_TICKS) + 1) * LED_TOGGLE_PERIOD_TICKS;
+	
+	dtimer_start_interrupts(&dclk, start_time, LED_TOGGLE_PERIOD_TICKS);
+	spin1_mode_restore(cpsr);
+	dtimer_update_schedule();
+	started = TRUE;
+	
+	// Any fast lock is abandoned: the timer now only counts LED toggles
+	fast_locking = FALSE;
+	spin1_set_timer_tick(0);
+	
+	#ifdef DEBUG_SLAVE
+	io_printf(IO_BUF, "Starting interrupts at %d (cur time %d).\n"
+	         , start_time
+	         , dclk_get_time(&dclk)
+	         );
+	#endif
+}
+
+
+// Packet FIQ handler on the slave: answer pings immediately with the time of
+// arrival, timestamp piggybacked times from neighbours and the master's replies
+// to fast lock requests and queue everything else for on_slave_rx_event.
+void
+on_slave_mc_packet_fiq(uint key, uint payload)
 {
-	if (payload & PL_PING_BIT) {
-		// Respond to ping with the current time ASAP
-		uint time = dclk_get_time(&dclk);
-		spin1_send_mc_packet(RETURN_KEY(key), time, TRUE);
+	if (IS_NEAREST_NEIGHBOUR_KEY(key)) {
+		if (PIGGYBACK_SYNC)
+			psync_receive(&psync, payload, dclk_peek_time(&dclk));
+	} else if (IS_TIME_PL(payload)) {
+		fast_lock_on_reply(payload);
+	} else if (payload & PL_PING_BIT) {
+		spin1_send_mc_packet(RETURN_KEY(key), dclk_peek_time(&dclk), TRUE);
 	} else {
-		// Apply correction from master
-		if (result_count) {
-			// Sanity check
-			if (PL_TO_CORRECTION(payload) < 1000 && PL_TO_CORRECTION(payload) > -1000)
-				dclk_add_correction(&dclk, PL_TO_CORRECTION(payload));
-			#ifdef DEBUG_SLAVE
-			else
-				io_printf(IO_BUF, "The following correction was ignored:\n.");
-			#endif
-			
-			// Start the interrupts!
-			if (result_count == 1) {
-				// Start the timer
-				tc1[TC_CONTROL] &= ~(3 << 2);
-				tc1[TC_CONTROL] |= (TC_DIVIDER << 2);
-				
-				// Start the LEDs all at the same moment after everyone is due to have
-				// started up (after they have all definately receved two corrections).
-				// Assumes the first dimension order route is appropriate.
-				uint startup_time = 2.5*(WIDTH*HEIGHT*MASTER_TIMER_TICK*sv->cpu_clk/TC_DIVIDER_VAL);
-				dtimer_start_interrupts(&dclk, startup_time, LED_TOGGLE_PERIOD_TICKS);
-				#ifdef DEBUG_SLAVE
-				io_printf(IO_BUF, "Starting interrupts at %d (cur time %d).\n"
-				         , startup_time
-				         , dclk_get_time(&dclk)
-				         );
-				#endif
-			}
-		} else {
-			dclk_correct_phase_now(&dclk, PL_TO_CORRECTION(payload));
-		}
-		
+		rx_ring_push(key, payload, 0);
+	}
+}
+
+
+// Discipline the clock based on a correction (from the master via the given
+// key or, in piggyback mode, from neighbours)
+void
+slave_add_correction(int correction, uint key)
+{
+	uint cpsr = spin1_fiq_disable();
+	if (result_count) {
+		// Sanity check
+		if (correction < 1000 && correction > -1000)
+			dclk_add_correction(&dclk, correction);
 		#ifdef DEBUG_SLAVE
-		io_printf(IO_BUF, "Correction %d received via DOR %d. Corr Freq: 0x%08x. Prd Corrs: 0x%08x\n"
-		         , PL_TO_CORRECTION(payload)
-		         , KEY_TO_D(key)
-		         , dclk.correction_freq
-		         , dclk.correction_phase_accumulator
-		         );
+		else
+			io_printf(IO_BUF, "The following correction was ignored:\n.");
 		#endif
-		if (NUM_CORRECTIONS != 0)
-			*(result_log++) = PL_TO_CORRECTION(payload);
 		
-		// Terminate after enough updates have ocurred
-		if (++result_count > NUM_CORRECTIONS && (NUM_CORRECTIONS != 0))
-			spin1_exit(0);
+		// Keep the learned state of a good lock for the next time the
+		// application is loaded
+		if (dclk_is_locked(&dclk))
+			dclk_save_state(&dclk, DCLK_SAVED_STATE_ADDR, sv->clock_ms);
+		
+		// Report to the master once locked (until a start time arrives)
+		if (!started && dclk_is_locked(&dclk))
+			spin1_send_mc_packet(RETURN_KEY(key), 0, FALSE);
+	} else {
+		dclk_correct_phase_now(&dclk, correction);
+		
+		// Resume from the state saved by a previous run (if any)
+		uint restored = dclk_restore_state( &dclk, DCLK_SAVED_STATE_ADDR
+		                                  , sv->clock_ms, DCLK_SAVED_STATE_MAX_AGE_MS
+		                                  );
+		#ifdef DEBUG_SLAVE
+		io_printf(IO_BUF, "Saved clock state %s.\n", restored ? "restored" : "not found");
+		#else
+		(void)restored;
+		#endif
+	}
+	spin1_mode_restore(cpsr);
+	
+	// Recompute the LED interrupts' deadlines for the corrected clock so that the
+	// timer never has to.
+	if (started)
+		dtimer_update_schedule();
+	
+	#ifdef DEBUG_SLAVE
+	io_printf(IO_BUF, "Correction %d received via DOR %d. Corr Freq: 0x%08x. Prd Corrs: 0x%08x\n"
+	         , correction
+	         , KEY_TO_D(key)
+	         , dclk.correction_freq
+	         , dclk.correction_phase_accumulator
+	         );
+	#endif
+	result_count++;
+}
+
+
+// Log a correction to SDRAM. The log's readers expect one entry per
+// UPDATE_INTERVAL so only the master's (or piggybacked) corrections are logged,
+// never those made while fast locking.
+void
+slave_log_correction(int correction)
+{
+	if (NUM_CORRECTIONS == 0)
+		return;
+	*(result_log++) = correction;
+	
+	// Terminate after enough updates have ocurred
+	if (++num_logged > NUM_CORRECTIONS)
+		spin1_exit(0);
+}
+
+
+// Handle packets from the master (whose corrections are ignored while fast
+// locking)
+void
+on_slave_mc_packet(uint key, uint payload)
+{
+	if (payload & PL_START_BIT) {
+		if (!started)
+			start_slave(PL_TO_START_TIME(payload));
+	} else if (!fast_locking) {
+		slave_add_correction(PL_TO_CORRECTION(payload), key);
+		slave_log_correction(PL_TO_CORRECTION(payload));
 	}
 }
 
+
+// Process the packets queued by on_slave_mc_packet_fiq
+void
+on_slave_rx_event(uint _1, uint _2)
+{
+	rx_packet_t packet;
+	while (rx_ring_pop(&packet))
+		on_slave_mc_packet(packet.key, packet.payload);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Master-Specific Code
 ////////////////////////////////////////////////////////////////////////////////
 
-// A lookup table of dimension orders known to work with each remote core
+// A lookup table of dimension orders known to work with each remote core. Gives
+// an index into the chip's DIM_ORDER_PREFERENCE list.
 unsigned char working_dimension_order [WIDTH][HEIGHT];
 
 // Last destination sent to (on master)
@@ -164,26 +560,100 @@ volatile uint key;
 volatile int  last_error;
 volatile uint got_ping = TRUE;
 
+// Slaves which have reported that their clock is locked
+unsigned char chip_locked [WIDTH][HEIGHT];
+uint num_locked = 0;
+
+// Has the timer been reset at the app start? Until then fast lock requests are
+// not answered.
+volatile uint master_timer_reset = FALSE;
 
+// The start time broadcast to the slaves (once chosen)
+uint start_time_chosen = FALSE;
+uint agreed_start_time;
 
 
-// Packet callback on master
+// Choose the time at which all slaves should start their LED interrupts
 void
-on_master_mc_packet(uint return_key, uint remote_time)
+choose_start_time(void)
+{
+	// Round down so that the time fits in a payload
+	agreed_start_time = (TIMER_VALUE + START_DELAY_TICKS) & ~0x3;
+	start_time_chosen = TRUE;
+	
+	#ifdef DEBUG_MASTER
+	io_printf(IO_BUF, "%d of %d slaves locked, starting at %d (cur time %d).\n"
+	         , num_locked, (WIDTH*HEIGHT) - 1
+	         , agreed_start_time
+	         , TIMER_VALUE
+	         );
+	#endif
+}
+
+
+// Payload-less packet callback on master: a slave reporting that it is locked
+void
+on_master_lock_report(uint return_key, uint _1)
+{
+	uint x = KEY_TO_CHIP_X(return_key);
+	uint y = KEY_TO_CHIP_Y(return_key);
+	if (x >= WIDTH || y >= HEIGHT || chip_locked[x][y])
+		return;
+	
+	chip_locked[x][y] = TRUE;
+	num_locked++;
+	
+	// Start as soon as every slave is ready
+	if (!start_time_chosen && num_locked >= (WIDTH*HEIGHT) - 1)
+		choose_start_time();
+}
+
+
+// Packet FIQ handler on master: answer fast lock requests immediately with
+// the time of arrival and timestamp other replies on arrival and queue them
+// for on_master_rx_event. Piggybacked times from neighbours are ignored.
+void
+on_master_mc_packet_fiq(uint return_key, uint remote_time)
+{
+	if (IS_FAST_LOCK_REQUEST_KEY(return_key)) {
+		if (master_timer_reset)
+			spin1_send_mc_packet(FAST_LOCK_REPLY_KEY(return_key), TIME_TO_PL(TIMER_VALUE), TRUE);
+	} else if (!IS_NEAREST_NEIGHBOUR_KEY(return_key)) {
+		rx_ring_push(return_key, remote_time, TIMER_VALUE);
+	}
+}
+
+
+// Handle a ping reply received at recv_time
+void
+on_master_mc_packet(uint return_key, uint remote_time, uint recv_time)
 {
 	// Reject packets with the wrong key
 	if (RETURN_KEY(key) != return_key)
 		return;
 	
 	// Calculate the approximate error in the remote clock
-	uint recv_time = TIMER_VALUE;
 	uint latency = (recv_time - send_time)/2;
 	remote_time += latency;
 	last_error = (((int)recv_time) - ((int)remote_time));
 	got_ping = TRUE;
 	
 	// Send a correction back
-	spin1_send_mc_packet(key, (~PL_PING_BIT) & last_error, TRUE);
+	spin1_send_mc_packet(key, CORRECTION_TO_PL(last_error), TRUE);
+	
+	// Keep telling slaves the start time (in case they missed it)
+	if (start_time_chosen)
+		spin1_send_mc_packet(key, START_TIME_TO_PL(agreed_start_time), TRUE);
+}
+
+
+// Process the replies queued by on_master_mc_packet_fiq
+void
+on_master_rx_event(uint _1, uint _2)
+{
+	rx_packet_t packet;
+	while (rx_ring_pop(&packet))
+		on_master_mc_packet(packet.key, packet.payload, packet.time);
 }
 
 // Send out pings and corrections to each slave
@@ -195,11 +665,29 @@ on_master_tick(uint _1, uint _2)
 	static uint num_scans = 0;
 	static int total_drift = 0;
 	
-	static int first_run = TRUE;
-	if (first_run) {
+	if (!master_timer_reset) {
 		// Reset the timer on the app start
 		tc2[TC_LOAD] = 0;
-		first_run = FALSE;
+		master_timer_reset = TRUE;
+	}
+	
+	// In piggyback mode, stop scanning once the slaves have started and send
+	// stamped application traffic instead
+	if ( PIGGYBACK_SYNC
+	     && start_time_chosen
+	     && ((int)(TIMER_VALUE - agreed_start_time)) >= 0
+	   ) {
+		static int piggybacking = FALSE;
+		if (!piggybacking) {
+			spin1_set_timer_tick(1000000 / PIGGYBACK_PACKETS_PER_SEC);
+			piggybacking = TRUE;
+		}
+		
+		spin1_send_mc_packet( NEAREST_NEIGHBOUR_KEY(XY_TO_COLOUR(my_x,my_y), my_p-1)
+		                    , psync_stamp(&psync, TIMER_VALUE)
+		                    , TRUE
+		                    );
+		return;
 	}
 	
 	// Try a different DOR if a ping doesn't make it
@@ -226,7 +714,7 @@ on_master_tick(uint _1, uint _2)
 			dest_x = 0;
 			if (++dest_y >= HEIGHT) {
 				dest_y = 0;
-					
+				
 				#ifdef DEBUG_MASTER
 				io_printf( IO_BUF, "Full scan complete at %d, %d updated, %d not responding, total drift = %d @ %d.\n"
 				         , dclk_read_raw_time()
@@ -241,15 +729,26 @@ on_master_tick(uint _1, uint _2)
 				total_drift = 0;
 				num_scans++;
 				spin1_led_control(LED_INV(0));
+				
+				// Don't wait forever for slaves which never lock
+				if (!start_time_chosen && num_scans >= START_BARRIER_TIMEOUT_SCANS)
+					choose_start_time();
 			}
 		}
 	} while (dest_x == 0 && dest_y == 0 && dest_p == 1);
 	
 	// Send an empty packet to the remote to ping back
-	key = XYPD_TO_KEY(dest_x,dest_y,dest_p-1, working_dimension_order[dest_x][dest_y]);
+	key = XYPD_TO_KEY( dest_x,dest_y,dest_p-1
+	                 , DIM_ORDER_PREFERENCE[dest_x][dest_y][working_dimension_order[dest_x][dest_y]]
+	                 );
 	got_ping = FALSE;
+	
+	// Don't let the reply be processed before the send time is recorded (the
+	// FIQ handler may still timestamp it)
+	uint cpsr = spin1_irq_disable();
 	spin1_send_mc_packet(key, PL_PING_BIT, TRUE);
 	send_time = TIMER_VALUE;
+	spin1_mode_restore(cpsr);
 }
 
 
@@ -269,6 +768,10 @@ c_main() {
 	uint traffic_gen = my_p!=1;
 	
 	dclk_initialise_state(&dclk);
+	psync_initialise( &psync
+	                , slave ? PSYNC_STRATUM_NONE : PSYNC_STRATUM_REFERENCE
+	                , NS_TO_FP_TICKS(PIGGYBACK_LATENCY_NS)
+	                );
 	
 	io_printf( IO_BUF, "Starting spinn_time at %d %d %d as %s...\n"
 	         , my_x, my_y, my_p
@@ -279,32 +782,50 @@ c_main() {
 		setup_routing_tables(my_x, my_y, CORES_PER_CHIP);
 	
 	if (traffic_gen) {
-		if (GEN_TIMER_TICK)
-			spin1_set_timer_tick(GEN_TIMER_TICK);
+		tgen_initialise(my_x, my_y, my_p, GEN_USE_PAYLOAD, GEN_TIMER_NOISE_RANGE);
+		tgen_set_pattern(GEN_PATTERN, WIDTH, HEIGHT);
+		tgen_set_rate(GEN_PACKETS_PER_SEC);
+		update_gen_counters();
 		spin1_callback_on(TIMER_TICK, on_gen_tick, 1);
 		spin1_callback_on(MCPL_PACKET_RECEIVED, on_gen_mc_packet, 0);
 		spin1_callback_on(MC_PACKET_RECEIVED,   on_gen_mc_packet, 0);
 	} else if (slave) {
+		if (FAST_LOCK_MEASUREMENTS)
+			spin1_set_timer_tick(FAST_LOCK_TICK_US);
 		spin1_callback_on(TIMER_TICK, on_slave_tick, 1);
-		spin1_callback_on(MCPL_PACKET_RECEIVED, on_slave_mc_packet, 0);
+		spin1_callback_on(MCPL_PACKET_RECEIVED, on_slave_mc_packet_fiq, -1);
+		spin1_callback_on(USER_EVENT, on_slave_rx_event, 0);
 		
-		result_log = (int *)(SDRAM_BASE_BUF);
+		result_log = RESULT_LOG_ADDR;
 		// Add sentinel at start and zero the result array
 		*(result_log++) = 0xDEADBEEF;
 		for (int i = 0; i < NUM_CORRECTIONS; i++)
 			result_log[i] = 0;
+		
+		// Record the LED timer's interrupt latency
+		LATENCY_HIST_ADDR[0] = 0xDEADBEEF;
+		dtimer_record_latency_histograms((dtimer_latency_hist_t *)(LATENCY_HIST_ADDR + 1));
 	} else {
 		spin1_set_timer_tick(MASTER_TIMER_TICK);
 		spin1_callback_on(TIMER_TICK, on_master_tick, 1);
-		spin1_callback_on(MCPL_PACKET_RECEIVED, on_master_mc_packet, 0);
+		spin1_callback_on(MCPL_PACKET_RECEIVED, on_master_mc_packet_fiq, -1);
+		spin1_callback_on(USER_EVENT, on_master_rx_event, 0);
+		spin1_callback_on(MC_PACKET_RECEIVED, on_master_lock_report, 0);
+		
+		// Initialise DOR lookup to start with the dimension order which crosses
+		// the fewest board-to-board links
+		for (int x = 0; x < WIDTH; x++)
+			for (int y = 0; y < HEIGHT; y++)
+				working_dimension_order[x][y] = 0;
 		
-		// Initialise DOR lookup
+		// No slaves have locked yet
 		for (int x = 0; x < WIDTH; x++)
 			for (int y = 0; y < HEIGHT; y++)
-				working_dimension_order[x][y] = DIM_ORDER_XYZ;
+				chip_locked[x][y] = FALSE;
 		
-		// Remove any sentinel in SDRAM left by running the slave...
-		*((uint*)SDRAM_BASE_BUF) = 0;
+		// Remove any sentinels in SDRAM left by running the slave...
+		*((uint*)RESULT_LOG_ADDR) = 0;
+		LATENCY_HIST_ADDR[0] = 0;
 	}
 	
 	// Stop the monitors flashing the LEDs
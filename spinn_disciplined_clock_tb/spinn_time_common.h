@@ -25,16 +25,68 @@
 // Should the packet generator produce packets with paylods?
 #define GEN_USE_PAYLOAD FALSE
 
-// Number of packets to generate per timer tick
+// Number of packets to generate per second (zero if not to generate packets)
 #define GEN_PACKETS_PER_SEC 1000
 
-// The timer tick at which multicast packets are unleashed in packet generators
-// (zero if not to generate packets)
-#define GEN_TIMER_TICK ((GEN_PACKETS_PER_SEC) ? (1000000/GEN_PACKETS_PER_SEC) : 0)
+// Pattern of traffic to generate (one of the TGEN_PATTERN_* options in
+// lib/traffic_gen.h). In the burst pattern, the slave on each chip triggers a
+// burst from every traffic generator on its chip each TGEN_BURST_PERIOD of
+// disciplined time (once its LEDs have started). The master does not run a
+// disciplined timer so the generators on chip (0,0) remain idle.
+#define GEN_PATTERN TGEN_PATTERN_REGULAR
 
 // Range of uniform random noise in timer period
 #define GEN_TIMER_NOISE_RANGE 10
 
+// Once the LEDs have started, should the slaves' clocks be disciplined by
+// timestamps piggybacked on nearest-neighbour application packets (see
+// lib/piggyback_sync.h) rather than by the master's pings? If so, the master
+// stops its scans at the start time and core 1 of every chip (including the
+// master) sends PIGGYBACK_PACKETS_PER_SEC stamped nearest-neighbour packets, as
+// a spiking application sends spikes. Slaves correct their clocks from those
+// they receive once per UPDATE_INTERVAL.
+#define PIGGYBACK_SYNC FALSE
+
+// Number of stamped nearest-neighbour packets sent per second by each chip in
+// piggyback mode. Must divide 1000000/LED_TOGGLE_PERIOD_US.
+#define PIGGYBACK_PACKETS_PER_SEC 1000
+
+// The latency of a nearest-neighbour packet from being stamped by one chip to
+// being timestamped by the FIQ handler of its neighbour (ns)
+#define PIGGYBACK_LATENCY_NS 680
+
+// At startup, should each slave lock quickly using bursts of requests for the
+// master's time of its own rather than waiting for one correction per full
+// scan of the master (zero to disable)? Each burst is FAST_LOCK_BURST requests,
+// one at a time, of which the reply with the shortest roundtrip is used. The
+// offsets measured by the first FAST_LOCK_MEASUREMENTS bursts seed the clock's
+// phase and frequency and the next FAST_LOCK_CORRECTIONS bursts' are added as
+// ordinary corrections (to establish the lock) before the master's scans take
+// over. Slaves give up after FAST_LOCK_MAX_PERIODS periods regardless.
+//
+// Bursts are sent once every FAST_LOCK_PERIOD_US. The master answers requests
+// as they arrive so the period is chosen to keep the requests from every slave
+// within FAST_LOCK_REQUESTS_PER_SEC, but is at least FAST_LOCK_MIN_PERIOD_US so
+// that the measurements span long enough to estimate the frequency.
+#define FAST_LOCK_MEASUREMENTS 8
+#define FAST_LOCK_CORRECTIONS 8
+#define FAST_LOCK_MAX_PERIODS (2 * (FAST_LOCK_MEASUREMENTS + FAST_LOCK_CORRECTIONS))
+#define FAST_LOCK_BURST 4
+#define FAST_LOCK_REQUESTS_PER_SEC 200000
+#define FAST_LOCK_MIN_PERIOD_US 100000
+#define FAST_LOCK_PERIOD_US MAX( FAST_LOCK_MIN_PERIOD_US \
+                               , (WIDTH*HEIGHT*FAST_LOCK_BURST) * (1000000 / FAST_LOCK_REQUESTS_PER_SEC) \
+                               )
+
+#if FAST_LOCK_MEASUREMENTS == 1
+#error "FAST_LOCK_MEASUREMENTS must be zero or at least two (to measure the frequency)"
+#endif
+
+// Interval between the slaves' timer ticks while fast locking (us). Each slave
+// sends its bursts on a different tick of each period to spread the requests
+// arriving at the master.
+#define FAST_LOCK_TICK_US 1000
+
 // Timer for master sending out requests (calculated from UPDATE_INTERVAL,
 // result in us)
 #define MASTER_TIMER_TICK (UPDATE_INTERVAL/(WIDTH*HEIGHT))
@@ -67,13 +119,86 @@
 // Covert the period into a number of clock ticks
 #define LED_TOGGLE_PERIOD_TICKS (((sv->cpu_clk) * (LED_TOGGLE_PERIOD_US)) / TC_DIVIDER_VAL)
 
+// Location of the correction log in SDRAM. The log starts with a 0xDEADBEEF
+// sentinel.
+#define RESULT_LOG_ADDR ((int *)(SDRAM_BASE_BUF))
+
+// Location of the disciplined timer's latency histograms in SDRAM (a
+// dtimer_latency_hist_t preceded by a 0xDEADBEEF sentinel).
+#define LATENCY_HIST_ADDR ((uint *)(SDRAM_BASE_BUF + 0x00100000))
+
+// Location of each slave's saved clock state in SDRAM (a dclk_saved_state_t,
+// see dclk_save_state). Left in place when the application exits so that a
+// restarted slave resumes with its learned frequency and relocks quickly.
+#define DCLK_SAVED_STATE_ADDR ((dclk_saved_state_t *)(SDRAM_BASE_BUF + 0x00200000))
+
+// Saved clock state is stamped with the milliseconds since boot (so a reboot
+// invalidates it) and is only restored if it is at most this old (ms).
+#define DCLK_SAVED_STATE_MAX_AGE_MS (5 * 60 * 1000)
+
 // Read the disciplined timer
 #define TIMER_VALUE (-tc2[TC_COUNT])
 
+// Number of received sync packets (timestamped on arrival by the FIQ handler)
+// which may await processing by the user event callback. Must be a power of
+// two.
+#define RX_RING_SIZE 16
+
 // Defines a bit in the payload indicating a ping request
 #define PL_PING_BIT (1<<31)
 
-// Extract the signed correction from the payload
-#define PL_TO_CORRECTION(pl) ((int)(((uint)(pl))|((((uint)pl))>>30)<<31))
+// Defines a bit in the payload indicating the payload is the agreed start time
+// (rather than a correction)
+#define PL_START_BIT (1<<30)
+
+// Convert a signed correction to/from a (30-bit) payload
+#define CORRECTION_TO_PL(c) (((uint)(c)) & ~(PL_PING_BIT|PL_START_BIT))
+#define PL_TO_CORRECTION(pl) (((int)(((uint)(pl))<<2))>>2)
+
+// Both bits set indicate the payload is the master's time in reply to a fast
+// lock request. Only the bottom 30 bits of the time are sent (as for
+// corrections).
+#define PL_TIME_BITS (PL_PING_BIT|PL_START_BIT)
+#define TIME_TO_PL(t) (PL_TIME_BITS | (((uint)(t)) & ~PL_TIME_BITS))
+#define IS_TIME_PL(pl) ((((uint)(pl)) & PL_TIME_BITS) == PL_TIME_BITS)
+
+// Slaves send fast lock requests on the return version of their key but with
+// this core number (slaves only run on core 1 so it is otherwise unused). The
+// master replies on the slave's key.
+#define FAST_LOCK_REQUEST_P 0xF
+#define FAST_LOCK_REQUEST_KEY(x,y,d) (RETURN_KEY(XYPD_TO_KEY((x),(y),FAST_LOCK_REQUEST_P,(d))))
+#define IS_FAST_LOCK_REQUEST_KEY(k) (KEY_TO_P(k) == FAST_LOCK_REQUEST_P)
+#define FAST_LOCK_REPLY_KEY(k) (RETURN_MASK(k) & ~(0xF << 4))
+
+// Convert a start time to/from a payload. The bottom two bits of the start time
+// must be zero.
+#define START_TIME_TO_PL(t) (PL_START_BIT | (((uint)(t))>>2))
+#define PL_TO_START_TIME(pl) (((uint)(pl))<<2)
+
+// A slave reports to the master (with a payload-less packet) once
+// dclk_is_locked says its clock is locked and the master then broadcasts a
+// start time once every slave has reported. If not all slaves have locked after
+// this many full scans, the master gives up waiting and broadcasts a start time
+// anyway. Locking takes one correction per scan for the correction weights to
+// ramp down (about ten, see DCLK_*_CORRECTION_WEIGHT_STEP) plus
+// DCLK_LOCK_HOLDOFF more so this allows roughly twice that.
+#define START_BARRIER_TIMEOUT_SCANS 30
+
+// Convert master timer ticks (us) into disciplined clock ticks
+#define US_TO_TICKS(us) (((us) * (sv->cpu_clk)) / TC_DIVIDER_VAL)
+
+// Convert ns into (fixed point) disciplined clock ticks
+#define NS_TO_FP_TICKS(ns) ((dclk_fp_phase_t)( (((uint64_t)(ns) * (sv->cpu_clk)) << DCLK_FP_PHASE_FBITS) \
+                                             / (1000 * TC_DIVIDER_VAL) \
+                                             ))
+
+// The number of LED toggles between stamped packets and between corrections
+// in piggyback mode
+#define PIGGYBACK_SEND_TOGGLES (1000000 / (PIGGYBACK_PACKETS_PER_SEC * LED_TOGGLE_PERIOD_US))
+#define PIGGYBACK_UPDATE_TOGGLES (UPDATE_INTERVAL / LED_TOGGLE_PERIOD_US)
+
+// The delay between the master choosing a start time and that time. Allows one
+// full scan (plus a little extra) for the start time to reach every slave.
+#define START_DELAY_TICKS US_TO_TICKS((WIDTH*HEIGHT + 2) * MASTER_TIMER_TICK)
 
 #endif
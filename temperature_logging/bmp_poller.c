@@ -0,0 +1,444 @@
+/**
+ * Poll the temperatures and fan speeds of every board of a large SpiNNaker
+ * machine from its BMPs and record them in a trace file (see
+ * lib/trace_file.h).
+ *
+ * Unlike log_temperatures.sh, every rack's BMP is queried concurrently (from a
+ * single thread using non-blocking UDP sockets and poll()) with a timeout and
+ * limited retries for every request so a slow or unresponsive board cannot
+ * delay the rest of the sweep. Sweeps start at fixed intervals. Boards not
+ * reached by the time the next sweep starts are abandoned (rather than
+ * queued up behind it) and each sweep of a BMP continues from the slot after
+ * the last one queried so that the same boards are not always abandoned.
+ *
+ * Each board's samples form a series identified by (rack, slot) with fields
+ * "temp_top", "temp_btm", "temp_ext0", "temp_ext1" (1/256 degrees C), "fan0",
+ * "fan1" (RPM, -1 if not fitted) and "rtt_us" (the request's round-trip time).
+ * Record times are the time each reply was received (us since the Unix epoch)
+ * so samples can be joined with correction logs recorded against the same
+ * clock. The trace file is rewritten every checkpoint interval and when the
+ * poller exits (after the duration or on SIGINT or SIGTERM).
+ *
+ * Usage:
+ *   bmp_poller [-i interval_s] [-T timeout_ms] [-r retries] [-s slots]
+ *              [-C checkpoint_s] [-d duration_s] out.strc [bmp[:port]...]
+ *
+ * The BMPs are given in rack order (default 10.2.225.0 to 10.2.229.0).
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+
+#include <netdb.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "trace_file.h"
+
+#define DEFAULT_INTERVAL   5.0
+#define DEFAULT_TIMEOUT_MS 500
+#define DEFAULT_RETRIES    2
+#define DEFAULT_SLOTS      24
+#define DEFAULT_CHECKPOINT 60.0
+
+#define MAX_SLOTS 24
+
+// The UDP port BMPs listen for SCP requests on
+#define BMP_PORT "17893"
+
+// SCP command and argument reading a board's ADC (temperatures, voltages and
+// fan speeds) and the return code of a successful command
+#define CMD_BMP_INFO  48
+#define BMP_INFO_ADC  3
+#define RC_OK         0x80
+
+// SDP header fields of a request from the host to a board's BMP
+#define SDP_FLAGS_REPLY 0x87
+#define SDP_TAG_HOST    0xFF
+#define SDP_SRC_HOST    0xFF
+
+// Sizes of the parts of an SCP packet (the UDP payload begins with two bytes
+// of padding)
+#define SDP_PAD_BYTES    2
+#define SDP_HEADER_BYTES 8
+#define SCP_REQUEST_BYTES (SDP_PAD_BYTES + SDP_HEADER_BYTES + 16)
+#define SCP_REPLY_HEADER_BYTES (SDP_PAD_BYTES + SDP_HEADER_BYTES + 4)
+
+// The BMP's ADC information block: ushort adc[8], short t_int[4],
+// short t_ext[4], short fan[4], uint warning, uint shutdown
+#define ADC_INFO_BYTES 48
+#define ADC_T_INT_OFFSET 16
+#define ADC_T_EXT_OFFSET 24
+#define ADC_FAN_OFFSET   32
+
+const char *FIELD_NAMES[] = { "temp_top", "temp_btm", "temp_ext0", "temp_ext1"
+                            , "fan0", "fan1", "rtt_us"
+                            };
+#define NUM_FIELDS 7
+
+const char *DEFAULT_BMPS[] = { "10.2.225.0", "10.2.226.0", "10.2.227.0"
+                             , "10.2.228.0", "10.2.229.0"
+                             };
+#define NUM_DEFAULT_BMPS 5
+
+
+// The BMP of one rack. Requests to a BMP are made one at a time.
+typedef struct {
+	const char *name;
+	int fd;
+	
+	// Slots still to be queried in the current sweep (as a bit mask) and the
+	// slot to start looking for the next one from
+	uint32_t pending;
+	int next_slot;
+	
+	// The outstanding request (if any)
+	int busy;
+	int slot;
+	uint16_t seq;
+	int64_t sent_us;
+	int64_t deadline_us;
+	int retries_left;
+	
+	// Statistics
+	uint64_t num_samples;
+	uint64_t num_timeouts;
+	uint64_t num_skipped;
+} bmp_t;
+
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void
+on_signal(int sig)
+{
+	stop = 1;
+}
+
+
+/**
+ * The current time (us since the Unix epoch).
+ */
+static int64_t
+time_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ((int64_t)ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+
+static void
+put_u16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+}
+
+
+static void
+put_u32(uint8_t *p, uint32_t v)
+{
+	put_u16(p, v & 0xFFFF);
+	put_u16(p + 2, v >> 16);
+}
+
+
+static uint16_t
+get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+/**
+ * Open a (connected) UDP socket to a BMP given as host[:port]. Returns -1 on
+ * failure.
+ */
+static int
+open_bmp(const char *name)
+{
+	char host[256];
+	snprintf(host, sizeof(host), "%s", name);
+	const char *port = BMP_PORT;
+	char *colon = strrchr(host, ':');
+	if (colon) {
+		*colon = '\0';
+		port = colon + 1;
+	}
+	
+	struct addrinfo hints = {0};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	struct addrinfo *addrs;
+	int error = getaddrinfo(host, port, &hints, &addrs);
+	if (error) {
+		fprintf(stderr, "Could not resolve %s: %s\n", name, gai_strerror(error));
+		return -1;
+	}
+	
+	int fd = socket(addrs->ai_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	if (fd >= 0 && connect(fd, addrs->ai_addr, addrs->ai_addrlen) < 0) {
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+		fprintf(stderr, "Could not connect to %s: %s\n", name, strerror(errno));
+	freeaddrinfo(addrs);
+	return fd;
+}
+
+
+/**
+ * Send (or resend) a BMP's outstanding request.
+ */
+static void
+send_request(bmp_t *bmp, int64_t now_us, int timeout_ms)
+{
+	uint8_t packet[SCP_REQUEST_BYTES] = {0};
+	uint8_t *sdp = packet + SDP_PAD_BYTES;
+	sdp[0] = SDP_FLAGS_REPLY;
+	sdp[1] = SDP_TAG_HOST;
+	sdp[2] = bmp->slot; // Port 0 of the board's BMP
+	sdp[3] = SDP_SRC_HOST;
+	
+	uint8_t *scp = sdp + SDP_HEADER_BYTES;
+	put_u16(scp, CMD_BMP_INFO);
+	put_u16(scp + 2, bmp->seq);
+	put_u32(scp + 4, BMP_INFO_ADC);
+	
+	// A failed send is treated like a lost packet
+	send(bmp->fd, packet, sizeof(packet), 0);
+	bmp->sent_us = now_us;
+	bmp->deadline_us = now_us + ((int64_t)timeout_ms * 1000);
+}
+
+
+/**
+ * Start a request to the next pending slot of a BMP (if any).
+ */
+static void
+next_request(bmp_t *bmp, int64_t now_us, int timeout_ms, int retries)
+{
+	if (bmp->busy || !bmp->pending)
+		return;
+	
+	while (!(bmp->pending & (1u << bmp->next_slot)))
+		bmp->next_slot = (bmp->next_slot + 1) % MAX_SLOTS;
+	bmp->slot = bmp->next_slot;
+	bmp->next_slot = (bmp->next_slot + 1) % MAX_SLOTS;
+	bmp->pending &= ~(1u << bmp->slot);
+	bmp->seq++;
+	bmp->busy = 1;
+	bmp->retries_left = retries;
+	send_request(bmp, now_us, timeout_ms);
+}
+
+
+/**
+ * Receive any replies waiting for a BMP, recording those which answer its
+ * outstanding request. Returns 0 on success and -1 on failure.
+ */
+static int
+receive_replies(bmp_t *bmp, int rack, trace_writer_t *writer)
+{
+	uint8_t packet[1024];
+	ssize_t len;
+	while ((len = recv(bmp->fd, packet, sizeof(packet), 0)) >= 0) {
+		int64_t now_us = time_us();
+		
+		// Ignore malformed, failed and stale (e.g. retried) replies
+		if (!bmp->busy || len < SCP_REPLY_HEADER_BYTES + ADC_INFO_BYTES)
+			continue;
+		const uint8_t *scp = packet + SDP_PAD_BYTES + SDP_HEADER_BYTES;
+		if (get_u16(scp) != RC_OK || get_u16(scp + 2) != bmp->seq)
+			continue;
+		
+		const uint8_t *adc = packet + SCP_REPLY_HEADER_BYTES;
+		int32_t values[NUM_FIELDS];
+		values[0] = (int16_t)get_u16(adc + ADC_T_INT_OFFSET);
+		values[1] = (int16_t)get_u16(adc + ADC_T_INT_OFFSET + 2);
+		values[2] = (int16_t)get_u16(adc + ADC_T_EXT_OFFSET);
+		values[3] = (int16_t)get_u16(adc + ADC_T_EXT_OFFSET + 2);
+		values[4] = (int16_t)get_u16(adc + ADC_FAN_OFFSET);
+		values[5] = (int16_t)get_u16(adc + ADC_FAN_OFFSET + 2);
+		values[6] = (int32_t)(now_us - bmp->sent_us);
+		if (trace_writer_append(writer, rack, bmp->slot, now_us, values))
+			return -1;
+		
+		bmp->num_samples++;
+		bmp->busy = 0;
+	}
+	
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED) ? 0 : -1;
+}
+
+
+static void
+usage(const char *name)
+{
+	fprintf( stderr, "usage: %s [-i interval_s] [-T timeout_ms] [-r retries] [-s slots]\n"
+	                 "          [-C checkpoint_s] [-d duration_s] out.strc [bmp[:port]...]\n"
+	       , name);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	double interval = DEFAULT_INTERVAL;
+	int timeout_ms = DEFAULT_TIMEOUT_MS;
+	int retries = DEFAULT_RETRIES;
+	int num_slots = DEFAULT_SLOTS;
+	double checkpoint = DEFAULT_CHECKPOINT;
+	double duration = 0.0;
+	
+	int opt;
+	while ((opt = getopt(argc, argv, "i:T:r:s:C:d:")) != -1) {
+		if (opt == 'i') {
+			interval = atof(optarg);
+		} else if (opt == 'T') {
+			timeout_ms = atoi(optarg);
+		} else if (opt == 'r') {
+			retries = atoi(optarg);
+		} else if (opt == 's') {
+			num_slots = atoi(optarg);
+		} else if (opt == 'C') {
+			checkpoint = atof(optarg);
+		} else if (opt == 'd') {
+			duration = atof(optarg);
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc || interval <= 0.0 || timeout_ms <= 0 || retries < 0
+	    || num_slots < 1 || num_slots > MAX_SLOTS) {
+		usage(argv[0]);
+		return 1;
+	}
+	const char *out_path = argv[optind++];
+	
+	const char **names = DEFAULT_BMPS;
+	int num_bmps = NUM_DEFAULT_BMPS;
+	if (optind < argc) {
+		names = (const char **)(argv + optind);
+		num_bmps = argc - optind;
+	}
+	
+	bmp_t *bmps = calloc(num_bmps, sizeof(bmp_t));
+	struct pollfd *fds = calloc(num_bmps, sizeof(struct pollfd));
+	trace_writer_t *writer = trace_writer_create(NUM_FIELDS, FIELD_NAMES);
+	if (!bmps || !fds || !writer) {
+		fprintf(stderr, "Out of memory.\n");
+		return 1;
+	}
+	for (int i = 0; i < num_bmps; i++) {
+		bmps[i].name = names[i];
+		bmps[i].fd = open_bmp(names[i]);
+		if (bmps[i].fd < 0)
+			return 1;
+		fds[i].fd = bmps[i].fd;
+		fds[i].events = POLLIN;
+	}
+	
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	
+	int64_t interval_us = (int64_t)(interval * 1e6);
+	int64_t checkpoint_us = (int64_t)(checkpoint * 1e6);
+	int64_t start_us = time_us();
+	int64_t end_us = (duration > 0.0) ? start_us + (int64_t)(duration * 1e6) : INT64_MAX;
+	int64_t next_sweep_us = start_us;
+	int64_t next_checkpoint_us = start_us + checkpoint_us;
+	uint32_t all_slots = (1u << num_slots) - 1;
+	
+	int status = 0;
+	while (!stop) {
+		int64_t now_us = time_us();
+		if (now_us >= end_us)
+			break;
+		
+		// Start a new sweep, abandoning boards not reached in the last (the
+		// outstanding request, if any, is left to complete)
+		if (now_us >= next_sweep_us) {
+			for (int i = 0; i < num_bmps; i++) {
+				bmp_t *bmp = &(bmps[i]);
+				bmp->num_skipped += __builtin_popcount(bmp->pending);
+				bmp->pending = all_slots & ~(bmp->busy ? (1u << bmp->slot) : 0);
+			}
+			while (next_sweep_us <= now_us)
+				next_sweep_us += interval_us;
+		}
+		
+		if (checkpoint_us > 0 && now_us >= next_checkpoint_us) {
+			if (trace_writer_write(writer, out_path))
+				fprintf(stderr, "Could not write %s: %s\n", out_path, strerror(errno));
+			next_checkpoint_us = now_us + checkpoint_us;
+		}
+		
+		// Time out or retry outstanding requests and start new ones
+		int64_t wake_us = next_sweep_us;
+		if (end_us < wake_us)
+			wake_us = end_us;
+		for (int i = 0; i < num_bmps; i++) {
+			bmp_t *bmp = &(bmps[i]);
+			if (bmp->busy && now_us >= bmp->deadline_us) {
+				if (bmp->retries_left-- > 0) {
+					send_request(bmp, now_us, timeout_ms);
+				} else {
+					bmp->num_timeouts++;
+					bmp->busy = 0;
+				}
+			}
+			next_request(bmp, now_us, timeout_ms, retries);
+			if (bmp->busy && bmp->deadline_us < wake_us)
+				wake_us = bmp->deadline_us;
+		}
+		
+		int wait_ms = (int)((wake_us - now_us + 999) / 1000);
+		if (poll(fds, num_bmps, wait_ms < 0 ? 0 : wait_ms) < 0) {
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "poll failed: %s\n", strerror(errno));
+			status = 1;
+			break;
+		}
+		for (int i = 0; i < num_bmps; i++) {
+			if (fds[i].revents && receive_replies(&(bmps[i]), i, writer)) {
+				fprintf(stderr, "Could not receive from %s: %s\n", bmps[i].name, strerror(errno));
+				status = 1;
+				stop = 1;
+			}
+		}
+	}
+	
+	if (trace_writer_write(writer, out_path)) {
+		fprintf(stderr, "Could not write %s: %s\n", out_path, strerror(errno));
+		status = 1;
+	}
+	
+	for (int i = 0; i < num_bmps; i++) {
+		fprintf( stderr, "%s: %llu samples, %llu timeouts, %llu skipped.\n"
+		       , bmps[i].name
+		       , (unsigned long long)bmps[i].num_samples
+		       , (unsigned long long)bmps[i].num_timeouts
+		       , (unsigned long long)bmps[i].num_skipped
+		       );
+		close(bmps[i].fd);
+	}
+	
+	trace_writer_free(writer);
+	free(bmps);
+	free(fds);
+	return status;
+}
@@ -0,0 +1,89 @@
+#!/usr/bin/env python
+
+"""
+A stand-in for the BMPs of a large SpiNNaker machine for testing bmp_poller.
+Each rack's BMP listens on its own UDP port (base_port + rack) on localhost and
+answers SCP CMD_BMP_INFO (ADC) requests for any slot with synthetic
+temperatures and fan speeds. Like a real BMP, each rack handles one request at
+a time.
+
+Requests can be delayed (-d, ms, plus up to the same again at random) and
+dropped (-l, probability) to exercise the poller's timeouts and retries.
+
+Usage:
+	python bmp_stub.py [-n racks] [-p base_port] [-d delay_ms] [-l loss]
+"""
+
+import getopt
+import math
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+
+CMD_BMP_INFO = 48
+BMP_INFO_ADC = 3
+RC_OK = 0x80
+RC_ARG = 0x83
+
+# Padding, SDP header and SCP command, sequence number and arguments
+REQUEST = struct.Struct("<2x8BHH3I")
+
+# ushort adc[8], short t_int[4], short t_ext[4], short fan[4], uint warning,
+# uint shutdown
+ADC_INFO = struct.Struct("<8H4h4h4h2I")
+
+
+# Synthetic temperatures (in 1/256 degrees C) and fan speeds of a board which
+# drift slowly with time
+def adc_info(rack, slot, t):
+	base = 35.0 + rack + (0.1 * slot) + (2.0 * math.sin(t / 60.0))
+	t_int = [int((base + i) * 256) for i in range(2)] + [0, 0]
+	t_ext = [int((base - 10.0) * 256), int((base - 12.0) * 256), 0, 0]
+	fan = [2000 + slot, -1, -1, -1]
+	return ADC_INFO.pack(*([0] * 8 + t_int + t_ext + fan + [0, 0]))
+
+
+def serve(rack, port, delay, loss):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.bind(("127.0.0.1", port))
+	while True:
+		data, addr = sock.recvfrom(1024)
+		if len(data) < REQUEST.size:
+			continue
+		fields = REQUEST.unpack_from(data)
+		flags, tag, dest_port_cpu, src_port_cpu = fields[0:4]
+		cmd, seq, arg1 = fields[8:11]
+		slot = dest_port_cpu & 0x1F
+		
+		time.sleep((delay + random.uniform(0, delay)) / 1000.0)
+		if random.random() < loss:
+			continue
+		
+		header = struct.pack("<2x8B", flags, tag, src_port_cpu, dest_port_cpu,
+		                     0, 0, 0, 0)
+		if cmd == CMD_BMP_INFO and arg1 == BMP_INFO_ADC:
+			reply = header + struct.pack("<HH", RC_OK, seq) + adc_info(rack, slot, time.time())
+		else:
+			reply = header + struct.pack("<HH", RC_ARG, seq)
+		sock.sendto(reply, addr)
+
+
+if __name__ == "__main__":
+	opts, args = getopt.getopt(sys.argv[1:], "n:p:d:l:")
+	opts = dict(opts)
+	num_racks = int(opts.get("-n", 5))
+	base_port = int(opts.get("-p", 17893))
+	delay = float(opts.get("-d", 5))
+	loss = float(opts.get("-l", 0))
+	
+	for rack in range(num_racks):
+		thread = threading.Thread(target=serve, args=(rack, base_port + rack, delay, loss))
+		thread.daemon = True
+		thread.start()
+		sys.stderr.write("Rack %d BMP on 127.0.0.1:%d\n"%(rack, base_port + rack))
+	
+	while True:
+		time.sleep(1)
@@ -0,0 +1,338 @@
+/**
+ * A standalone C test bench for the virtual timer library. The disciplined
+ * timer hardware is emulated using a simulated raw clock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+// Many more timers than would fit on a SpiNNaker core
+#define VTIMER_MAX_TIMERS 8192
+
+// Interrupts are not real in the testbench
+#define VTIMER_IRQ_DISABLE()     0
+#define VTIMER_IRQ_RESTORE(cpsr) ((void)(cpsr))
+
+#include "disciplined_clock.c"
+#include "virtual_timer.c"
+
+
+// Number of each type of timer to create
+#define NUM_PERIODIC_TIMERS 4000
+#define NUM_ONE_SHOT_TIMERS 4000
+
+// Range of periods (corrected ticks) for periodic timers. Periods and start
+// times are always even.
+#define MIN_PERIOD 1000
+#define MAX_PERIOD 1000000
+
+// Number of times each one-shot timer re-arms itself from its callback
+#define ONE_SHOT_CHAIN_LENGTH 10
+
+// Every CANCEL_EVERYth periodic timer is cancelled at CANCEL_TIME (which is odd
+// so that no periodic deadline coincides with it).
+#define CANCEL_EVERY 10
+#define CANCEL_TIME  25000001
+
+// Only deadlines up to this (corrected) time are checked
+#define END_TIME 50000000
+
+// Raw ticks between clock corrections and the range of correction applied
+#define CORRECTION_PERIOD 100000
+#define CORRECTION_RANGE 20
+
+// Largest acceptable lateness of a callback (corrected ticks). Positive phase
+// corrections are applied to the clock immediately and so may make timers late
+// by up to the size of the correction.
+#define MAX_LATENESS CORRECTION_RANGE
+
+
+dclk_state_t dclk;
+
+// The simulated raw clock
+dclk_time_t raw_time = 0;
+
+// The emulated hardware timer
+bool interrupt_enabled = false;
+dclk_time_t interrupt_raw_time;
+dclk_time_t interrupt_deadline;
+unsigned long num_timer_loads = 0;
+
+// Per-timer record of expiries
+typedef struct {
+	vtimer_t timer;
+	dclk_time_t first_time;
+	unsigned long num_fires;
+	dclk_time_t expected_deadline;
+	bool cancelled;
+} test_timer_t;
+
+test_timer_t periodic_timers[NUM_PERIODIC_TIMERS];
+test_timer_t one_shot_timers[NUM_ONE_SHOT_TIMERS];
+vtimer_t cancel_timer;
+
+unsigned long num_fires = 0;
+unsigned long num_errors = 0;
+dclk_offset_t max_lateness = 0;
+dclk_time_t last_deadline = 0;
+
+
+dclk_time_t
+dclk_read_raw_time(void)
+{
+	return raw_time;
+}
+
+
+void
+dtimer_schedule_interrupt_at(volatile dclk_state_t *dclk, dclk_time_t time)
+{
+	dclk_time_t ticks = dclk_get_ticks_until_time(dclk, time);
+	interrupt_raw_time = raw_time + ((ticks > 0) ? ticks : 1);
+	interrupt_deadline = time;
+	interrupt_enabled = true;
+	num_timer_loads++;
+}
+
+
+void
+dtimer_cancel_interrupts(void)
+{
+	interrupt_enabled = false;
+}
+
+
+// Interrupt latency is not modelled
+void
+dtimer_measure_latency(dclk_time_t now)
+{
+}
+
+
+dclk_time_t
+dtimer_get_latency_compensation(void)
+{
+	return 0;
+}
+
+
+/**
+ * A random even number in the range [min, max).
+ */
+dclk_time_t
+rand_even(dclk_time_t min, dclk_time_t max)
+{
+	return (min + (((dclk_time_t)rand() << 8 ^ (dclk_time_t)rand()) % (max - min))) & ~1u;
+}
+
+
+/**
+ * Checks common to all timers.
+ */
+void
+check_expiry(test_timer_t *t, dclk_time_t deadline)
+{
+	dclk_time_t now = dclk_get_time(&dclk);
+	dclk_offset_t lateness = now - deadline;
+	
+	if (lateness < 0) {
+		printf("Timer %p expired %d ticks early.\n", (void *)t, -lateness);
+		num_errors++;
+	}
+	if (lateness > max_lateness)
+		max_lateness = lateness;
+	
+	if (deadline != t->expected_deadline) {
+		printf("Timer %p expired for %u, expected %u.\n"
+		      , (void *)t, deadline, t->expected_deadline);
+		num_errors++;
+	}
+	
+	if ((dclk_offset_t)(deadline - last_deadline) < 0) {
+		printf("Timer %p expired for %u out of order (after %u).\n"
+		      , (void *)t, deadline, last_deadline);
+		num_errors++;
+	}
+	last_deadline = deadline;
+}
+
+
+void
+on_periodic(vtimer_t *timer, dclk_time_t deadline)
+{
+	test_timer_t *t = (test_timer_t *)timer;
+	if ((dclk_offset_t)(deadline - END_TIME) > 0)
+		return;
+	
+	check_expiry(t, deadline);
+	if (t->cancelled) {
+		printf("Timer %p expired after being cancelled.\n", (void *)t);
+		num_errors++;
+	}
+	
+	t->expected_deadline += timer->period;
+	t->num_fires++;
+	num_fires++;
+}
+
+
+void
+on_one_shot(vtimer_t *timer, dclk_time_t deadline)
+{
+	test_timer_t *t = (test_timer_t *)timer;
+	check_expiry(t, deadline);
+	
+	t->num_fires++;
+	num_fires++;
+	
+	// Re-arm from within the callback
+	if (t->num_fires < ONE_SHOT_CHAIN_LENGTH) {
+		t->expected_deadline = deadline + rand_even(MIN_PERIOD, MAX_PERIOD);
+		vtimer_start(timer, t->expected_deadline, 0);
+	}
+}
+
+
+void
+on_cancel(vtimer_t *timer, dclk_time_t deadline)
+{
+	for (int i = 0; i < NUM_PERIODIC_TIMERS; i += CANCEL_EVERY) {
+		vtimer_cancel(&(periodic_timers[i].timer));
+		periodic_timers[i].cancelled = true;
+	}
+}
+
+
+/**
+ * Check that restarting the nearest timer with a later deadline aims the
+ * hardware timer at the new nearest deadline (rather than leaving it to fire
+ * spuriously at the old one).
+ */
+void
+check_restart_nearest(void)
+{
+	vtimer_t a, b;
+	vtimer_init_timer(&a, NULL, 0);
+	vtimer_init_timer(&b, NULL, 0);
+	vtimer_start(&a, 1000, 0);
+	vtimer_start(&b, 2000, 0);
+	vtimer_start(&a, 3000, 0);
+	
+	if (!interrupt_enabled || interrupt_deadline != 2000) {
+		printf("Restarting the nearest timer left the hardware timer aimed at %u, expected 2000.\n"
+		      , interrupt_deadline);
+		num_errors++;
+	}
+	
+	vtimer_cancel(&a);
+	vtimer_cancel(&b);
+	if (interrupt_enabled) {
+		printf("Cancelling every timer left the hardware timer enabled.\n");
+		num_errors++;
+	}
+}
+
+
+int
+main(int argc, char *argv[])
+{
+	srand((argc > 1) ? atoi(argv[1]) : 0);
+	
+	dclk_initialise_state(&dclk);
+	vtimer_initialise(&dclk);
+	
+	check_restart_nearest();
+	num_timer_loads = 0;
+	
+	for (int i = 0; i < NUM_PERIODIC_TIMERS; i++) {
+		test_timer_t *t = &(periodic_timers[i]);
+		t->first_time = rand_even(MIN_PERIOD, MAX_PERIOD);
+		t->expected_deadline = t->first_time;
+		vtimer_init_timer(&(t->timer), on_periodic, i);
+		if (!vtimer_start(&(t->timer), t->first_time, rand_even(MIN_PERIOD, MAX_PERIOD))) {
+			printf("Could not start periodic timer %d.\n", i);
+			num_errors++;
+		}
+	}
+	
+	for (int i = 0; i < NUM_ONE_SHOT_TIMERS; i++) {
+		test_timer_t *t = &(one_shot_timers[i]);
+		t->first_time = rand_even(MIN_PERIOD, MAX_PERIOD);
+		t->expected_deadline = t->first_time;
+		vtimer_init_timer(&(t->timer), on_one_shot, i);
+		if (!vtimer_start(&(t->timer), t->first_time, 0)) {
+			printf("Could not start one-shot timer %d.\n", i);
+			num_errors++;
+		}
+	}
+	
+	vtimer_init_timer(&cancel_timer, on_cancel, 0);
+	vtimer_start(&cancel_timer, CANCEL_TIME, 0);
+	
+	// Run the simulated clock until well past the end time, applying noisy
+	// corrections along the way.
+	clock_t start = clock();
+	dclk_time_t next_correction = CORRECTION_PERIOD;
+	bool first_correction = true;
+	while ((dclk_offset_t)(dclk_get_time(&dclk) - (END_TIME + 2*MAX_PERIOD)) < 0) {
+		if ( interrupt_enabled
+		     && (dclk_offset_t)(interrupt_raw_time - next_correction) < 0
+		   ) {
+			raw_time = interrupt_raw_time;
+			interrupt_enabled = false;
+			vtimer_handle_interrupt();
+		} else {
+			raw_time = next_correction;
+			next_correction += CORRECTION_PERIOD;
+			
+			dclk_offset_t correction = (rand() % (2*CORRECTION_RANGE + 1)) - CORRECTION_RANGE;
+			if (first_correction)
+				dclk_correct_phase_now(&dclk, correction);
+			else
+				dclk_add_correction(&dclk, correction);
+			first_correction = false;
+		}
+	}
+	double duration = ((double)(clock() - start)) / CLOCKS_PER_SEC;
+	
+	// Check that every timer expired the right number of times
+	for (int i = 0; i < NUM_PERIODIC_TIMERS; i++) {
+		test_timer_t *t = &(periodic_timers[i]);
+		dclk_time_t last = t->cancelled ? CANCEL_TIME : END_TIME;
+		unsigned long expected = ((last - t->first_time) / t->timer.period) + 1;
+		if (t->num_fires != expected) {
+			printf("Periodic timer %d expired %lu times, expected %lu.\n"
+			      , i, t->num_fires, expected);
+			num_errors++;
+		}
+	}
+	for (int i = 0; i < NUM_ONE_SHOT_TIMERS; i++) {
+		test_timer_t *t = &(one_shot_timers[i]);
+		if (t->num_fires != ONE_SHOT_CHAIN_LENGTH) {
+			printf("One-shot timer %d expired %lu times, expected %d.\n"
+			      , i, t->num_fires, ONE_SHOT_CHAIN_LENGTH);
+			num_errors++;
+		}
+	}
+	
+	if (max_lateness > MAX_LATENESS) {
+		printf("Timers expired up to %d ticks late.\n", max_lateness);
+		num_errors++;
+	}
+	
+	printf("timers\texpiries\ttimer_loads\tmax_lateness\tus_per_expiry\terrors\n");
+	printf( "%d\t%lu\t%lu\t%d\t%f\t%lu\n"
+	      , NUM_PERIODIC_TIMERS + NUM_ONE_SHOT_TIMERS + 1
+	      , num_fires
+	      , num_timer_loads
+	      , max_lateness
+	      , (duration * 1000000.0) / num_fires
+	      , num_errors
+	      );
+	
+	return num_errors ? 1 : 0;
+}